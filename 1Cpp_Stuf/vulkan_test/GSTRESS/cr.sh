@@ -1,12 +1,23 @@
 #!/bin/bash
 rm -rf build
 rm shader.h
-rm stress.spv
+rm stress.spv peak_*.spv
 
 sleep 6
 glslc stress.comp -o stress.spv
+# One peak module per type; see peak.comp.
+glslc -DPEAK_TYPE=TYPE_INT32 peak.comp -o peak_int32.spv
+glslc -DPEAK_TYPE=TYPE_INT64 peak.comp -o peak_int64.spv
+glslc -DPEAK_TYPE=TYPE_FP32 peak.comp -o peak_fp32.spv
+glslc -DPEAK_TYPE=TYPE_FP16 peak.comp -o peak_fp16.spv
+glslc -DPEAK_TYPE=TYPE_FP64 peak.comp -o peak_fp64.spv
 
 xxd -i stress.spv > shader.h
+xxd -i peak_int32.spv >> shader.h
+xxd -i peak_int64.spv >> shader.h
+xxd -i peak_fp32.spv >> shader.h
+xxd -i peak_fp16.spv >> shader.h
+xxd -i peak_fp64.spv >> shader.h
 mkdir build
 cd build
 cmake ..
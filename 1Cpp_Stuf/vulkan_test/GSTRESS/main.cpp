@@ -1,69 +1,325 @@
 #include <iostream>
 #include <vector>
 #include <stdexcept>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <csignal>
+#include <memory>
 #include <vulkan/vulkan.h>
 
-#include "shader.h" // Will be generated from stress.comp
+#include "../common/vk_context.h"
+#include "../common/primality64.h"
+#include "../common/bench_report.h"
+#include "../common/throughput_monitor.h"
+#include "../common/cpu_stress.h"
+#include "peak_bench.h"
+
+#include "shader.h" // Will be generated from stress.comp and peak.comp
 
 // --- Configuration ---
 const int FRAMES_IN_FLIGHT = 2;
 const uint32_t WORKGROUP_COUNT = 4096;
 const uint32_t WORKGROUP_SIZE = 256;
+const uint32_t INVOCATIONS = WORKGROUP_COUNT * WORKGROUP_SIZE;
+const uint32_t DEFAULT_ITERATIONS = 64;   // numbers per invocation and submit
+const uint32_t MAX_ITERATIONS = 4096;     // keeps the per-workgroup mulmod count in 32 bits
+const uint64_t DEFAULT_START = (1ULL << 40) + 1; // above 2^32, where the Lucas test runs
+const uint32_t VERIFY_SAMPLE = 16;        // invocations the host recomputes per submit
+const uint64_t SELF_CHECK_NUMBERS = 2048; // per range in slowMulmodSelfCheck()
+
+std::atomic<bool> stopRequested{false};
+void onSigint(int) { stopRequested = true; }
+
+// Matches the push constant block of stress.comp (std430: 16 bytes).
+struct PushConstants {
+    uint64_t firstNumber;
+    uint32_t iterations;
+    uint32_t pad;
+};
+
+// fold_prime() of stress.comp.
+uint32_t foldPrime(uint32_t checksum, uint64_t p) {
+    return (checksum ^ uint32_t(p)) * 0x9e3779b1u + uint32_t(p >> 32);
+}
 
-// Helper to find a suitable memory type
-uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
+// What invocation index of the submit starting at firstNumber must report.
+uint32_t expectedChecksum(uint64_t firstNumber, uint32_t index, uint32_t iterations) {
+    uint32_t checksum = 0;
+    uint64_t n = firstNumber + 2 * uint64_t(index);
+    for (uint32_t i = 0; i < iterations; ++i) {
+        if (Primality64::isPrime(n)) checksum = foldPrime(checksum, n);
+        n += 2 * uint64_t(INVOCATIONS);
+    }
+    return checksum;
+}
+
+// --slow-mulmod: the double-and-add twin of the shader (mul_mod_slow) must
+// agree with the Montgomery one the checksums come from, from --start, on
+// either side of 2^63, where mul_mod_slow changes method, and at the top of
+// the range. Returns the number of disagreements.
+uint64_t slowMulmodSelfCheck(uint64_t start) {
+    const uint64_t ranges[] = {start, (1ULL << 63) - SELF_CHECK_NUMBERS, UINT64_MAX - 2 * SELF_CHECK_NUMBERS};
+    uint64_t wrong = 0;
+    for (uint64_t first : ranges) {
+        for (uint64_t n = first | 1, i = 0; i < SELF_CHECK_NUMBERS && n >= first; n += 2, ++i) {
+            bool expected = Primality64::isPrime(n);
+            if (Primality64::isPrimeSlow(n) != expected && wrong++ < 10)
+                std::cerr << "SELF-CHECK: double-and-add says " << n << " is " << (expected ? "composite" : "prime") << std::endl;
         }
     }
-    throw std::runtime_error("Failed to find suitable memory type!");
+    return wrong;
 }
 
-int main() {
-    // --- 1. Vulkan Setup (Standard, Abridged) ---
-    // ... This section is identical to the previous version and is correct ...
-    VkInstance instance; VkApplicationInfo appInfo{}; appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO; appInfo.pApplicationName="GPU Stress Test"; appInfo.apiVersion = VK_API_VERSION_1_2; VkInstanceCreateInfo instInfo{}; instInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO; instInfo.pApplicationInfo = &appInfo; vkCreateInstance(&instInfo, nullptr, &instance); uint32_t deviceCount = 0; vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr); if (deviceCount == 0) throw std::runtime_error("No GPUs with Vulkan support found!"); std::vector<VkPhysicalDevice> devices(deviceCount); vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data()); VkPhysicalDevice physicalDevice = devices[0]; uint32_t queueFamilyIndex = 0; vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &deviceCount, nullptr); std::vector<VkQueueFamilyProperties> queueFamilies(deviceCount); vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &deviceCount, queueFamilies.data()); for(uint32_t i=0; i<deviceCount; ++i) if(queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) { queueFamilyIndex = i; break; } VkDevice device; float queuePriority = 1.0f; VkDeviceQueueCreateInfo queueCreateInfo{}; queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO; queueCreateInfo.queueFamilyIndex = queueFamilyIndex; queueCreateInfo.queueCount = 1; queueCreateInfo.pQueuePriorities = &queuePriority; VkDeviceCreateInfo devInfo{}; devInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO; devInfo.queueCreateInfoCount = 1; devInfo.pQueueCreateInfos = &queueCreateInfo; vkCreateDevice(physicalDevice, &devInfo, nullptr, &device); VkQueue computeQueue; vkGetDeviceQueue(device, queueFamilyIndex, 0, &computeQueue);
+struct Frame {
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    VkBuffer resultBuffer;
+    VkDeviceMemory resultMemory;
+    const uint32_t* results; // checksums, then per-workgroup mulmod counts
+    VkDescriptorSet descriptorSet;
+    PushConstants push;
+    bool pending = false;
+    std::chrono::steady_clock::time_point submitted;
+};
+
+int main(int argc, char* argv[]) {
+    // --slow-mulmod keeps the original double-and-add mul_mod in the shader,
+    // which is far heavier per number than the default Montgomery path.
+    VkBool32 slowMulmod = VK_FALSE;
+    std::string deviceSelector; // --device: index, part of the name or UUID
+    uint32_t iterations = DEFAULT_ITERATIONS;
+    uint64_t start = DEFAULT_START;
+    MonitorOptions monitorOptions; // --csv, --drop
+    CpuStressOptions cpuOptions;   // --cpu and friends
+    bool peak = false;             // --peak: the ALU throughput table instead of the stress run
+    std::string jsonPath;          // --json: its report
+    auto usage = [&]() {
+        std::cerr << "Usage: " << argv[0] << " [--slow-mulmod] [--device <index|name|uuid>] [--iterations <numbers per invocation, 1-" << MAX_ITERATIONS << ">] [--start <n>]"
+                  << " [--csv <per-second samples>] [--drop <percent below baseline to flag, default 10>]" << CPU_USAGE
+                  << "\n       " << argv[0] << " --peak [--device <index|name|uuid>] [--json <report>]" << std::endl;
+    };
+    // Bad values end up in the catch below with the usage, before any GPU setup.
+    for (int i = 1; i < argc; ++i) {
+        try {
+            if (strcmp(argv[i], "--slow-mulmod") == 0) slowMulmod = VK_TRUE;
+            else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) deviceSelector = argv[++i];
+            else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) iterations = uint32_t(std::stoul(argv[++i]));
+            else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) start = std::stoull(argv[++i]) | 1;
+            else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) monitorOptions.csvPath = argv[++i];
+            else if (strcmp(argv[i], "--drop") == 0 && i + 1 < argc) monitorOptions.dropFraction = parseDropPercent(argv[++i]);
+            else if (strcmp(argv[i], "--peak") == 0) peak = true;
+            else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) jsonPath = argv[++i];
+            else if (parseCpuStressOption(argc, argv, i, cpuOptions)) {}
+            else {
+                usage();
+                return 1;
+            }
+        } catch (const std::logic_error&) { // std::stoul and friends: not a number, or out of range
+            std::cerr << "Error: " << argv[i - 1] << " " << argv[i] << ": not a valid number" << std::endl;
+            usage();
+            return 1;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            usage();
+            return 1;
+        }
+    }
+    if (iterations == 0 || iterations > MAX_ITERATIONS) {
+        std::cerr << "--iterations must be 1 to " << MAX_ITERATIONS << std::endl;
+        return 1;
+    }
+    if (slowMulmod) {
+        uint64_t wrong = slowMulmodSelfCheck(start);
+        if (wrong != 0) {
+            std::cerr << "--slow-mulmod self-check: " << wrong << " of " << 3 * SELF_CHECK_NUMBERS << " numbers disagree with the Montgomery path" << std::endl;
+            return 1;
+        }
+    }
+    if (cpuOptions.alone) {
+        if (cpuOptions.kernel.empty()) {
+            std::cerr << "--cpu-only needs --cpu <" << CPU_KERNELS << ">" << std::endl;
+            return 1;
+        }
+        std::signal(SIGINT, onSigint);
+        return CpuStress::runAlone(cpuOptions, stopRequested);
+    }
+
+    // --- 1. Vulkan Setup (shared with the other tools, ../common/vk_context.h) ---
+    VulkanContext vulkan(deviceSelector, "GPU Stress Test");
+    VkDevice device = vulkan.device; VkQueue computeQueue = vulkan.computeQueue; uint32_t queueFamilyIndex = vulkan.queueFamilyIndex;
+    std::cout << "Device " << vulkan.deviceIndex << ": " << vulkan.properties.deviceName << " (" << vulkan.deviceType() << ")" << std::endl;
+    if (peak) {
+        return runPeakBench(vulkan, {{peak_int32_spv, sizeof(peak_int32_spv)}, {peak_int64_spv, sizeof(peak_int64_spv)}, {peak_fp32_spv, sizeof(peak_fp32_spv)},
+                                     {peak_fp16_spv, sizeof(peak_fp16_spv)}, {peak_fp64_spv, sizeof(peak_fp64_spv)}}, jsonPath);
+    }
+    if (!vulkan.enabledFeatures.shaderInt64) throw std::runtime_error("The device has no shaderInt64");
 
-    // --- 2. Create Vulkan Resources (Standard) ---
-    // ... This section is also identical and correct ...
-    VkBuffer resultBuffer; VkDeviceMemory resultMemory; const size_t bufferSize = sizeof(uint32_t) * WORKGROUP_COUNT * WORKGROUP_SIZE; VkBufferCreateInfo bufferInfo{}; bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO; bufferInfo.size = bufferSize; bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT; vkCreateBuffer(device, &bufferInfo, nullptr, &resultBuffer); VkMemoryRequirements memRequirements; vkGetBufferMemoryRequirements(device, resultBuffer, &memRequirements); VkMemoryAllocateInfo allocInfo{}; allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO; allocInfo.allocationSize = memRequirements.size; allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT); vkAllocateMemory(device, &allocInfo, nullptr, &resultMemory); vkBindBufferMemory(device, resultBuffer, resultMemory, 0); VkShaderModule computeShaderModule; VkShaderModuleCreateInfo smInfo{}; smInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO; smInfo.codeSize = sizeof(stress_spv); smInfo.pCode = reinterpret_cast<const uint32_t*>(stress_spv); vkCreateShaderModule(device, &smInfo, nullptr, &computeShaderModule); VkDescriptorSetLayoutBinding binding{}; binding.binding = 0; binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; binding.descriptorCount = 1; binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT; VkDescriptorSetLayoutCreateInfo layoutInfo{}; layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO; layoutInfo.bindingCount = 1; layoutInfo.pBindings = &binding; VkDescriptorSetLayout descriptorSetLayout; vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout); VkPipelineLayoutCreateInfo pipelineLayoutInfo{}; pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO; pipelineLayoutInfo.setLayoutCount = 1; pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout; VkPipelineLayout pipelineLayout; vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout); VkPipeline computePipeline; VkComputePipelineCreateInfo pipelineInfo{}; pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO; pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO; pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT; pipelineInfo.stage.module = computeShaderModule; pipelineInfo.stage.pName = "main"; pipelineInfo.layout = pipelineLayout; vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline); VkDescriptorPool descriptorPool; VkDescriptorPoolSize poolSize{}; poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; poolSize.descriptorCount = 1; VkDescriptorPoolCreateInfo poolInfo{}; poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO; poolInfo.poolSizeCount = 1; poolInfo.pPoolSizes = &poolSize; poolInfo.maxSets = 1; vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool); VkDescriptorSet descriptorSet; VkDescriptorSetAllocateInfo dsAllocInfo{}; dsAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO; dsAllocInfo.descriptorPool = descriptorPool; dsAllocInfo.descriptorSetCount = 1; dsAllocInfo.pSetLayouts = &descriptorSetLayout; vkAllocateDescriptorSets(device, &dsAllocInfo, &descriptorSet); VkDescriptorBufferInfo bufferDescInfo{}; bufferDescInfo.buffer = resultBuffer; bufferDescInfo.offset = 0; bufferDescInfo.range = VK_WHOLE_SIZE; VkWriteDescriptorSet descriptorWrite{}; descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; descriptorWrite.dstSet = descriptorSet; descriptorWrite.dstBinding = 0; descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; descriptorWrite.descriptorCount = 1; descriptorWrite.pBufferInfo = &bufferDescInfo; vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr); VkCommandPool commandPool; VkCommandPoolCreateInfo cpInfo{}; cpInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO; cpInfo.queueFamilyIndex = queueFamilyIndex; vkCreateCommandPool(device, &cpInfo, nullptr, &commandPool); std::vector<VkCommandBuffer> commandBuffers(FRAMES_IN_FLIGHT); std::vector<VkFence> inFlightFences(FRAMES_IN_FLIGHT); VkCommandBufferAllocateInfo cbAllocInfo{}; cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO; cbAllocInfo.commandPool = commandPool; cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbAllocInfo.commandBufferCount = (uint32_t)FRAMES_IN_FLIGHT; vkAllocateCommandBuffers(device, &cbAllocInfo, commandBuffers.data()); VkFenceCreateInfo fenceInfo{}; fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO; fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; for (int i = 0; i < FRAMES_IN_FLIGHT; i++) { vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]); }
+    // --- 2. Create Vulkan Resources ---
+    // One host-visible result buffer per frame: the host reads a sample of checksums and the workgroup counts back.
+    const VkDeviceSize bufferSize = sizeof(uint32_t) * (INVOCATIONS + WORKGROUP_COUNT);
+    std::vector<Frame> frames(FRAMES_IN_FLIGHT);
+    for (Frame& frame : frames) {
+        void* data;
+        vulkan.createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.resultBuffer, frame.resultMemory);
+        vkMapMemory(device, frame.resultMemory, 0, bufferSize, 0, &data);
+        frame.results = static_cast<const uint32_t*>(data);
+    }
+    VkShaderModule computeShaderModule = vulkan.createShaderModule(stress_spv, sizeof(stress_spv));
+    VkDescriptorSetLayoutBinding binding{}; binding.binding = 0; binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; binding.descriptorCount = 1; binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT; VkDescriptorSetLayoutCreateInfo layoutInfo{}; layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO; layoutInfo.bindingCount = 1; layoutInfo.pBindings = &binding; VkDescriptorSetLayout descriptorSetLayout; vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout);
+    VkPushConstantRange pushConstantRange{}; pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT; pushConstantRange.offset = 0; pushConstantRange.size = sizeof(PushConstants);
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{}; pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO; pipelineLayoutInfo.setLayoutCount = 1; pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout; pipelineLayoutInfo.pushConstantRangeCount = 1; pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange; VkPipelineLayout pipelineLayout; vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout);
+    VkSpecializationMapEntry specEntry{}; specEntry.constantID = 0; specEntry.offset = 0; specEntry.size = sizeof(VkBool32); VkSpecializationInfo specInfo{}; specInfo.mapEntryCount = 1; specInfo.pMapEntries = &specEntry; specInfo.dataSize = sizeof(VkBool32); specInfo.pData = &slowMulmod;
+    VkPipeline computePipeline; VkComputePipelineCreateInfo pipelineInfo{}; pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO; pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO; pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT; pipelineInfo.stage.module = computeShaderModule; pipelineInfo.stage.pName = "main"; pipelineInfo.stage.pSpecializationInfo = &specInfo; pipelineInfo.layout = pipelineLayout; vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline);
+    VkDescriptorPool descriptorPool; VkDescriptorPoolSize poolSize{}; poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; poolSize.descriptorCount = FRAMES_IN_FLIGHT; VkDescriptorPoolCreateInfo poolInfo{}; poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO; poolInfo.poolSizeCount = 1; poolInfo.pPoolSizes = &poolSize; poolInfo.maxSets = FRAMES_IN_FLIGHT; vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
+    VkCommandPool commandPool; VkCommandPoolCreateInfo cpInfo{}; cpInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO; cpInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; cpInfo.queueFamilyIndex = queueFamilyIndex; vkCreateCommandPool(device, &cpInfo, nullptr, &commandPool);
+    for (Frame& frame : frames) {
+        VkDescriptorSetAllocateInfo dsAllocInfo{}; dsAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO; dsAllocInfo.descriptorPool = descriptorPool; dsAllocInfo.descriptorSetCount = 1; dsAllocInfo.pSetLayouts = &descriptorSetLayout; vkAllocateDescriptorSets(device, &dsAllocInfo, &frame.descriptorSet);
+        VkDescriptorBufferInfo bufferDescInfo{}; bufferDescInfo.buffer = frame.resultBuffer; bufferDescInfo.offset = 0; bufferDescInfo.range = VK_WHOLE_SIZE;
+        VkWriteDescriptorSet descriptorWrite{}; descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; descriptorWrite.dstSet = frame.descriptorSet; descriptorWrite.dstBinding = 0; descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; descriptorWrite.descriptorCount = 1; descriptorWrite.pBufferInfo = &bufferDescInfo; vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+        VkCommandBufferAllocateInfo cbAllocInfo{}; cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO; cbAllocInfo.commandPool = commandPool; cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbAllocInfo.commandBufferCount = 1; vkAllocateCommandBuffers(device, &cbAllocInfo, &frame.commandBuffer);
+        VkFenceCreateInfo fenceInfo{}; fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO; vkCreateFence(device, &fenceInfo, nullptr, &frame.fence);
+    }
+
+    // Two timestamps per frame, around the dispatch.
+    const bool timed = vulkan.timestampValidBits != 0;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (timed) {
+        VkQueryPoolCreateInfo qpInfo{}; qpInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO; qpInfo.queryType = VK_QUERY_TYPE_TIMESTAMP; qpInfo.queryCount = 2 * FRAMES_IN_FLIGHT;
+        vkCreateQueryPool(device, &qpInfo, nullptr, &queryPool);
+    } else {
+        std::cout << "No timestamps on this queue; rates use the host's submit-to-fence time." << std::endl;
+    }
 
-    // --- 3. The Final, Unthrottled Stress Loop ---
+    // --- 3. The Stress Loop, Measured and Verified ---
     std::cout << "*******************************************" << std::endl;
     std::cout << "***     GPU STRESS TEST IS RUNNING      ***" << std::endl;
     std::cout << "***  This is the maximum throughput test.   ***"
     "\n***     Press Ctrl+C to exit.         ***" << std::endl;
     std::cout << "*******************************************" << std::endl;
+    std::cout << iterations << " numbers per invocation, " << double(INVOCATIONS) * iterations / 1e6 << "M per submit, from " << start
+              << " (" << (slowMulmod ? "double-and-add" : "Montgomery") << " mul_mod)" << std::endl;
+
+    using Clock = std::chrono::steady_clock;
+    const double numbersPerSubmit = double(INVOCATIONS) * iterations;
+    uint64_t nextNumber = start, submits = 0, mismatches = 0;
+    double totalSeconds = 0.0, totalMulmods = 0.0;
+    RunningStats numberRate, mulmodRate; // per submit, over the whole run
+    RunningStats secondNumbers, secondMulmods; // per submit, since the last status line
+    Clock::time_point runStart = Clock::now(), lastStatus = runStart;
+    ThroughputMonitor monitor("numbers", monitorOptions);
+    std::unique_ptr<CpuStress> cpu; // --cpu: the CPU loaded alongside
+    if (!cpuOptions.kernel.empty()) cpu.reset(new CpuStress(cpuOptions));
+
+    // Waits for a frame, checks its sample and books its rates.
+    auto collect = [&](Frame& frame, int index) {
+        vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+        Clock::time_point done = Clock::now();
+        vkResetFences(device, 1, &frame.fence);
+        frame.pending = false;
+
+        double seconds = std::chrono::duration<double>(done - frame.submitted).count();
+        if (timed) {
+            uint64_t ticks[2];
+            vkGetQueryPoolResults(device, queryPool, 2 * index, 2, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+            seconds = double((ticks[1] - ticks[0]) & vulkan.timestampMask()) * vulkan.timestampPeriodNs * 1e-9;
+        }
+        double mulmods = 0.0;
+        for (uint32_t g = 0; g < WORKGROUP_COUNT; ++g) mulmods += frame.results[INVOCATIONS + g];
 
+        // A different, spread-out sample every submit.
+        for (uint32_t k = 0; k < VERIFY_SAMPLE; ++k) {
+            uint32_t inv = uint32_t((uint64_t(k) * (INVOCATIONS / VERIFY_SAMPLE) + submits * 7919) % INVOCATIONS);
+            uint32_t expected = expectedChecksum(frame.push.firstNumber, inv, frame.push.iterations);
+            if (frame.results[inv] != expected) {
+                ++mismatches;
+                std::cerr << "CHECKSUM MISMATCH: submit from " << frame.push.firstNumber << ", invocation " << inv << ": GPU " << frame.results[inv] << ", host " << expected << std::endl;
+            }
+        }
+
+        monitor.completed(uint64_t(numbersPerSubmit), timed ? seconds : 0.0);
+        ++submits;
+        totalSeconds += seconds;
+        totalMulmods += mulmods;
+        numberRate.add(numbersPerSubmit / seconds);
+        mulmodRate.add(mulmods / seconds);
+        secondNumbers.add(numbersPerSubmit / seconds);
+        secondMulmods.add(mulmods / seconds);
+        if (std::chrono::duration<double>(done - lastStatus).count() >= 1.0) {
+            std::cout << "[" << std::chrono::duration<double>(done - runStart).count() << " s] " << secondNumbers.count << " submits, "
+                      << secondNumbers.mean / 1e6 << "M numbers/s (" << secondNumbers.min / 1e6 << " - " << secondNumbers.max / 1e6 << "), "
+                      << secondMulmods.mean / 1e9 << "G mulmods/s, " << mismatches << " checksum mismatches" << std::endl;
+            secondNumbers = RunningStats();
+            secondMulmods = RunningStats();
+            lastStatus = done;
+        }
+    };
+
+    std::signal(SIGINT, onSigint);
     int currentFrame = 0;
-    while (true) {
+    while (!stopRequested) {
+        Frame& frame = frames[currentFrame];
         // Wait for the frame's resources to be free
-        vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
-        vkResetFences(device, 1, &inFlightFences[currentFrame]);
+        if (frame.pending) collect(frame, currentFrame);
 
         // Record the command buffer
-        VkCommandBuffer cb = commandBuffers[currentFrame];
+        frame.push = {nextNumber, iterations, 0};
+        nextNumber += 2 * uint64_t(numbersPerSubmit);
+        VkCommandBuffer cb = frame.commandBuffer;
         vkResetCommandBuffer(cb, 0);
         VkCommandBufferBeginInfo beginInfo{}; beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
         vkBeginCommandBuffer(cb, &beginInfo);
+        if (timed) {
+            vkCmdResetQueryPool(cb, queryPool, 2 * currentFrame, 2);
+            vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 2 * currentFrame);
+        }
         vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
-        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+        vkCmdPushConstants(cb, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &frame.push);
         vkCmdDispatch(cb, WORKGROUP_COUNT, 1, 1);
+        if (timed) vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2 * currentFrame + 1);
+        // Make the shader writes visible to the host mapping before the fence signals.
+        VkMemoryBarrier hostBarrier{}; hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; hostBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT; hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
         vkEndCommandBuffer(cb);
 
         // Submit to the GPU. THERE IS NO SLEEP.
         VkSubmitInfo submitInfo{}; submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; submitInfo.commandBufferCount = 1; submitInfo.pCommandBuffers = &cb;
-        vkQueueSubmit(computeQueue, 1, &submitInfo, inFlightFences[currentFrame]);
+        frame.submitted = Clock::now();
+        if (vkQueueSubmit(computeQueue, 1, &submitInfo, frame.fence) != VK_SUCCESS) throw std::runtime_error("vkQueueSubmit failed (device lost?)");
+        frame.pending = true;
 
         // Move to the next frame
         currentFrame = (currentFrame + 1) % FRAMES_IN_FLIGHT;
     }
+    for (int f = 0; f < FRAMES_IN_FLIGHT; ++f) {
+        int index = (currentFrame + f) % FRAMES_IN_FLIGHT;
+        if (frames[index].pending) collect(frames[index], index);
+    }
+
+    std::cout << "--- Summary: " << submits << " submits, " << numbersPerSubmit * submits / 1e9 << "G numbers tested in " << totalSeconds << " s of "
+              << (timed ? "GPU" : "submit-to-fence") << " time: " << numbersPerSubmit * submits / totalSeconds / 1e6 << "M numbers/s, "
+              << totalMulmods / totalSeconds / 1e9 << "G mulmods/s (per submit: " << numberRate.mean / 1e6 << "M +- " << numberRate.stddev() / 1e6
+              << "M numbers/s, " << mulmodRate.mean / 1e9 << "G +- " << mulmodRate.stddev() / 1e9 << "G mulmods/s), "
+              << mismatches << " checksum mismatches in " << submits * VERIFY_SAMPLE << " checked invocations ---" << std::endl;
+    monitor.stop();
+    if (cpu) cpu->stop();
 
     // --- 4. Cleanup ---
     vkDeviceWaitIdle(device);
-    // ... all vkDestroy calls ...
-    return 0;
+    for (Frame& frame : frames) {
+        vkDestroyFence(device, frame.fence, nullptr);
+        vkUnmapMemory(device, frame.resultMemory);
+        vkDestroyBuffer(device, frame.resultBuffer, nullptr);
+        vkFreeMemory(device, frame.resultMemory, nullptr);
+    }
+    if (queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(device, queryPool, nullptr);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyPipeline(device, computePipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    vkDestroyShaderModule(device, computeShaderModule, nullptr);
+    return mismatches == 0 ? 0 : 1;
 }
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../common/vk_context.h"
+#include "../common/compute_kernel.h"
+#include "../common/bench_report.h"
+
+/*
+ * GSTRESS --peak: the ALU ceiling the stress kernel is measured against.
+ * For every type (int32, int64, fp32, fp16, fp64) and operation (add,
+ * mul, mad, mulhi) peak.comp runs long unrolled chains of that one
+ * instruction with no memory traffic, and the table gives Gops/s: the
+ * best of PEAK_REPEATS dispatches, each calibrated to PEAK_TARGET_SECONDS.
+ *
+ * A mad counts as one operation, as the vendors' "FMA rate" does not; a
+ * packed fp16 pair counts as two. int64 is whatever the compiler builds
+ * it from (no GPU has a 64-bit multiplier), and its mulhi is mul64_wide,
+ * the Montgomery product of the primality kernels. Floats have no mulhi.
+ *
+ * A type the device lacks the feature for (shaderInt64, shaderFloat64,
+ * shaderFloat16) is skipped with the reason; its module is never loaded.
+ */
+
+const uint32_t PEAK_TYPE_COUNT = 5;
+const uint32_t PEAK_OP_COUNT = 4;
+const char* const PEAK_TYPE_NAMES[PEAK_TYPE_COUNT] = {"int32", "int64", "fp32", "fp16", "fp64"};
+const char* const PEAK_OP_NAMES[PEAK_OP_COUNT] = {"add", "mul", "mad", "mulhi"};
+const uint32_t PEAK_MULHI = 3;
+const uint32_t PEAK_CHAINS = 8;   // peak.comp
+const uint32_t PEAK_UNROLL = 16;  // peak.comp
+const uint32_t PEAK_WORKGROUPS = 4096;
+const uint32_t PEAK_INVOCATIONS = PEAK_WORKGROUPS * 256;
+const uint32_t PEAK_REPEATS = 5;
+const double PEAK_TARGET_SECONDS = 0.05; // per dispatch: well inside any watchdog
+
+// One peak.comp module, in PEAK_TYPE_NAMES order.
+struct PeakShader {
+    const void* spirv;
+    size_t size;
+};
+
+// Matches the push constant block of peak.comp.
+struct PeakPush {
+    uint32_t iterations;
+    uint32_t intA, intB;
+    float floatA, floatB;
+};
+
+// Why the device cannot run a type, or nullptr.
+inline const char* peakMissingFeature(const VulkanContext& vulkan, uint32_t type) {
+    switch (type) {
+    case 1: return vulkan.enabledFeatures.shaderInt64 ? nullptr : "no shaderInt64";
+    case 3: return vulkan.enabled12.shaderFloat16 ? nullptr : "no shaderFloat16 (or Vulkan below 1.2)";
+    case 4: return vulkan.enabledFeatures.shaderFloat64 ? nullptr : "no shaderFloat64";
+    default: return nullptr;
+    }
+}
+
+inline int runPeakBench(const VulkanContext& vulkan, const std::vector<PeakShader>& shaders, const std::string& jsonPath) {
+    if (shaders.size() != PEAK_TYPE_COUNT) throw std::runtime_error("runPeakBench: one shader per type");
+    VkDevice device = vulkan.device;
+
+    VkBuffer sink; VkDeviceMemory sinkMemory;
+    vulkan.createBuffer(sizeof(uint32_t) * PEAK_INVOCATIONS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sink, sinkMemory);
+
+    const bool fp16Storage = vulkan.enabled11.storageBuffer16BitAccess;
+    std::cout << "Peak ALU throughput on " << vulkan.properties.deviceName << ": Gops/s, best of " << PEAK_REPEATS << " dispatches of "
+              << PEAK_INVOCATIONS << " invocations x " << PEAK_CHAINS << " chains" << std::endl;
+    std::cout << "  shaderInt64 " << (vulkan.enabledFeatures.shaderInt64 ? "yes" : "no") << ", shaderFloat64 " << (vulkan.enabledFeatures.shaderFloat64 ? "yes" : "no")
+              << ", shaderFloat16 " << (vulkan.enabled12.shaderFloat16 ? "yes" : "no") << ", shaderInt16 " << (vulkan.enabledFeatures.shaderInt16 ? "yes" : "no")
+              << ", storageBuffer16BitAccess " << (fp16Storage ? "yes" : "no") << std::endl;
+    std::printf("%8s", "type");
+    for (uint32_t op = 0; op < PEAK_OP_COUNT; ++op) std::printf("%12s", PEAK_OP_NAMES[op]);
+    std::printf("\n");
+
+    double gops[PEAK_TYPE_COUNT][PEAK_OP_COUNT];
+    uint32_t calibrated[PEAK_TYPE_COUNT][PEAK_OP_COUNT] = {};
+    for (uint32_t type = 0; type < PEAK_TYPE_COUNT; ++type) {
+        std::fill(gops[type], gops[type] + PEAK_OP_COUNT, NAN);
+        std::printf("%8s", PEAK_TYPE_NAMES[type]);
+        if (const char* missing = peakMissingFeature(vulkan, type)) {
+            std::printf("  skipped: %s\n", missing);
+            continue;
+        }
+        const bool integer = type <= 1;
+        const double opsPerIteration = double(PEAK_INVOCATIONS) * PEAK_CHAINS * PEAK_UNROLL * (type == 3 ? 2 : 1);
+        VkShaderModule module = vulkan.createShaderModule(shaders[type].spirv, shaders[type].size);
+        for (uint32_t op = 0; op < PEAK_OP_COUNT; ++op) {
+            if (op == PEAK_MULHI && !integer) { std::printf("%12s", "-"); continue; }
+            ComputeKernel kernel(vulkan, module, 1, sizeof(PeakPush), {op});
+            kernel.bind({sink});
+
+            // Operands that keep float chains finite and normal: see peak.comp.
+            PeakPush push{8, 0x9e3779b9u, 0x7f4a7c15u, op == 0 ? 1.0f / 1024 : op == 1 ? 1.0f : 0.5f, 1.0f};
+            double seconds = kernel.run(PEAK_WORKGROUPS, &push); // also warms up the clocks
+            push.iterations = uint32_t(std::clamp(push.iterations * PEAK_TARGET_SECONDS / std::max(seconds, 1e-6), 1.0, double(1u << 20)));
+            double best = INFINITY;
+            for (uint32_t r = 0; r < PEAK_REPEATS; ++r) best = std::min(best, kernel.run(PEAK_WORKGROUPS, &push));
+            gops[type][op] = opsPerIteration * push.iterations / best / 1e9;
+            calibrated[type][op] = push.iterations;
+            std::printf("%12.1f", gops[type][op]);
+            std::fflush(stdout);
+        }
+        std::printf("\n");
+        vkDestroyShaderModule(device, module, nullptr);
+    }
+
+    if (!jsonPath.empty()) {
+        std::ofstream out(jsonPath);
+        if (!out) throw std::runtime_error("Cannot write " + jsonPath);
+        JsonWriter json(out);
+        json.beginObject();
+        json.value("tool", "gstress-peak");
+        json.device("device", vulkan);
+        json.beginObject("features");
+        json.value("shaderInt64", bool(vulkan.enabledFeatures.shaderInt64));
+        json.value("shaderFloat64", bool(vulkan.enabledFeatures.shaderFloat64));
+        json.value("shaderInt16", bool(vulkan.enabledFeatures.shaderInt16));
+        json.value("shaderFloat16", bool(vulkan.enabled12.shaderFloat16));
+        json.value("shaderInt8", bool(vulkan.enabled12.shaderInt8));
+        json.value("storageBuffer16BitAccess", fp16Storage);
+        json.endObject();
+        json.value("invocations", PEAK_INVOCATIONS);
+        json.value("chains", PEAK_CHAINS);
+        json.value("unroll", PEAK_UNROLL);
+        json.value("repeats", PEAK_REPEATS);
+        json.beginArray("results");
+        for (uint32_t type = 0; type < PEAK_TYPE_COUNT; ++type) {
+            const char* missing = peakMissingFeature(vulkan, type);
+            json.beginObject();
+            json.value("type", PEAK_TYPE_NAMES[type]);
+            json.value("supported", missing == nullptr);
+            if (missing) json.value("reason", missing);
+            json.beginObject("gops");
+            for (uint32_t op = 0; op < PEAK_OP_COUNT; ++op) json.value(PEAK_OP_NAMES[op], gops[type][op]); // NaN: null
+            json.endObject();
+            json.beginObject("iterations");
+            for (uint32_t op = 0; op < PEAK_OP_COUNT; ++op) {
+                if (calibrated[type][op]) json.value(PEAK_OP_NAMES[op], calibrated[type][op]);
+                else json.null(PEAK_OP_NAMES[op]);
+            }
+            json.endObject();
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+        json.finish();
+        std::cout << "Report written to " << jsonPath << std::endl;
+    }
+
+    vkDestroyBuffer(device, sink, nullptr);
+    vkFreeMemory(device, sinkMemory, nullptr);
+    return 0;
+}
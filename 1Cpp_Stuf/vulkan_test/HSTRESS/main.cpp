@@ -1,8 +1,20 @@
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <cstdio>
 #include <stdexcept>
+#include <string>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <csignal>
 #include <vulkan/vulkan.h>
 
+#include "../common/vk_context.h"
+#include "../common/throughput_monitor.h"
+#include "../common/cpu_stress.h"
+
 #include "shader.h" // Will be generated from hybrid_stress.comp
 
 // --- Configuration ---
@@ -10,41 +22,186 @@ const int FRAMES_IN_FLIGHT = 2;
 const uint32_t WORKGROUP_COUNT = 4096;
 const uint32_t WORKGROUP_SIZE = 256;
 const uint32_t BUFFER_ELEMENTS = 64 * 1024 * 1024; // 64 Million uints = 256 MB
+const uint32_t ELEMENTS_PER_INVOCATION = 500;      // the outer loop of hybrid_stress.comp
+const int SCALING_WARMUP_SECONDS = 1;
+const uint64_t ELEMENTS_PER_DISPATCH = uint64_t(WORKGROUP_COUNT) * WORKGROUP_SIZE * ELEMENTS_PER_INVOCATION;
+
+std::atomic<bool> stopRequested{false};
+void onSigint(int) { stopRequested = true; }
 
-// Helper to find a suitable memory type
-uint32_t findMemoryType(VkPhysicalDevice pDevice, uint32_t typeFilter, VkMemoryPropertyFlags props) {
-    VkPhysicalDeviceMemoryProperties memProps;
-    vkGetPhysicalDeviceMemoryProperties(pDevice, &memProps);
-    for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProps.memoryTypes[i].propertyFlags & props) == props) {
-            return i;
+// One independent submit stream on one queue: its own thread, command
+// pool, command buffers and fences, recording and submitting the same
+// dispatch with FRAMES_IN_FLIGHT in flight until stop is set. The
+// pipeline, descriptor set and buffers are shared: the shader only reads
+// the input, and every stream writes the same values to the output.
+// On a queue with timestamps every dispatch is timed, so the monitor's
+// gpu_busy column is the GPU time of the stream's dispatches.
+struct QueueStream {
+    VkDevice device;
+    VulkanQueue queue;
+    double timestampPeriodNs;
+    VkPipeline pipeline;
+    VkPipelineLayout pipelineLayout;
+    VkDescriptorSet dSet;
+    std::atomic<uint64_t> completed{0}; // dispatches whose fence has signalled
+    ThroughputMonitor* monitor = nullptr; // told about every completed dispatch, when set
+    std::thread thread;
+
+    void run(const std::atomic<bool>& stop) {
+        VkCommandPool cmdPool;
+        VkCommandPoolCreateInfo cpInfo{}; cpInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO; cpInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; cpInfo.queueFamilyIndex = queue.family;
+        vkCreateCommandPool(device, &cpInfo, nullptr, &cmdPool);
+        std::vector<VkCommandBuffer> cmdBuffers(FRAMES_IN_FLIGHT);
+        std::vector<VkFence> fences(FRAMES_IN_FLIGHT);
+        VkCommandBufferAllocateInfo cbAllocInfo{}; cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO; cbAllocInfo.commandPool = cmdPool; cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbAllocInfo.commandBufferCount = FRAMES_IN_FLIGHT;
+        vkAllocateCommandBuffers(device, &cbAllocInfo, cmdBuffers.data());
+        VkFenceCreateInfo fenceInfo{}; fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) vkCreateFence(device, &fenceInfo, nullptr, &fences[i]);
+        // Two timestamps per frame, around the dispatch.
+        const bool timed = queue.timestampValidBits != 0;
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        if (timed) {
+            VkQueryPoolCreateInfo qpInfo{}; qpInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO; qpInfo.queryType = VK_QUERY_TYPE_TIMESTAMP; qpInfo.queryCount = 2 * FRAMES_IN_FLIGHT;
+            vkCreateQueryPool(device, &qpInfo, nullptr, &queryPool);
         }
+
+        std::vector<bool> pending(FRAMES_IN_FLIGHT, false);
+        for (int frame = 0; !stop.load(std::memory_order_relaxed); frame = (frame + 1) % FRAMES_IN_FLIGHT) {
+            if (pending[frame]) {
+                vkWaitForFences(device, 1, &fences[frame], VK_TRUE, UINT64_MAX);
+                vkResetFences(device, 1, &fences[frame]);
+                completed.fetch_add(1, std::memory_order_relaxed);
+                double gpuSeconds = 0.0;
+                if (timed) {
+                    uint64_t ticks[2];
+                    vkGetQueryPoolResults(device, queryPool, 2 * frame, 2, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+                    gpuSeconds = double((ticks[1] - ticks[0]) & VulkanContext::timestampMask(queue.timestampValidBits)) * timestampPeriodNs * 1e-9;
+                }
+                if (monitor) monitor->completed(ELEMENTS_PER_DISPATCH, gpuSeconds);
+            }
+            VkCommandBuffer cb = cmdBuffers[frame];
+            vkResetCommandBuffer(cb, 0);
+            VkCommandBufferBeginInfo beginInfo{}; beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            vkBeginCommandBuffer(cb, &beginInfo);
+            if (timed) {
+                vkCmdResetQueryPool(cb, queryPool, 2 * frame, 2);
+                vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 2 * frame);
+            }
+            vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+            vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &dSet, 0, nullptr);
+            uint32_t buffer_elements_const = BUFFER_ELEMENTS;
+            vkCmdPushConstants(cb, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &buffer_elements_const);
+            vkCmdDispatch(cb, WORKGROUP_COUNT, 1, 1);
+            if (timed) vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2 * frame + 1);
+            vkEndCommandBuffer(cb);
+            VkSubmitInfo submitInfo{}; submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; submitInfo.commandBufferCount = 1; submitInfo.pCommandBuffers = &cb;
+            if (vkQueueSubmit(queue.queue, 1, &submitInfo, fences[frame]) != VK_SUCCESS) {
+                std::cerr << "vkQueueSubmit failed on queue " << queue.family << "." << queue.index << " (device lost?)" << std::endl;
+                break;
+            }
+            pending[frame] = true;
+        }
+
+        for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+            if (pending[i]) vkWaitForFences(device, 1, &fences[i], VK_TRUE, UINT64_MAX);
+            vkDestroyFence(device, fences[i], nullptr);
+        }
+        if (queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(device, queryPool, nullptr);
+        vkDestroyCommandPool(device, cmdPool, nullptr);
     }
-    throw std::runtime_error("Failed to find suitable memory type!");
+};
+
+// Sleeps for seconds, or until Ctrl+C.
+void sleepUnlessStopped(int seconds) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    while (!stopRequested && std::chrono::steady_clock::now() < end) std::this_thread::sleep_for(std::chrono::milliseconds(100));
 }
 
-// Helper to create a device-local buffer
-void createDeviceBuffer(VkDevice device, VkPhysicalDevice pDevice, VkDeviceSize size, VkBuffer& buffer, VkDeviceMemory& memory) {
-    VkBufferCreateInfo bufferInfo{};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = size;
-    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
-
-    VkMemoryRequirements memReqs;
-    vkGetBufferMemoryRequirements(device, buffer, &memReqs);
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memReqs.size;
-    allocInfo.memoryTypeIndex = findMemoryType(pDevice, memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    vkAllocateMemory(device, &allocInfo, nullptr, &memory);
-    vkBindBufferMemory(device, buffer, memory, 0);
+// Runs the first count streams for seconds after a warm-up; returns dispatches per second of all of them.
+double measureStreams(std::vector<std::unique_ptr<QueueStream>>& streams, size_t count, int seconds) {
+    std::atomic<bool> stop{false};
+    for (size_t i = 0; i < count; ++i) streams[i]->thread = std::thread(&QueueStream::run, streams[i].get(), std::cref(stop));
+    sleepUnlessStopped(SCALING_WARMUP_SECONDS);
+    uint64_t before = 0, after = 0;
+    for (size_t i = 0; i < count; ++i) before += streams[i]->completed.load();
+    auto start = std::chrono::steady_clock::now();
+    sleepUnlessStopped(seconds);
+    for (size_t i = 0; i < count; ++i) after += streams[i]->completed.load();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stop = true;
+    for (size_t i = 0; i < count; ++i) streams[i]->thread.join();
+    return (after - before) / elapsed;
 }
 
+int main(int argc, char* argv[]) {
+    std::string deviceSelector; // --device: index, part of the name or UUID
+    uint32_t queueCount = 1;    // --queues: compute queues to stress, 0 for all of them
+    bool explicitQueues = false;
+    int scalingSeconds = 0;     // --scaling: measure 1..all queues for this long each, then exit
+    MonitorOptions monitorOptions; // --csv, --drop
+    CpuStressOptions cpuOptions;   // --cpu and friends
+    auto usage = [&]() {
+        std::cerr << "Usage: " << argv[0] << " [--device <index|name|uuid>] [--queues <n|all>] [--scaling <seconds per step>]"
+                  << " [--csv <per-second samples>] [--drop <percent below baseline to flag, default 10>]" << CPU_USAGE << std::endl;
+    };
+    // Bad values end up in the catch below with the usage, before any GPU setup.
+    for (int i = 1; i < argc; ++i) {
+        try {
+            bool hasValue = i + 1 < argc;
+            if (strcmp(argv[i], "--device") == 0 && hasValue) deviceSelector = argv[++i];
+            else if (strcmp(argv[i], "--queues") == 0 && hasValue) { std::string n = argv[++i]; queueCount = n == "all" ? 0 : uint32_t(std::stoul(n)); explicitQueues = true; }
+            else if (strcmp(argv[i], "--scaling") == 0 && hasValue) scalingSeconds = std::stoi(argv[++i]);
+            else if (strcmp(argv[i], "--csv") == 0 && hasValue) monitorOptions.csvPath = argv[++i];
+            else if (strcmp(argv[i], "--drop") == 0 && hasValue) monitorOptions.dropFraction = parseDropPercent(argv[++i]);
+            else if (parseCpuStressOption(argc, argv, i, cpuOptions)) {}
+            else {
+                usage();
+                return 1;
+            }
+        } catch (const std::logic_error&) { // std::stoul and friends: not a number, or out of range
+            std::cerr << "Error: " << argv[i - 1] << " " << argv[i] << ": not a valid number" << std::endl;
+            usage();
+            return 1;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            usage();
+            return 1;
+        }
+    }
+    if (scalingSeconds > 0 && (explicitQueues || !monitorOptions.csvPath.empty())) {
+        std::cerr << "--scaling measures 1 to all queues and prints its own table; drop --queues and --csv" << std::endl;
+        return 1;
+    }
+    // Before any setup: Ctrl+C ends every mode through its cleanup.
+    std::signal(SIGINT, onSigint);
+    if (cpuOptions.alone) {
+        if (cpuOptions.kernel.empty()) {
+            std::cerr << "--cpu-only needs --cpu <" << CPU_KERNELS << ">" << std::endl;
+            return 1;
+        }
+        return CpuStress::runAlone(cpuOptions, stopRequested);
+    }
 
-int main() {
-    // --- 1. Vulkan Setup (Standard, Abridged) ---
-    VkInstance instance; VkApplicationInfo appInfo{}; appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO; appInfo.pApplicationName="GPU Bandwidth Test"; appInfo.apiVersion = VK_API_VERSION_1_2; VkInstanceCreateInfo instInfo{}; instInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO; instInfo.pApplicationInfo = &appInfo; vkCreateInstance(&instInfo, nullptr, &instance); uint32_t deviceCount = 0; vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr); std::vector<VkPhysicalDevice> devices(deviceCount); vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data()); VkPhysicalDevice physicalDevice = devices[0]; uint32_t queueFamilyIndex=0; vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &deviceCount, nullptr); std::vector<VkQueueFamilyProperties> queueFamilies(deviceCount); vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &deviceCount, queueFamilies.data()); for(uint32_t i=0; i<deviceCount; ++i) if(queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) { queueFamilyIndex = i; break; } VkDevice device; float qp=1.0f; VkDeviceQueueCreateInfo qcInfo{}; qcInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO; qcInfo.queueFamilyIndex = queueFamilyIndex; qcInfo.queueCount = 1; qcInfo.pQueuePriorities = &qp; VkDeviceCreateInfo dInfo{}; dInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO; dInfo.queueCreateInfoCount = 1; dInfo.pQueueCreateInfos = &qcInfo; vkCreateDevice(physicalDevice, &dInfo, nullptr, &device); VkQueue computeQueue; vkGetDeviceQueue(device, queueFamilyIndex, 0, &computeQueue);
+    // --- 1. Vulkan Setup (shared with the other tools, ../common/vk_context.h) ---
+    // Every queue of every family when more than one may be used.
+    VulkanContext vulkan(deviceSelector, "GPU Bandwidth Test", queueCount != 1 || scalingSeconds > 0);
+    VkDevice device = vulkan.device;
+    std::cout << "Device " << vulkan.deviceIndex << ": " << vulkan.properties.deviceName << " (" << vulkan.deviceType() << ")" << std::endl;
+
+    // The compute queues, the context's own first.
+    std::vector<VulkanQueue> computeQueues;
+    for (const VulkanQueue& q : vulkan.queues) {
+        if (q.queue == vulkan.computeQueue) computeQueues.insert(computeQueues.begin(), q);
+        else if (q.flags & VK_QUEUE_COMPUTE_BIT) computeQueues.push_back(q);
+    }
+    if (queueCount == 0 || scalingSeconds > 0) queueCount = uint32_t(computeQueues.size());
+    if (queueCount > computeQueues.size()) {
+        std::cerr << "--queues " << queueCount << ": the device has " << computeQueues.size() << " compute queues" << std::endl;
+        return 1;
+    }
+    std::cout << computeQueues.size() << " compute queue(s) (family.index):";
+    for (const VulkanQueue& q : computeQueues) std::cout << " " << q.family << "." << q.index;
+    std::cout << ", using " << queueCount << std::endl;
 
     // --- 2. Create Two Large Device-Local Buffers ---
     VkBuffer inputBuffer, outputBuffer;
@@ -52,8 +209,8 @@ int main() {
     VkDeviceSize bufferSizeBytes = sizeof(uint32_t) * BUFFER_ELEMENTS;
 
     std::cout << "Allocating " << (bufferSizeBytes * 2) / (1024*1024) << " MiB of VRAM for stress test..." << std::endl;
-    createDeviceBuffer(device, physicalDevice, bufferSizeBytes, inputBuffer, inputMemory);
-    createDeviceBuffer(device, physicalDevice, bufferSizeBytes, outputBuffer, outputMemory);
+    vulkan.createBuffer(bufferSizeBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, inputBuffer, inputMemory);
+    vulkan.createBuffer(bufferSizeBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, outputBuffer, outputMemory);
 
     // --- 3. Create Pipeline for Two Buffers ---
     VkShaderModule shaderModule;
@@ -100,39 +257,55 @@ int main() {
     writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; writes[1].dstSet = dSet; writes[1].dstBinding = 1; writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; writes[1].descriptorCount = 1; writes[1].pBufferInfo = &outputBufInfo;
     vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
 
-    VkCommandPool cmdPool;
-    VkCommandPoolCreateInfo cpInfo{}; cpInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO; cpInfo.queueFamilyIndex = queueFamilyIndex;
-    vkCreateCommandPool(device, &cpInfo, nullptr, &cmdPool);
-
-    std::vector<VkCommandBuffer> cmdBuffers(FRAMES_IN_FLIGHT);
-    std::vector<VkFence> fences(FRAMES_IN_FLIGHT);
-    VkCommandBufferAllocateInfo cbAllocInfo{}; cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO; cbAllocInfo.commandPool = cmdPool; cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbAllocInfo.commandBufferCount = FRAMES_IN_FLIGHT;
-    vkAllocateCommandBuffers(device, &cbAllocInfo, cmdBuffers.data());
-    VkFenceCreateInfo fenceInfo{}; fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO; fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-    for(int i=0; i<FRAMES_IN_FLIGHT; ++i) vkCreateFence(device, &fenceInfo, nullptr, &fences[i]);
-
-    // --- 5. The Unthrottled Memory Stress Loop ---
-    std::cout << "*******************************************\n" << "***  MEMORY BANDWIDTH STRESS TEST RUNNING ***\n" << "***    Monitor GPU Power (Watts).         ***\n" << "***        Press Ctrl+C to exit.        ***\n" << "*******************************************" << std::endl;
-
-    int frame = 0;
-    while (true) {
-        vkWaitForFences(device, 1, &fences[frame], VK_TRUE, UINT64_MAX);
-        vkResetFences(device, 1, &fences[frame]);
-        VkCommandBuffer cb = cmdBuffers[frame];
-        vkResetCommandBuffer(cb, 0);
-        VkCommandBufferBeginInfo beginInfo{}; beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        vkBeginCommandBuffer(cb, &beginInfo);
-        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
-        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &dSet, 0, nullptr);
-        uint32_t buffer_elements_const = BUFFER_ELEMENTS;
-        vkCmdPushConstants(cb, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &buffer_elements_const);
-        vkCmdDispatch(cb, WORKGROUP_COUNT, 1, 1);
-        vkEndCommandBuffer(cb);
-        VkSubmitInfo submitInfo{}; submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; submitInfo.commandBufferCount = 1; submitInfo.pCommandBuffers = &cb;
-        vkQueueSubmit(computeQueue, 1, &submitInfo, fences[frame]);
-        frame = (frame + 1) % FRAMES_IN_FLIGHT;
+    std::vector<std::unique_ptr<QueueStream>> streams;
+    for (uint32_t i = 0; i < queueCount; ++i) {
+        streams.emplace_back(new QueueStream());
+        QueueStream& stream = *streams.back();
+        stream.device = device; stream.queue = computeQueues[i]; stream.timestampPeriodNs = vulkan.timestampPeriodNs; stream.pipeline = pipeline; stream.pipelineLayout = pipelineLayout; stream.dSet = dSet;
+    }
+
+    std::unique_ptr<CpuStress> cpu; // --cpu: the CPU loaded alongside
+    if (!cpuOptions.kernel.empty()) cpu.reset(new CpuStress(cpuOptions));
+
+    // --- 5a. Scaling: aggregate throughput of 1, 2, 4, ... and all queues ---
+    if (scalingSeconds > 0) {
+        std::vector<size_t> steps;
+        for (size_t n = 1; n < streams.size(); n *= 2) steps.push_back(n);
+        steps.push_back(streams.size());
+        double single = 0;
+        std::printf("%8s%16s%18s%10s\n", "queues", "dispatches/s", "Gelements/s", "scaling");
+        for (size_t n : steps) {
+            double rate = measureStreams(streams, n, scalingSeconds);
+            if (stopRequested) break; // a cut-short step is not a measurement
+            if (n == 1) single = rate;
+            std::printf("%8zu%16.2f%18.3f%10.2f\n", n, rate, rate * ELEMENTS_PER_DISPATCH / 1e9, single > 0 ? rate / single : 0.0);
+            std::fflush(stdout);
+        }
+    } else {
+        // --- 5. The Unthrottled Memory Stress Loop ---
+        std::cout << "*******************************************\n" << "***  MEMORY BANDWIDTH STRESS TEST RUNNING ***\n" << "***    Monitor GPU Power (Watts).         ***\n" << "***        Press Ctrl+C to exit.        ***\n" << "*******************************************" << std::endl;
+
+        ThroughputMonitor monitor("elements", monitorOptions);
+        for (auto& stream : streams) {
+            stream->monitor = &monitor;
+            stream->thread = std::thread(&QueueStream::run, stream.get(), std::cref(stopRequested));
+        }
+        for (auto& stream : streams) stream->thread.join();
+        monitor.stop();
     }
+    if (cpu) cpu->stop();
 
+    // --- 6. Cleanup, after either mode ---
     vkDeviceWaitIdle(device);
+    streams.clear();
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorPool(device, pool, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    vkDestroyShaderModule(device, shaderModule, nullptr);
+    vkDestroyBuffer(device, inputBuffer, nullptr);
+    vkDestroyBuffer(device, outputBuffer, nullptr);
+    vkFreeMemory(device, inputMemory, nullptr);
+    vkFreeMemory(device, outputMemory, nullptr);
     return 0;
 }
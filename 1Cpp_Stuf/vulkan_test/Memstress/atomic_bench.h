@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../common/vk_context.h"
+#include "../common/compute_kernel.h"
+#include "../common/bench_report.h"
+
+/*
+ * Memstress --atomics: what a counter costs, the shape of miller_rabin.comp's
+ * round_completed and of any compaction kernel. atomics.comp increments
+ * counters in four patterns:
+ *  - global    every invocation on one word in device memory;
+ *  - spread    invocation i on slot i % ATOMIC_SLOTS, a 128-byte line each;
+ *  - shared    a counter in workgroup-shared memory, added to the global
+ *              one once per workgroup;
+ *  - subgroup  subgroupAdd, then one global atomic per subgroup (needs
+ *              subgroup arithmetic in compute shaders).
+ * Occupancy is the number of workgroups in flight: the table has one row
+ * per dispatch size, from 1 workgroup up to --max-workgroups, in steps of
+ * four. A cell is increments per second, the best of ATOMIC_REPEATS
+ * dispatches calibrated to ATOMIC_TARGET_SECONDS each.
+ *
+ * After the repeats the host sums the counters and expects every
+ * increment (modulo 2^32: the single counter wraps at full occupancy);
+ * a shortfall is a lost update and fails the run.
+ */
+
+struct AtomicOptions {
+    uint32_t maxWorkgroups = 4096;
+    std::string jsonPath; // empty: no report
+};
+
+const uint32_t ATOMIC_PATTERN_COUNT = 4;
+const char* const ATOMIC_PATTERN_NAMES[ATOMIC_PATTERN_COUNT] = {"global", "spread", "shared", "subgroup"};
+const uint32_t ATOMIC_SUBGROUP = 3;
+const uint32_t ATOMIC_SLOTS = 65536;   // atomics.comp
+const uint32_t ATOMIC_SLOT_WORDS = 32; // atomics.comp
+const uint32_t ATOMIC_WORKGROUP_SIZE = 256;
+const uint32_t ATOMIC_REPEATS = 3;
+const double ATOMIC_TARGET_SECONDS = 0.02;
+
+// subgroupSpirv is atomics.comp built with -DSUBGROUP_AGGREGATED.
+inline int runAtomicBench(const VulkanContext& vulkan, const void* spirv, size_t spirvSize, const void* subgroupSpirv, size_t subgroupSpirvSize,
+                          const AtomicOptions& options) {
+    VkDevice device = vulkan.device;
+    const uint32_t deviceMax = vulkan.properties.limits.maxComputeWorkGroupCount[0];
+    if (options.maxWorkgroups == 0 || options.maxWorkgroups > deviceMax) {
+        throw std::runtime_error("--max-workgroups must be 1 to " + std::to_string(deviceMax) + " (maxComputeWorkGroupCount on this device)");
+    }
+    const bool haveSubgroups = vulkan.subgroupOperations & VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+
+    const VkDeviceSize counterBytes = VkDeviceSize(ATOMIC_SLOTS) * ATOMIC_SLOT_WORDS * sizeof(uint32_t);
+    VkBuffer counters, readback; VkDeviceMemory counterMemory, readbackMemory;
+    vulkan.createBuffer(counterBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, counters, counterMemory);
+    vulkan.createBuffer(counterBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readback, readbackMemory);
+    void* mapped;
+    vkMapMemory(device, readbackMemory, 0, VK_WHOLE_SIZE, 0, &mapped);
+    const uint32_t* readbackWords = static_cast<const uint32_t*>(mapped);
+
+    auto clearCounters = [&] {
+        vulkan.submitOnce([&](VkCommandBuffer cb) {
+            vkCmdFillBuffer(cb, counters, 0, VK_WHOLE_SIZE, 0);
+            VkMemoryBarrier barrier{}; barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        });
+    };
+    auto counterTotal = [&] {
+        vulkan.submitOnce([&](VkCommandBuffer cb) {
+            VkMemoryBarrier barrier{}; barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT; barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+            VkBufferCopy region{}; region.size = counterBytes;
+            vkCmdCopyBuffer(cb, counters, readback, 1, &region);
+            VkMemoryBarrier hostBarrier{}; hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+        });
+        uint64_t total = 0;
+        for (uint32_t s = 0; s < ATOMIC_SLOTS; ++s) total += readbackWords[s * ATOMIC_SLOT_WORDS];
+        return total;
+    };
+
+    std::vector<uint32_t> workgroupCounts;
+    for (uint64_t groups = 1; groups <= options.maxWorkgroups; groups *= 4) workgroupCounts.push_back(uint32_t(groups));
+    if (workgroupCounts.back() != options.maxWorkgroups) workgroupCounts.push_back(options.maxWorkgroups);
+
+    struct Point {
+        uint32_t pattern, workgroups, iterations;
+        RunningStats perSecond; // increments
+        bool verified;
+    };
+    std::vector<Point> points;
+    bool lost = false;
+
+    std::cout << "Atomic contention on " << vulkan.properties.deviceName << ": G increments/s, best of " << ATOMIC_REPEATS << " dispatches, "
+              << ATOMIC_WORKGROUP_SIZE << " invocations per workgroup, subgroup size " << vulkan.subgroupSize << std::endl;
+    if (!haveSubgroups) std::cout << "  subgroup: skipped, no subgroup arithmetic in compute shaders" << std::endl;
+
+    // Kernels first, then the sweep, so the table comes out row by row.
+    VkShaderModule module = vulkan.createShaderModule(spirv, spirvSize);
+    VkShaderModule subgroupModule = haveSubgroups ? vulkan.createShaderModule(subgroupSpirv, subgroupSpirvSize) : VK_NULL_HANDLE;
+    std::vector<std::unique_ptr<ComputeKernel>> kernels(ATOMIC_PATTERN_COUNT);
+    for (uint32_t p = 0; p < ATOMIC_PATTERN_COUNT; ++p) {
+        if (p == ATOMIC_SUBGROUP && !haveSubgroups) continue;
+        kernels[p].reset(new ComputeKernel(vulkan, p == ATOMIC_SUBGROUP ? subgroupModule : module, 1, sizeof(uint32_t), {p}));
+        kernels[p]->bind({counters});
+    }
+
+    std::printf("%12s", "workgroups");
+    for (uint32_t p = 0; p < ATOMIC_PATTERN_COUNT; ++p) std::printf("%12s", ATOMIC_PATTERN_NAMES[p]);
+    std::printf("\n");
+    for (uint32_t groups : workgroupCounts) {
+        std::printf("%12u", groups);
+        const double invocations = double(groups) * ATOMIC_WORKGROUP_SIZE;
+        for (uint32_t p = 0; p < ATOMIC_PATTERN_COUNT; ++p) {
+            if (!kernels[p]) { std::printf("%12s", "-"); continue; }
+            ComputeKernel& kernel = *kernels[p];
+            uint32_t iterations = 4;
+            double seconds = kernel.run(groups, &iterations);
+            iterations = uint32_t(std::clamp(iterations * ATOMIC_TARGET_SECONDS / std::max(seconds, 1e-6), 1.0, double(1u << 16)));
+
+            Point point{p, groups, iterations, {}, false};
+            clearCounters();
+            for (uint32_t r = 0; r < ATOMIC_REPEATS; ++r) point.perSecond.add(invocations * iterations / kernel.run(groups, &iterations));
+            const uint64_t expected = uint64_t(groups) * ATOMIC_WORKGROUP_SIZE * iterations * ATOMIC_REPEATS;
+            const uint64_t total = counterTotal();
+            point.verified = uint32_t(total) == uint32_t(expected);
+            if (!point.verified) {
+                lost = true;
+                std::cerr << "LOST UPDATES: " << ATOMIC_PATTERN_NAMES[p] << " at " << groups << " workgroups counted " << uint32_t(total) << " of " << uint32_t(expected) << " (mod 2^32)" << std::endl;
+            }
+            std::printf("%12.3f", point.perSecond.max / 1e9);
+            std::fflush(stdout);
+            points.push_back(point);
+        }
+        std::printf("\n");
+    }
+
+    if (!options.jsonPath.empty()) {
+        std::ofstream out(options.jsonPath);
+        if (!out) throw std::runtime_error("Cannot write " + options.jsonPath);
+        JsonWriter json(out);
+        json.beginObject();
+        json.value("tool", "memstress-atomics");
+        json.device("device", vulkan);
+        json.value("workgroup_size", ATOMIC_WORKGROUP_SIZE);
+        json.value("subgroup_size", vulkan.subgroupSize);
+        json.value("subgroup_arithmetic", haveSubgroups);
+        json.value("spread_slots", ATOMIC_SLOTS);
+        json.value("slot_bytes", uint32_t(ATOMIC_SLOT_WORDS * sizeof(uint32_t)));
+        json.value("repeats", ATOMIC_REPEATS);
+        json.value("verified", !lost);
+        json.beginArray("results");
+        for (const Point& p : points) {
+            json.beginObject();
+            json.value("pattern", ATOMIC_PATTERN_NAMES[p.pattern]);
+            json.value("workgroups", p.workgroups);
+            json.value("iterations", p.iterations);
+            json.value("increments_per_second", p.perSecond.max);
+            json.stats("increments_per_second_runs", p.perSecond);
+            json.value("verified", p.verified);
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+        json.finish();
+        std::cout << "Report written to " << options.jsonPath << std::endl;
+    }
+
+    kernels.clear();
+    vkDestroyShaderModule(device, module, nullptr);
+    if (subgroupModule != VK_NULL_HANDLE) vkDestroyShaderModule(device, subgroupModule, nullptr);
+    vkUnmapMemory(device, readbackMemory);
+    vkDestroyBuffer(device, readback, nullptr);
+    vkFreeMemory(device, readbackMemory, nullptr);
+    vkDestroyBuffer(device, counters, nullptr);
+    vkFreeMemory(device, counterMemory, nullptr);
+    return lost ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../common/vk_context.h"
+#include "../common/compute_kernel.h"
+#include "../common/bench_report.h"
+
+/*
+ * Memstress --sweep: achieved bandwidth of each access pattern of
+ * bandwidth.comp over buffer sizes from 64 KB to 2 GB, which walks the
+ * cache hierarchy down to VRAM. Every (size, pattern) point is one
+ * warm-up dispatch and SWEEP_REPEATS timed ones; the table shows the
+ * best GB/s, the JSON report best, mean and spread. Bytes are the ones
+ * the pattern asks for, so strided and gather (one 16-byte word per
+ * cache line) show how much of the bus they waste.
+ */
+
+struct BandwidthPattern {
+    const char* name;
+    uint32_t id;            // PATTERN in bandwidth.comp
+    uint32_t bytesPerStep;  // per invocation and iteration
+};
+
+const BandwidthPattern BANDWIDTH_PATTERNS[] = {
+    {"read", 0, 16}, {"write", 1, 16}, {"copy", 2, 32}, {"triad", 3, 48},
+    {"strided", 4, 16}, {"gather", 5, 16}, {"copy32", 6, 8},
+};
+
+struct SweepOptions {
+    std::vector<std::string> patterns; // empty: all
+    uint64_t minBytes = 64ULL << 10;
+    uint64_t maxBytes = 2ULL << 30;
+    uint32_t stride = 33;              // STRIDED, in 16-byte elements (odd)
+    std::string jsonPath;              // empty: no report
+};
+
+const uint32_t SWEEP_WORKGROUPS = 512;        // 131072 invocations
+const uint64_t SWEEP_MIN_STEPS = 1ULL << 24;  // element accesses per dispatch at least
+const uint32_t SWEEP_REPEATS = 5;
+const uint32_t SWEEP_FILL = 0x5a5a5a5a;
+
+inline std::string formatBytes(uint64_t bytes) {
+    char buf[32];
+    if (bytes >= (1ULL << 30)) snprintf(buf, sizeof buf, "%g GB", double(bytes) / (1ULL << 30));
+    else if (bytes >= (1ULL << 20)) snprintf(buf, sizeof buf, "%g MB", double(bytes) / (1ULL << 20));
+    else snprintf(buf, sizeof buf, "%g KB", double(bytes) / (1ULL << 10));
+    return buf;
+}
+
+inline int runBandwidthSweep(const VulkanContext& vulkan, const void* spirv, size_t spirvSize, const SweepOptions& options) {
+    VkDevice device = vulkan.device;
+    std::vector<const BandwidthPattern*> patterns;
+    for (const BandwidthPattern& p : BANDWIDTH_PATTERNS) {
+        if (options.patterns.empty() || std::find(options.patterns.begin(), options.patterns.end(), p.name) != options.patterns.end()) patterns.push_back(&p);
+    }
+    if (patterns.empty()) throw std::runtime_error("--patterns: none of read, write, copy, triad, strided, gather, copy32");
+    if (options.stride % 2 == 0) throw std::runtime_error("--stride must be odd");
+
+    VkShaderModule module = vulkan.createShaderModule(spirv, spirvSize);
+    std::vector<std::unique_ptr<ComputeKernel>> kernels;
+    for (const BandwidthPattern* p : patterns) kernels.emplace_back(new ComputeKernel(vulkan, module, 3, 4 * sizeof(uint32_t), {p->id}));
+
+    struct Point {
+        uint64_t bytes;
+        const BandwidthPattern* pattern;
+        RunningStats gbps;
+    };
+    std::vector<Point> points;
+    const uint64_t maxRange = vulkan.properties.limits.maxStorageBufferRange;
+    const uint32_t threads = SWEEP_WORKGROUPS * 256;
+
+    std::cout << "Bandwidth sweep on " << vulkan.properties.deviceName << ", best GB/s of " << SWEEP_REPEATS << " dispatches" << std::endl;
+    std::printf("%10s", "size");
+    for (const BandwidthPattern* p : patterns) std::printf("%10s", p->name);
+    std::printf("\n");
+
+    for (uint64_t bytes = options.minBytes; bytes <= options.maxBytes; bytes *= 2) {
+        if (bytes > maxRange) {
+            std::cout << formatBytes(bytes) << " and up: above maxStorageBufferRange (" << maxRange << " bytes)" << std::endl;
+            break;
+        }
+        // a, b and c; triad reads two buffers and writes the third.
+        VkBuffer buffers[3] = {};
+        VkDeviceMemory memories[3] = {};
+        try {
+            for (int i = 0; i < 3; ++i) {
+                vulkan.createBuffer(bytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffers[i], memories[i]);
+            }
+        } catch (const std::exception& e) {
+            for (int i = 0; i < 3; ++i) {
+                if (buffers[i] != VK_NULL_HANDLE) vkDestroyBuffer(device, buffers[i], nullptr);
+                if (memories[i] != VK_NULL_HANDLE) vkFreeMemory(device, memories[i], nullptr);
+            }
+            std::cout << formatBytes(bytes) << " and up: " << e.what() << std::endl;
+            break;
+        }
+
+        // Known contents, so that the reads' XOR is predictable.
+        vulkan.submitOnce([&](VkCommandBuffer cb) {
+            for (int i = 0; i < 3; ++i) vkCmdFillBuffer(cb, buffers[i], 0, VK_WHOLE_SIZE, SWEEP_FILL);
+            VkMemoryBarrier barrier{}; barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        });
+
+        // Enough steps to touch the buffer twice, and never a trivially short dispatch.
+        const uint64_t elements = bytes / 16;
+        const uint32_t iterations = uint32_t(std::max<uint64_t>(SWEEP_MIN_STEPS, 2 * elements) / threads);
+        struct { uint32_t mask, iterations, stride, scalar; } push = {uint32_t(elements - 1), iterations, options.stride, 3};
+
+        std::printf("%10s", formatBytes(bytes).c_str());
+        for (size_t k = 0; k < patterns.size(); ++k) {
+            kernels[k]->bind({buffers[0], buffers[1], buffers[2]});
+            kernels[k]->run(SWEEP_WORKGROUPS, &push); // warm-up
+            Point point{bytes, patterns[k], {}};
+            const double traffic = double(threads) * iterations * patterns[k]->bytesPerStep;
+            for (uint32_t r = 0; r < SWEEP_REPEATS; ++r) point.gbps.add(traffic / kernels[k]->run(SWEEP_WORKGROUPS, &push) / 1e9);
+            std::printf("%10.1f", point.gbps.max);
+            std::fflush(stdout);
+            points.push_back(point);
+        }
+        std::printf("\n");
+
+        for (int i = 0; i < 3; ++i) {
+            vkDestroyBuffer(device, buffers[i], nullptr);
+            vkFreeMemory(device, memories[i], nullptr);
+        }
+    }
+
+    if (!options.jsonPath.empty()) {
+        std::ofstream out(options.jsonPath);
+        if (!out) throw std::runtime_error("Cannot write " + options.jsonPath);
+        JsonWriter json(out);
+        json.beginObject();
+        json.value("tool", "memstress-sweep");
+        json.device("device", vulkan);
+        json.value("workgroups", SWEEP_WORKGROUPS);
+        json.value("repeats", SWEEP_REPEATS);
+        json.value("stride_bytes", 16 * options.stride);
+        json.beginArray("results");
+        for (const Point& p : points) {
+            json.beginObject();
+            json.value("pattern", p.pattern->name);
+            json.value("bytes", p.bytes);
+            json.value("gb_per_second", p.gbps.max);
+            json.stats("gb_per_second_runs", p.gbps);
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+        json.finish();
+        std::cout << "Report written to " << options.jsonPath << std::endl;
+    }
+
+    kernels.clear();
+    vkDestroyShaderModule(device, module, nullptr);
+    return 0;
+}
@@ -1,12 +1,20 @@
 #!/bin/bash
 rm -rf build
 rm shader.h
-rm memory_stress.spv
+rm memory_stress.spv bandwidth.spv latency.spv atomics.spv atomics_subgroup.spv
 
 sleep 6
 glslc memory_stress.comp -o memory_stress.spv
+glslc bandwidth.comp -o bandwidth.spv
+glslc latency.comp -o latency.spv
+glslc atomics.comp -o atomics.spv
+glslc -DSUBGROUP_AGGREGATED --target-env=vulkan1.1 atomics.comp -o atomics_subgroup.spv
 
 xxd -i memory_stress.spv > shader.h
+xxd -i bandwidth.spv >> shader.h
+xxd -i latency.spv >> shader.h
+xxd -i atomics.spv >> shader.h
+xxd -i atomics_subgroup.spv >> shader.h
 mkdir build
 cd build
 cmake ..
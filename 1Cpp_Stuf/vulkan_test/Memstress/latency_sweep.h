@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../common/vk_context.h"
+#include "../common/compute_kernel.h"
+#include "../common/bench_report.h"
+#include "bandwidth_sweep.h" // formatBytes
+
+/*
+ * Memstress --latency: load-to-use latency over working-set sizes, the
+ * curve whose steps are L1, L2, (L3/Infinity Cache,) VRAM and the TLB
+ * reach. The host links the nodes of a buffer into one random cycle,
+ * one node per LATENCY_NODE_BYTES so that no two hops share a cache line,
+ * and latency.comp follows it for --hops loads. The GPU time divided by
+ * the hops is the nanoseconds per load.
+ *
+ * The chain lives either in device-local memory (uploaded through a
+ * staging buffer) or in the first host-visible, host-coherent memory
+ * type, which on a discrete GPU is system memory across the bus (unless
+ * resizable BAR puts it in VRAM; the table says which heap it got).
+ *
+ * --chasers runs that many chains at once, one per workgroup, starting
+ * evenly spaced on the cycle: the latency per chain under load, and the
+ * loads per second of all of them.
+ */
+
+struct LatencyOptions {
+    uint64_t minBytes = 4ULL << 10;
+    uint64_t maxBytes = 1ULL << 30;
+    uint32_t hops = 1u << 18;     // per chaser and dispatch
+    uint32_t chasers = 1;
+    bool deviceLocal = true;
+    bool hostVisible = true;
+    std::string jsonPath;         // empty: no report
+};
+
+const uint32_t LATENCY_NODE_BYTES = 128; // the widest cache line in common GPUs
+const uint32_t LATENCY_REPEATS = 3;
+const uint64_t LATENCY_SEED = 0x9e3779b97f4a7c15ULL;
+
+struct LatencyMemory {
+    const char* name;
+    VkMemoryPropertyFlags flags;
+};
+
+// The cycle over the nodes as an order: node order[i] links to order[i + 1].
+inline std::vector<uint32_t> latencyCycle(uint32_t nodes) {
+    std::vector<uint32_t> order(nodes);
+    for (uint32_t i = 0; i < nodes; ++i) order[i] = i;
+    std::mt19937_64 rng(LATENCY_SEED + nodes);
+    std::shuffle(order.begin(), order.end(), rng);
+    return order;
+}
+
+inline int runLatencySweep(const VulkanContext& vulkan, const void* spirv, size_t spirvSize, const LatencyOptions& options) {
+    VkDevice device = vulkan.device;
+    const uint32_t nodeWords = LATENCY_NODE_BYTES / sizeof(uint32_t);
+    if (options.minBytes < 2 * LATENCY_NODE_BYTES) throw std::runtime_error("--min-size: at least two nodes of " + std::to_string(LATENCY_NODE_BYTES) + " bytes");
+    if (options.hops == 0 || options.chasers == 0) throw std::runtime_error("--hops and --chasers must be positive");
+
+    std::vector<LatencyMemory> memories;
+    if (options.deviceLocal) memories.push_back({"device-local", VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
+    if (options.hostVisible) memories.push_back({"host-visible", VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT});
+
+    VkShaderModule module = vulkan.createShaderModule(spirv, spirvSize);
+    ComputeKernel kernel(vulkan, module, 2, sizeof(uint32_t));
+
+    // Chaser start and end positions, read and written by the host.
+    VkBuffer positionBuffer; VkDeviceMemory positionMemory;
+    vulkan.createBuffer(sizeof(uint32_t) * options.chasers, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, positionBuffer, positionMemory);
+    uint32_t* positions;
+    vkMapMemory(device, positionMemory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>(&positions));
+
+    VkPhysicalDeviceMemoryProperties memProps;
+    vkGetPhysicalDeviceMemoryProperties(vulkan.physicalDevice, &memProps);
+
+    struct Point {
+        uint64_t bytes;
+        const LatencyMemory* memory;
+        uint32_t heap;
+        RunningStats ns;
+    };
+    std::vector<Point> points;
+    const uint64_t maxRange = vulkan.properties.limits.maxStorageBufferRange;
+    bool mismatch = false;
+
+    std::cout << "Latency sweep on " << vulkan.properties.deviceName << ": " << options.chasers << " chaser(s), " << options.hops
+              << " hops each, best ns per load of " << LATENCY_REPEATS << " dispatches" << std::endl;
+    for (const LatencyMemory& m : memories) {
+        uint32_t type = vulkan.findMemoryType(~0u, m.flags);
+        bool heapLocal = memProps.memoryHeaps[memProps.memoryTypes[type].heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+        std::cout << "  " << m.name << ": memory type " << type << ", heap " << memProps.memoryTypes[type].heapIndex << (heapLocal ? " (device-local heap)" : " (system heap)") << std::endl;
+    }
+    std::printf("%10s", "size");
+    for (const LatencyMemory& m : memories) std::printf("%14s", m.name);
+    std::printf("\n");
+
+    std::vector<bool> exhausted(memories.size(), false);
+    for (uint64_t bytes = options.minBytes; bytes <= options.maxBytes; bytes *= 2) {
+        if (bytes > maxRange) {
+            std::cout << formatBytes(bytes) << " and up: above maxStorageBufferRange (" << maxRange << " bytes)" << std::endl;
+            break;
+        }
+        const uint32_t nodes = uint32_t(bytes / LATENCY_NODE_BYTES);
+        const std::vector<uint32_t> order = latencyCycle(nodes);
+
+        std::printf("%10s", formatBytes(bytes).c_str());
+        for (size_t k = 0; k < memories.size(); ++k) {
+            if (exhausted[k]) { std::printf("%14s", "-"); continue; }
+            const LatencyMemory& m = memories[k];
+            const bool upload = !(m.flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+            VkBuffer chain = VK_NULL_HANDLE, staging = VK_NULL_HANDLE;
+            VkDeviceMemory chainMemory = VK_NULL_HANDLE, stagingMemory = VK_NULL_HANDLE;
+            try {
+                vulkan.createBuffer(bytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, m.flags, chain, chainMemory);
+                if (upload) vulkan.createBuffer(bytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging, stagingMemory);
+            } catch (const std::exception&) {
+                // Out of this memory: the larger sizes will not fit either.
+                if (chain != VK_NULL_HANDLE) { vkDestroyBuffer(device, chain, nullptr); vkFreeMemory(device, chainMemory, nullptr); }
+                exhausted[k] = true;
+                std::printf("%14s", "no memory");
+                continue;
+            }
+
+            uint32_t* words;
+            vkMapMemory(device, upload ? stagingMemory : chainMemory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>(&words));
+            std::memset(words, 0, bytes);
+            for (uint32_t i = 0; i < nodes; ++i) words[order[i] * nodeWords] = order[(i + 1) % nodes] * nodeWords;
+            if (upload) {
+                vkUnmapMemory(device, stagingMemory);
+                vulkan.submitOnce([&](VkCommandBuffer cb) {
+                    VkBufferCopy region{}; region.size = bytes;
+                    vkCmdCopyBuffer(cb, staging, chain, 1, &region);
+                    VkMemoryBarrier barrier{}; barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+                    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+                });
+                vkDestroyBuffer(device, staging, nullptr);
+                vkFreeMemory(device, stagingMemory, nullptr);
+            } else {
+                vkUnmapMemory(device, chainMemory);
+            }
+
+            kernel.bind({chain, positionBuffer});
+            Point point{bytes, &m, memProps.memoryTypes[vulkan.findMemoryType(~0u, m.flags)].heapIndex, {}};
+            for (uint32_t r = 0; r <= LATENCY_REPEATS; ++r) {
+                // Chaser c starts at step c * nodes / chasers of the cycle
+                // and must end hops steps further.
+                for (uint32_t c = 0; c < options.chasers; ++c) positions[c] = order[uint64_t(c) * nodes / options.chasers] * nodeWords;
+                double seconds = kernel.run(options.chasers, &options.hops);
+                for (uint32_t c = 0; c < options.chasers; ++c) {
+                    uint64_t step = uint64_t(c) * nodes / options.chasers + options.hops;
+                    if (positions[c] != order[step % nodes] * nodeWords) mismatch = true;
+                }
+                if (r > 0) point.ns.add(seconds * 1e9 / options.hops); // the first run warms caches and TLBs
+            }
+            std::printf("%14.1f", point.ns.min);
+            std::fflush(stdout);
+            points.push_back(point);
+
+            vkDestroyBuffer(device, chain, nullptr);
+            vkFreeMemory(device, chainMemory, nullptr);
+        }
+        std::printf("\n");
+        if (std::all_of(exhausted.begin(), exhausted.end(), [](bool e) { return e; })) break;
+    }
+    if (mismatch) std::cerr << "MISMATCH: a chaser did not end where the cycle says; the device lost loads." << std::endl;
+
+    if (!options.jsonPath.empty()) {
+        std::ofstream out(options.jsonPath);
+        if (!out) throw std::runtime_error("Cannot write " + options.jsonPath);
+        JsonWriter json(out);
+        json.beginObject();
+        json.value("tool", "memstress-latency");
+        json.device("device", vulkan);
+        json.value("node_bytes", LATENCY_NODE_BYTES);
+        json.value("hops", options.hops);
+        json.value("chasers", options.chasers);
+        json.value("repeats", LATENCY_REPEATS);
+        json.value("verified", !mismatch);
+        json.beginArray("results");
+        for (const Point& p : points) {
+            json.beginObject();
+            json.value("memory", p.memory->name);
+            json.value("heap", p.heap);
+            json.value("bytes", p.bytes);
+            json.value("ns_per_load", p.ns.min);
+            json.value("loads_per_second", options.chasers / (p.ns.min * 1e-9));
+            json.stats("ns_per_load_runs", p.ns);
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+        json.finish();
+        std::cout << "Report written to " << options.jsonPath << std::endl;
+    }
+
+    vkUnmapMemory(device, positionMemory);
+    vkDestroyBuffer(device, positionBuffer, nullptr);
+    vkFreeMemory(device, positionMemory, nullptr);
+    vkDestroyShaderModule(device, module, nullptr);
+    return mismatch ? 1 : 0;
+}
@@ -1,50 +1,135 @@
 #include <iostream>
 #include <vector>
 #include <stdexcept>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
 #include <vulkan/vulkan.h>
 
-#include "shader.h" // Will be generated from memory_stress.comp
+#include "../common/vk_context.h"
+#include "../common/throughput_monitor.h"
+#include "../common/cpu_stress.h"
+
+#include "shader.h" // Will be generated from memory_stress.comp, bandwidth.comp, latency.comp and atomics.comp
+#include "bandwidth_sweep.h"
+#include "latency_sweep.h"
+#include "transfer_bench.h"
+#include "atomic_bench.h"
 
 // --- Configuration ---
 const int FRAMES_IN_FLIGHT = 2;
 const uint32_t WORKGROUP_COUNT = 4096;
 const uint32_t WORKGROUP_SIZE = 256;
 const uint32_t BUFFER_ELEMENTS = 64 * 1024 * 1024; // 64 Million uints = 256 MB
-
-// Helper to find a suitable memory type
-uint32_t findMemoryType(VkPhysicalDevice pDevice, uint32_t typeFilter, VkMemoryPropertyFlags props) {
-    VkPhysicalDeviceMemoryProperties memProps;
-    vkGetPhysicalDeviceMemoryProperties(pDevice, &memProps);
-    for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProps.memoryTypes[i].propertyFlags & props) == props) {
-            return i;
+const uint64_t ELEMENTS_PER_DISPATCH = uint64_t(WORKGROUP_COUNT) * WORKGROUP_SIZE * 5000; // the copy loop of memory_stress.comp
+
+std::atomic<bool> stopRequested{false};
+void onSigint(int) { stopRequested = true; }
+
+
+int main(int argc, char* argv[]) {
+    std::string deviceSelector; // --device: index, part of the name or UUID
+    bool sweep = false;         // --sweep: measure bandwidth.comp instead of running the stress loop
+    bool latency = false;       // --latency: measure latency.comp instead
+    bool transfer = false;      // --transfer: measure copies and mapping instead
+    bool atomics = false;       // --atomics: measure atomics.comp instead
+    SweepOptions sweepOptions;
+    LatencyOptions latencyOptions;
+    TransferOptions transferOptions;
+    AtomicOptions atomicOptions;
+    uint64_t minBytes = 0, maxBytes = 0; // 0: the mode's default range
+    std::string jsonPath;
+    MonitorOptions monitorOptions; // --csv, --drop
+    CpuStressOptions cpuOptions;   // --cpu and friends
+    auto usage = [&]() {
+        std::cerr << "Usage: " << argv[0] << " [--device <index|name|uuid>] [--csv <per-second samples>] [--drop <percent below baseline to flag, default 10>]\n"
+                  << "       (every mode)" << CPU_USAGE << "\n"
+                  << "       " << argv[0] << " --sweep [--device <index|name|uuid>] [--patterns read,write,copy,triad,strided,gather,copy32]"
+                  << " [--min-size <KiB, power of two>] [--max-size <MiB>] [--stride <16-byte elements, odd>] [--json <file>]\n"
+                  << "       " << argv[0] << " --latency [--device <index|name|uuid>] [--memory device|host|both] [--chasers <n>] [--hops <n>]"
+                  << " [--min-size <KiB, power of two>] [--max-size <MiB>] [--json <file>]\n"
+                  << "       " << argv[0] << " --transfer [--device <index|name|uuid>] [--min-size <KiB, power of two>] [--max-size <MiB>] [--json <file>]\n"
+                  << "       " << argv[0] << " --atomics [--device <index|name|uuid>] [--max-workgroups <n, default 4096>] [--json <file>]" << std::endl;
+    };
+    // Bad values end up in the catch below with the usage, before any GPU setup.
+    for (int i = 1; i < argc; ++i) {
+        try {
+            bool hasValue = i + 1 < argc;
+            if (strcmp(argv[i], "--device") == 0 && hasValue) deviceSelector = argv[++i];
+            else if (strcmp(argv[i], "--sweep") == 0) sweep = true;
+            else if (strcmp(argv[i], "--latency") == 0) latency = true;
+            else if (strcmp(argv[i], "--transfer") == 0) transfer = true;
+            else if (strcmp(argv[i], "--atomics") == 0) atomics = true;
+            else if (strcmp(argv[i], "--max-workgroups") == 0 && hasValue) atomicOptions.maxWorkgroups = uint32_t(std::stoul(argv[++i]));
+            else if (strcmp(argv[i], "--patterns") == 0 && hasValue) {
+                std::string list = argv[++i];
+                for (size_t pos = 0; pos <= list.size();) {
+                    size_t comma = std::min(list.find(',', pos), list.size());
+                    sweepOptions.patterns.push_back(list.substr(pos, comma - pos));
+                    pos = comma + 1;
+                }
+            }
+            else if (strcmp(argv[i], "--min-size") == 0 && hasValue) minBytes = std::stoull(argv[++i]) << 10;
+            else if (strcmp(argv[i], "--max-size") == 0 && hasValue) maxBytes = std::stoull(argv[++i]) << 20;
+            else if (strcmp(argv[i], "--stride") == 0 && hasValue) sweepOptions.stride = uint32_t(std::stoul(argv[++i]));
+            else if (strcmp(argv[i], "--hops") == 0 && hasValue) latencyOptions.hops = uint32_t(std::stoul(argv[++i]));
+            else if (strcmp(argv[i], "--chasers") == 0 && hasValue) latencyOptions.chasers = uint32_t(std::stoul(argv[++i]));
+            else if (strcmp(argv[i], "--memory") == 0 && hasValue) {
+                std::string memory = argv[++i];
+                latencyOptions.deviceLocal = memory == "device" || memory == "both";
+                latencyOptions.hostVisible = memory == "host" || memory == "both";
+            }
+            else if (strcmp(argv[i], "--json") == 0 && hasValue) jsonPath = argv[++i];
+            else if (strcmp(argv[i], "--csv") == 0 && hasValue) monitorOptions.csvPath = argv[++i];
+            else if (strcmp(argv[i], "--drop") == 0 && hasValue) monitorOptions.dropFraction = parseDropPercent(argv[++i]);
+            else if (parseCpuStressOption(argc, argv, i, cpuOptions)) {}
+            else {
+                usage();
+                return 1;
+            }
+        } catch (const std::logic_error&) { // std::stoul and friends: not a number, or out of range
+            std::cerr << "Error: " << argv[i - 1] << " " << argv[i] << ": not a valid number" << std::endl;
+            usage();
+            return 1;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            usage();
+            return 1;
         }
     }
-    throw std::runtime_error("Failed to find suitable memory type!");
-}
-
-// Helper to create a device-local buffer
-void createDeviceBuffer(VkDevice device, VkPhysicalDevice pDevice, VkDeviceSize size, VkBuffer& buffer, VkDeviceMemory& memory) {
-    VkBufferCreateInfo bufferInfo{};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = size;
-    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
-
-    VkMemoryRequirements memReqs;
-    vkGetBufferMemoryRequirements(device, buffer, &memReqs);
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memReqs.size;
-    allocInfo.memoryTypeIndex = findMemoryType(pDevice, memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    vkAllocateMemory(device, &allocInfo, nullptr, &memory);
-    vkBindBufferMemory(device, buffer, memory, 0);
-}
-
+    if (minBytes & (minBytes - 1)) {
+        std::cerr << "--min-size must be a power of two" << std::endl;
+        return 1;
+    }
+    if (!latencyOptions.deviceLocal && !latencyOptions.hostVisible) {
+        std::cerr << "--memory must be device, host or both" << std::endl;
+        return 1;
+    }
+    if (minBytes) sweepOptions.minBytes = latencyOptions.minBytes = transferOptions.minBytes = minBytes;
+    if (maxBytes) sweepOptions.maxBytes = latencyOptions.maxBytes = transferOptions.maxBytes = maxBytes;
+    sweepOptions.jsonPath = latencyOptions.jsonPath = transferOptions.jsonPath = atomicOptions.jsonPath = jsonPath;
+    if (cpuOptions.alone) {
+        if (cpuOptions.kernel.empty()) {
+            std::cerr << "--cpu-only needs --cpu <" << CPU_KERNELS << ">" << std::endl;
+            return 1;
+        }
+        std::signal(SIGINT, onSigint);
+        return CpuStress::runAlone(cpuOptions, stopRequested);
+    }
 
-int main() {
-    // --- 1. Vulkan Setup (Standard, Abridged) ---
-    VkInstance instance; VkApplicationInfo appInfo{}; appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO; appInfo.pApplicationName="GPU Bandwidth Test"; appInfo.apiVersion = VK_API_VERSION_1_2; VkInstanceCreateInfo instInfo{}; instInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO; instInfo.pApplicationInfo = &appInfo; vkCreateInstance(&instInfo, nullptr, &instance); uint32_t deviceCount = 0; vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr); std::vector<VkPhysicalDevice> devices(deviceCount); vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data()); VkPhysicalDevice physicalDevice = devices[0]; uint32_t queueFamilyIndex=0; vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &deviceCount, nullptr); std::vector<VkQueueFamilyProperties> queueFamilies(deviceCount); vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &deviceCount, queueFamilies.data()); for(uint32_t i=0; i<deviceCount; ++i) if(queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) { queueFamilyIndex = i; break; } VkDevice device; float qp=1.0f; VkDeviceQueueCreateInfo qcInfo{}; qcInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO; qcInfo.queueFamilyIndex = queueFamilyIndex; qcInfo.queueCount = 1; qcInfo.pQueuePriorities = &qp; VkDeviceCreateInfo dInfo{}; dInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO; dInfo.queueCreateInfoCount = 1; dInfo.pQueueCreateInfos = &qcInfo; vkCreateDevice(physicalDevice, &dInfo, nullptr, &device); VkQueue computeQueue; vkGetDeviceQueue(device, queueFamilyIndex, 0, &computeQueue);
+    // --- 1. Vulkan Setup (shared with the other tools, ../common/vk_context.h) ---
+    VulkanContext vulkan(deviceSelector, "GPU Bandwidth Test", transfer); // --transfer needs every queue
+    VkDevice device = vulkan.device; VkQueue computeQueue = vulkan.computeQueue; uint32_t queueFamilyIndex = vulkan.queueFamilyIndex;
+    std::cout << "Device " << vulkan.deviceIndex << ": " << vulkan.properties.deviceName << " (" << vulkan.deviceType() << ")" << std::endl;
+    // The CPU load runs under every mode, so the sweeps show what it costs the GPU.
+    std::unique_ptr<CpuStress> cpu;
+    if (!cpuOptions.kernel.empty()) cpu.reset(new CpuStress(cpuOptions));
+    if (sweep) return runBandwidthSweep(vulkan, bandwidth_spv, sizeof(bandwidth_spv), sweepOptions);
+    if (latency) return runLatencySweep(vulkan, latency_spv, sizeof(latency_spv), latencyOptions);
+    if (transfer) return runTransferBench(vulkan, bandwidth_spv, sizeof(bandwidth_spv), transferOptions);
+    if (atomics) return runAtomicBench(vulkan, atomics_spv, sizeof(atomics_spv), atomics_subgroup_spv, sizeof(atomics_subgroup_spv), atomicOptions);
 
     // --- 2. Create Two Large Device-Local Buffers ---
     VkBuffer inputBuffer, outputBuffer;
@@ -52,8 +137,8 @@ int main() {
     VkDeviceSize bufferSizeBytes = sizeof(uint32_t) * BUFFER_ELEMENTS;
 
     std::cout << "Allocating " << (bufferSizeBytes * 2) / (1024*1024) << " MiB of VRAM for stress test..." << std::endl;
-    createDeviceBuffer(device, physicalDevice, bufferSizeBytes, inputBuffer, inputMemory);
-    createDeviceBuffer(device, physicalDevice, bufferSizeBytes, outputBuffer, outputMemory);
+    vulkan.createBuffer(bufferSizeBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, inputBuffer, inputMemory);
+    vulkan.createBuffer(bufferSizeBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, outputBuffer, outputMemory);
 
     // --- 3. Create Pipeline for Two Buffers ---
     VkShaderModule shaderModule;
@@ -111,28 +196,57 @@ int main() {
     VkFenceCreateInfo fenceInfo{}; fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO; fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
     for(int i=0; i<FRAMES_IN_FLIGHT; ++i) vkCreateFence(device, &fenceInfo, nullptr, &fences[i]);
 
+    // Two timestamps per frame, around the dispatch: the monitor's gpu_busy column.
+    const bool timed = vulkan.timestampValidBits != 0;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (timed) {
+        VkQueryPoolCreateInfo qpInfo{}; qpInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO; qpInfo.queryType = VK_QUERY_TYPE_TIMESTAMP; qpInfo.queryCount = 2 * FRAMES_IN_FLIGHT;
+        vkCreateQueryPool(device, &qpInfo, nullptr, &queryPool);
+    }
+
     // --- 5. The Unthrottled Memory Stress Loop ---
     std::cout << "*******************************************\n" << "***  MEMORY BANDWIDTH STRESS TEST RUNNING ***\n" << "***    Monitor GPU Power (Watts).         ***\n" << "***        Press Ctrl+C to exit.        ***\n" << "*******************************************" << std::endl;
 
+    ThroughputMonitor monitor("elements", monitorOptions);
+    std::signal(SIGINT, onSigint);
+    std::vector<bool> pending(FRAMES_IN_FLIGHT, false);
     int frame = 0;
-    while (true) {
+    while (!stopRequested) {
         vkWaitForFences(device, 1, &fences[frame], VK_TRUE, UINT64_MAX);
         vkResetFences(device, 1, &fences[frame]);
+        if (pending[frame]) {
+            double gpuSeconds = 0.0;
+            if (timed) {
+                uint64_t ticks[2];
+                vkGetQueryPoolResults(device, queryPool, 2 * frame, 2, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+                gpuSeconds = double((ticks[1] - ticks[0]) & vulkan.timestampMask()) * vulkan.timestampPeriodNs * 1e-9;
+            }
+            monitor.completed(ELEMENTS_PER_DISPATCH, gpuSeconds);
+        }
         VkCommandBuffer cb = cmdBuffers[frame];
         vkResetCommandBuffer(cb, 0);
         VkCommandBufferBeginInfo beginInfo{}; beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
         vkBeginCommandBuffer(cb, &beginInfo);
+        if (timed) {
+            vkCmdResetQueryPool(cb, queryPool, 2 * frame, 2);
+            vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 2 * frame);
+        }
         vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
         vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &dSet, 0, nullptr);
         uint32_t buffer_elements_const = BUFFER_ELEMENTS;
         vkCmdPushConstants(cb, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &buffer_elements_const);
         vkCmdDispatch(cb, WORKGROUP_COUNT, 1, 1);
+        if (timed) vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2 * frame + 1);
         vkEndCommandBuffer(cb);
         VkSubmitInfo submitInfo{}; submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; submitInfo.commandBufferCount = 1; submitInfo.pCommandBuffers = &cb;
         vkQueueSubmit(computeQueue, 1, &submitInfo, fences[frame]);
+        pending[frame] = true;
         frame = (frame + 1) % FRAMES_IN_FLIGHT;
     }
 
     vkDeviceWaitIdle(device);
+    monitor.stop();
+    if (cpu) cpu->stop();
+    if (queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(device, queryPool, nullptr);
     return 0;
 }
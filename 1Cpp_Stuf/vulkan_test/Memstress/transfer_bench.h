@@ -0,0 +1,350 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../common/vk_context.h"
+#include "../common/compute_kernel.h"
+#include "../common/bench_report.h"
+#include "bandwidth_sweep.h" // formatBytes, the READ pattern of bandwidth.comp
+
+/*
+ * Memstress --transfer: what it costs to get data to and from the GPU.
+ * Per buffer size, best GB/s of TRANSFER_REPEATS runs:
+ *  - memcpy     host to host, the baseline;
+ *  - to-map     memcpy into mapped host-visible, host-coherent memory
+ *               (usually write-combined);
+ *  - from-map   memcpy out of mapped host-visible memory, host-cached
+ *               when the device has such a type;
+ *  - up/down    vkCmdCopyBuffer between a host-visible staging buffer and
+ *               a device-local one, on the compute queue and on the first
+ *               dedicated transfer queue (no compute, no graphics) if any;
+ *  - staged     memcpy into staging plus the upload, end to end: the
+ *               alternative to the compute kernel reading the host-visible
+ *               buffer across the bus itself.
+ *
+ * Then, at the largest size, the overlap test: the upload on a second
+ * queue while the compute queue runs bandwidth.comp's read pattern on a
+ * cache-resident buffer, sized to take as long as the copy. Overlap is
+ * (copy + compute - both) / min(copy, compute): 1 when the two run fully
+ * concurrently, 0 when the device serializes them.
+ *
+ * The buffers are exclusive to a family and change families without an
+ * ownership transfer: their contents are don't-care here.
+ */
+
+struct TransferOptions {
+    uint64_t minBytes = 4ULL << 10;
+    uint64_t maxBytes = 256ULL << 20;
+    std::string jsonPath; // empty: no report
+};
+
+const uint32_t TRANSFER_REPEATS = 5;
+const uint64_t TRANSFER_MEMCPY_BYTES = 64ULL << 20; // memcpy samples repeat small copies up to this much
+const uint64_t OVERLAP_COMPUTE_BYTES = 1ULL << 20;  // cache-resident, so compute stays off the bus
+
+// vkCmdCopyBuffer on one queue, timed with its timestamps when it has them.
+class QueueCopy {
+public:
+    QueueCopy(const VulkanContext& vulkan, const VulkanQueue& queue) : device(vulkan.device), queue(queue), periodNs(vulkan.timestampPeriodNs) {
+        VkCommandPoolCreateInfo cpInfo{}; cpInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO; cpInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; cpInfo.queueFamilyIndex = queue.family;
+        vkCreateCommandPool(device, &cpInfo, nullptr, &commandPool);
+        VkCommandBufferAllocateInfo cbAllocInfo{}; cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO; cbAllocInfo.commandPool = commandPool; cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbAllocInfo.commandBufferCount = 1;
+        vkAllocateCommandBuffers(device, &cbAllocInfo, &commandBuffer);
+        VkFenceCreateInfo fenceInfo{}; fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        vkCreateFence(device, &fenceInfo, nullptr, &fence);
+        if (queue.timestampValidBits != 0) {
+            VkQueryPoolCreateInfo qpInfo{}; qpInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO; qpInfo.queryType = VK_QUERY_TYPE_TIMESTAMP; qpInfo.queryCount = 2;
+            vkCreateQueryPool(device, &qpInfo, nullptr, &queryPool);
+        }
+    }
+    ~QueueCopy() {
+        vkDestroyQueryPool(device, queryPool, nullptr);
+        vkDestroyFence(device, fence, nullptr);
+        vkDestroyCommandPool(device, commandPool, nullptr);
+    }
+    QueueCopy(const QueueCopy&) = delete;
+    QueueCopy& operator=(const QueueCopy&) = delete;
+
+    double run(VkBuffer src, VkBuffer dst, VkDeviceSize bytes) {
+        submit(src, dst, bytes);
+        return wait();
+    }
+
+    void submit(VkBuffer src, VkBuffer dst, VkDeviceSize bytes) {
+        VkCommandBuffer cb = commandBuffer;
+        vkResetCommandBuffer(cb, 0);
+        VkCommandBufferBeginInfo beginInfo{}; beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO; beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(cb, &beginInfo);
+        if (queryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(cb, queryPool, 0, 2);
+            vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+        }
+        VkBufferCopy region{}; region.size = bytes;
+        vkCmdCopyBuffer(cb, src, dst, 1, &region);
+        if (queryPool != VK_NULL_HANDLE) vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+        VkMemoryBarrier hostBarrier{}; hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+        vkEndCommandBuffer(cb);
+
+        VkSubmitInfo submitInfo{}; submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; submitInfo.commandBufferCount = 1; submitInfo.pCommandBuffers = &cb;
+        submitTime = std::chrono::steady_clock::now();
+        if (vkQueueSubmit(queue.queue, 1, &submitInfo, fence) != VK_SUCCESS) throw std::runtime_error("vkQueueSubmit failed (device lost?)");
+    }
+
+    double wait() {
+        vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+        double hostSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - submitTime).count();
+        vkResetFences(device, 1, &fence);
+        if (queryPool == VK_NULL_HANDLE) return hostSeconds;
+
+        uint64_t ticks[2];
+        vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        return double((ticks[1] - ticks[0]) & VulkanContext::timestampMask(queue.timestampValidBits)) * periodNs * 1e-9;
+    }
+
+private:
+    VkDevice device;
+    VulkanQueue queue;
+    double periodNs;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    std::chrono::steady_clock::time_point submitTime;
+};
+
+inline double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Best GB/s of memcpy(dst, src, bytes), repeated enough to be timeable.
+inline double memcpyGbps(void* dst, const void* src, uint64_t bytes) {
+    const uint64_t copies = std::max<uint64_t>(1, TRANSFER_MEMCPY_BYTES / bytes);
+    double best = 0;
+    for (uint32_t r = 0; r < TRANSFER_REPEATS; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t c = 0; c < copies; ++c) std::memcpy(dst, src, bytes);
+        best = std::max(best, double(bytes) * copies / secondsSince(start) / 1e9);
+    }
+    return best;
+}
+
+inline int runTransferBench(const VulkanContext& vulkan, const void* spirv, size_t spirvSize, const TransferOptions& options) {
+    VkDevice device = vulkan.device;
+    const VkMemoryPropertyFlags HOST_COHERENT = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VkMemoryPropertyFlags readbackFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    try {
+        vulkan.findMemoryType(~0u, readbackFlags);
+    } catch (const std::exception&) {
+        readbackFlags = HOST_COHERENT;
+    }
+
+    // The compute queue, the first dedicated transfer queue, and the queue
+    // the overlap test copies on: that transfer queue, else any other one
+    // that can copy (not a video queue: those have no vkCmdCopyBuffer).
+    const VulkanQueue* computeQueue = nullptr;
+    const VulkanQueue* transferQueue = nullptr;
+    const VulkanQueue* overlapQueue = nullptr;
+    for (const VulkanQueue& q : vulkan.queues) {
+        if (q.queue == vulkan.computeQueue) computeQueue = &q;
+        else if (!transferQueue && (q.flags & VK_QUEUE_TRANSFER_BIT) && !(q.flags & (VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT))) transferQueue = &q;
+    }
+    for (const VulkanQueue& q : vulkan.queues) {
+        const VkQueueFlags canCopy = VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT;
+        if (!overlapQueue && q.queue != vulkan.computeQueue && (q.flags & canCopy)) overlapQueue = &q;
+    }
+    if (transferQueue) overlapQueue = transferQueue;
+    if (!computeQueue) throw std::runtime_error("--transfer: the context was created without its queue list");
+
+    std::vector<std::unique_ptr<QueueCopy>> copies;
+    std::vector<std::string> copyNames;
+    copies.emplace_back(new QueueCopy(vulkan, *computeQueue));
+    copyNames.push_back("compute");
+    if (transferQueue) {
+        copies.emplace_back(new QueueCopy(vulkan, *transferQueue));
+        copyNames.push_back("transfer");
+    }
+
+    std::cout << "Transfer benchmark on " << vulkan.properties.deviceName << ", best GB/s of " << TRANSFER_REPEATS << " runs" << std::endl;
+    std::cout << "  compute queue: family " << computeQueue->family << std::endl;
+    if (transferQueue) std::cout << "  transfer queue: family " << transferQueue->family << (transferQueue->timestampValidBits ? "" : " (no timestamps, host-timed)") << std::endl;
+    else std::cout << "  no dedicated transfer queue family" << std::endl;
+    std::cout << "  readback memory: " << ((readbackFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? "host-cached" : "host-coherent (no cached type)") << std::endl;
+
+    std::printf("%10s%10s%10s%10s", "size", "memcpy", "to-map", "from-map");
+    for (const std::string& n : copyNames) std::printf("%12s", ("up:" + n).c_str());
+    for (const std::string& n : copyNames) std::printf("%14s", ("down:" + n).c_str());
+    std::printf("%10s\n", "staged");
+
+    struct Point {
+        uint64_t bytes;
+        double memcpyGbps, toMapGbps, fromMapGbps, stagedGbps;
+        std::vector<double> upGbps, downGbps;
+    };
+    std::vector<Point> points;
+    uint64_t lastBytes = 0;
+
+    for (uint64_t bytes = options.minBytes; bytes <= options.maxBytes; bytes *= 2) {
+        VkBuffer staging = VK_NULL_HANDLE, local = VK_NULL_HANDLE, readback = VK_NULL_HANDLE;
+        VkDeviceMemory stagingMemory = VK_NULL_HANDLE, localMemory = VK_NULL_HANDLE, readbackMemory = VK_NULL_HANDLE;
+        try {
+            vulkan.createBuffer(bytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, HOST_COHERENT, staging, stagingMemory);
+            vulkan.createBuffer(bytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, local, localMemory);
+            vulkan.createBuffer(bytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, readbackFlags, readback, readbackMemory);
+        } catch (const std::exception& e) {
+            if (staging != VK_NULL_HANDLE) { vkDestroyBuffer(device, staging, nullptr); vkFreeMemory(device, stagingMemory, nullptr); }
+            if (local != VK_NULL_HANDLE) { vkDestroyBuffer(device, local, nullptr); vkFreeMemory(device, localMemory, nullptr); }
+            std::cout << formatBytes(bytes) << " and up: " << e.what() << std::endl;
+            break;
+        }
+        void* stagingMap; void* readbackMap;
+        vkMapMemory(device, stagingMemory, 0, VK_WHOLE_SIZE, 0, &stagingMap);
+        vkMapMemory(device, readbackMemory, 0, VK_WHOLE_SIZE, 0, &readbackMap);
+        std::vector<unsigned char> hostSrc(bytes, 0x5a), hostDst(bytes);
+
+        Point point{bytes, 0, 0, 0, 0, {}, {}};
+        point.memcpyGbps = memcpyGbps(hostDst.data(), hostSrc.data(), bytes);
+        point.toMapGbps = memcpyGbps(stagingMap, hostSrc.data(), bytes);
+        if (!(readbackFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+            VkMappedMemoryRange range{}; range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE; range.memory = readbackMemory; range.size = VK_WHOLE_SIZE;
+            vkInvalidateMappedMemoryRanges(device, 1, &range);
+        }
+        point.fromMapGbps = memcpyGbps(hostDst.data(), readbackMap, bytes);
+
+        for (size_t q = 0; q < copies.size(); ++q) {
+            double up = 0, down = 0;
+            copies[q]->run(staging, local, bytes); // warm-up
+            for (uint32_t r = 0; r < TRANSFER_REPEATS; ++r) up = std::max(up, bytes / copies[q]->run(staging, local, bytes) / 1e9);
+            for (uint32_t r = 0; r < TRANSFER_REPEATS; ++r) down = std::max(down, bytes / copies[q]->run(local, readback, bytes) / 1e9);
+            point.upGbps.push_back(up);
+            point.downGbps.push_back(down);
+        }
+
+        // Staged upload, host clock: memcpy into staging, copy on the fastest queue.
+        QueueCopy& uploader = *copies[std::max_element(point.upGbps.begin(), point.upGbps.end()) - point.upGbps.begin()];
+        for (uint32_t r = 0; r < TRANSFER_REPEATS; ++r) {
+            auto start = std::chrono::steady_clock::now();
+            std::memcpy(stagingMap, hostSrc.data(), bytes);
+            uploader.run(staging, local, bytes);
+            point.stagedGbps = std::max(point.stagedGbps, bytes / secondsSince(start) / 1e9);
+        }
+
+        std::printf("%10s%10.2f%10.2f%10.2f", formatBytes(bytes).c_str(), point.memcpyGbps, point.toMapGbps, point.fromMapGbps);
+        for (double g : point.upGbps) std::printf("%12.2f", g);
+        for (double g : point.downGbps) std::printf("%14.2f", g);
+        std::printf("%10.2f\n", point.stagedGbps);
+        std::fflush(stdout);
+        points.push_back(point);
+        lastBytes = bytes;
+
+        vkUnmapMemory(device, stagingMemory);
+        vkUnmapMemory(device, readbackMemory);
+        vkDestroyBuffer(device, staging, nullptr); vkFreeMemory(device, stagingMemory, nullptr);
+        vkDestroyBuffer(device, local, nullptr); vkFreeMemory(device, localMemory, nullptr);
+        vkDestroyBuffer(device, readback, nullptr); vkFreeMemory(device, readbackMemory, nullptr);
+    }
+
+    // --- Overlap: upload on a second queue against compute on the compute queue ---
+    double copySeconds = 0, computeSeconds = 0, bothSeconds = 0, overlap = -1;
+    if (!overlapQueue) {
+        std::cout << "Overlap: skipped, no second queue that can copy" << std::endl;
+    } else if (lastBytes != 0) {
+        VkBuffer staging, local, scratch;
+        VkDeviceMemory stagingMemory, localMemory, scratchMemory;
+        vulkan.createBuffer(lastBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, HOST_COHERENT, staging, stagingMemory);
+        vulkan.createBuffer(lastBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, local, localMemory);
+        vulkan.createBuffer(OVERLAP_COMPUTE_BYTES, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, scratch, scratchMemory);
+
+        QueueCopy copy(vulkan, *overlapQueue);
+        VkShaderModule module = vulkan.createShaderModule(spirv, spirvSize);
+        // Only READ's a binding is touched; the write the shader keeps is never taken.
+        ComputeKernel compute(vulkan, module, 3, 4 * sizeof(uint32_t), {BANDWIDTH_PATTERNS[0].id});
+        compute.bind({scratch, scratch, scratch});
+        struct { uint32_t mask, iterations, stride, scalar; } push = {uint32_t(OVERLAP_COMPUTE_BYTES / 16 - 1), 64, 1, 3};
+
+        // Size the compute to the copy.
+        copy.run(staging, local, lastBytes);
+        auto start = std::chrono::steady_clock::now();
+        copy.run(staging, local, lastBytes);
+        double target = secondsSince(start);
+        compute.run(SWEEP_WORKGROUPS, &push);
+        start = std::chrono::steady_clock::now();
+        compute.run(SWEEP_WORKGROUPS, &push);
+        push.iterations = uint32_t(std::max(1.0, std::min(double(1u << 30), push.iterations * target / secondsSince(start))));
+
+        // Host clock throughout: the two queues' timestamps need not share a timeline.
+        copySeconds = computeSeconds = bothSeconds = 1e30;
+        for (uint32_t r = 0; r < TRANSFER_REPEATS; ++r) {
+            start = std::chrono::steady_clock::now();
+            copy.run(staging, local, lastBytes);
+            copySeconds = std::min(copySeconds, secondsSince(start));
+            start = std::chrono::steady_clock::now();
+            compute.run(SWEEP_WORKGROUPS, &push);
+            computeSeconds = std::min(computeSeconds, secondsSince(start));
+            start = std::chrono::steady_clock::now();
+            compute.submit(SWEEP_WORKGROUPS, &push);
+            copy.submit(staging, local, lastBytes);
+            compute.wait();
+            copy.wait();
+            bothSeconds = std::min(bothSeconds, secondsSince(start));
+        }
+        overlap = std::max(0.0, std::min(1.0, (copySeconds + computeSeconds - bothSeconds) / std::min(copySeconds, computeSeconds)));
+        std::printf("Overlap at %s on family %u: copy %.3f ms, compute %.3f ms, both %.3f ms -> overlap %.2f\n",
+                    formatBytes(lastBytes).c_str(), overlapQueue->family, copySeconds * 1e3, computeSeconds * 1e3, bothSeconds * 1e3, overlap);
+
+        vkDestroyShaderModule(device, module, nullptr);
+        vkDestroyBuffer(device, staging, nullptr); vkFreeMemory(device, stagingMemory, nullptr);
+        vkDestroyBuffer(device, local, nullptr); vkFreeMemory(device, localMemory, nullptr);
+        vkDestroyBuffer(device, scratch, nullptr); vkFreeMemory(device, scratchMemory, nullptr);
+    }
+
+    if (!options.jsonPath.empty()) {
+        std::ofstream out(options.jsonPath);
+        if (!out) throw std::runtime_error("Cannot write " + options.jsonPath);
+        JsonWriter json(out);
+        json.beginObject();
+        json.value("tool", "memstress-transfer");
+        json.device("device", vulkan);
+        json.value("transfer_queue_family", transferQueue ? int(transferQueue->family) : -1);
+        json.value("readback_host_cached", (readbackFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0);
+        json.beginArray("results");
+        for (const Point& p : points) {
+            json.beginObject();
+            json.value("bytes", p.bytes);
+            json.value("memcpy_gb_per_second", p.memcpyGbps);
+            json.value("to_map_gb_per_second", p.toMapGbps);
+            json.value("from_map_gb_per_second", p.fromMapGbps);
+            json.value("staged_upload_gb_per_second", p.stagedGbps);
+            for (size_t q = 0; q < copyNames.size(); ++q) {
+                json.value(("upload_" + copyNames[q] + "_gb_per_second").c_str(), p.upGbps[q]);
+                json.value(("download_" + copyNames[q] + "_gb_per_second").c_str(), p.downGbps[q]);
+            }
+            json.endObject();
+        }
+        json.endArray();
+        json.beginObject("overlap");
+        if (overlap >= 0) {
+            json.value("bytes", lastBytes);
+            json.value("queue_family", overlapQueue->family);
+            json.value("copy_ms", copySeconds * 1e3);
+            json.value("compute_ms", computeSeconds * 1e3);
+            json.value("both_ms", bothSeconds * 1e3);
+            json.value("overlap", overlap);
+        }
+        json.endObject();
+        json.endObject();
+        json.finish();
+        std::cout << "Report written to " << options.jsonPath << std::endl;
+    }
+    return 0;
+}
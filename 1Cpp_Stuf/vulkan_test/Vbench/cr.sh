@@ -0,0 +1,11 @@
+#!/bin/bash
+
+# The workloads are the shaders of the stress tools; run the binary from here
+# (./build/Vbench ...), it opens them relative to the working directory.
+glslc ../GSTRESS/stress.comp -o stress.spv
+glslc ../HSTRESS/hybrid_stress.comp -o hybrid_stress.spv
+glslc ../Memstress/memory_stress.comp -o memory_stress.spv
+mkdir build
+cd build
+cmake ..
+make
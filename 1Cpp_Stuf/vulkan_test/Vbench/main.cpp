@@ -0,0 +1,326 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <atomic>
+#include <csignal>
+#include <stdexcept>
+#include <vulkan/vulkan.h>
+
+#include "../common/vk_context.h"
+#include "../common/bench_report.h"
+#include "workloads.h"
+
+/*
+ * Vbench: one runner for the stress shaders of GSTRESS, HSTRESS and
+ * Memstress that measures instead of just burning. It keeps a few
+ * dispatches in flight as the stress tools do, stops after --duration
+ * seconds or --iterations dispatches (or on Ctrl+C), and writes a JSON
+ * report: achieved work and bytes per second, GPU time per dispatch from
+ * timestamp queries, submit-to-fence latency on the host, and the rate
+ * of every one-second window to show how steady the device was.
+ */
+
+// --- Configuration ---
+const double DEFAULT_DURATION = 10.0; // seconds
+const uint32_t DEFAULT_IN_FLIGHT = 2;
+const double WINDOW_SECONDS = 1.0;    // per-window rates in the report
+
+using Clock = std::chrono::steady_clock;
+
+std::atomic<bool> stopRequested{false};
+void onSigint(int) { stopRequested = true; }
+
+struct Options {
+    std::string device;
+    std::string workload;
+    std::string jsonPath = "-";
+    double duration = DEFAULT_DURATION;
+    uint64_t iterations = 0;
+    uint32_t inFlight = DEFAULT_IN_FLIGHT;
+    WorkloadOptions workloadOptions;
+};
+
+// One dispatch slot: its command buffer is recorded once and resubmitted.
+struct Frame {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    uint32_t firstQuery = 0;
+    bool pending = false;
+    Clock::time_point submitted;
+};
+
+void writeReport(std::ostream& out, const Options& options, const VulkanContext& vulkan, const Workload& w,
+                 uint64_t dispatches, double wallSeconds, double gpuSeconds, const RunningStats& dispatchMs,
+                 const RunningStats& latencyMs, const std::vector<double>& windows) {
+    JsonWriter json(out);
+    RunningStats windowStats;
+    for (double r : windows) windowStats.add(r);
+    double ops = w.opsPerDispatch * dispatches, bytes = w.bytesPerDispatch * dispatches;
+
+    json.beginObject();
+    json.value("tool", "vbench");
+    json.value("workload", w.name);
+    json.device("device", vulkan);
+    json.beginObject("config");
+    json.value("workgroups", w.workgroups);
+    json.value("in_flight", options.inFlight);
+    json.value("duration_limit_s", options.duration);
+    json.value("iteration_limit", options.iterations);
+    json.value("slow_mulmod", options.workloadOptions.slowMulmod);
+    json.value("intensity", options.workloadOptions.intensity);
+    json.endObject();
+    json.value("dispatches", dispatches);
+    json.value("wall_seconds", wallSeconds);
+    json.value("gpu_seconds", vulkan.timestampValidBits ? gpuSeconds : NAN);
+    json.value("op_unit", w.opUnit);
+    json.value("ops", ops);
+    json.value("ops_per_second", ops / wallSeconds);
+    json.value("gpu_ops_per_second", vulkan.timestampValidBits ? ops / gpuSeconds : NAN);
+    json.value("bytes", bytes);
+    json.value("gb_per_second", bytes / wallSeconds / 1e9);
+    json.value("gpu_gb_per_second", vulkan.timestampValidBits ? bytes / gpuSeconds / 1e9 : NAN);
+    json.stats("dispatch_gpu_ms", dispatchMs);
+    json.stats("submit_to_fence_ms", latencyMs);
+    json.beginObject("windows");
+    json.value("seconds", WINDOW_SECONDS);
+    json.stats("ops_per_second", windowStats);
+    json.value("cv", windowStats.cv());
+    json.beginArray("samples");
+    for (double r : windows) json.value(nullptr, r);
+    json.endArray();
+    json.endObject();
+    json.endObject();
+    json.finish();
+}
+
+int run(const Options& options) {
+    // --- 1. Device and Workload ---
+    VulkanContext vulkan(options.device, "Vbench");
+    VkDevice device = vulkan.device;
+    Workload w = makeWorkload(options.workload, options.workloadOptions);
+    if (!vulkan.enabledFeatures.shaderInt64 && w.name != "memstress") {
+        throw std::runtime_error(std::string(vulkan.properties.deviceName) + " has no shaderInt64, which " + w.name + " needs");
+    }
+    std::cerr << "Device " << vulkan.deviceIndex << ": " << vulkan.properties.deviceName << " (" << vulkan.deviceType() << "), workload " << w.name << std::endl;
+
+    // --- 2. Buffers ---
+    std::vector<VkBuffer> buffers(w.buffers.size());
+    std::vector<VkDeviceMemory> memories(w.buffers.size());
+    for (size_t b = 0; b < w.buffers.size(); ++b) {
+        vulkan.createBuffer(w.buffers[b], VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffers[b], memories[b]);
+    }
+
+    // --- 3. Pipeline from the Description ---
+    const uint32_t bindingCount = uint32_t(w.buffers.size());
+    std::vector<VkDescriptorSetLayoutBinding> bindings(bindingCount);
+    for (uint32_t b = 0; b < bindingCount; ++b) {
+        bindings[b].binding = b; bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; bindings[b].descriptorCount = 1; bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo layoutInfo{}; layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO; layoutInfo.bindingCount = bindingCount; layoutInfo.pBindings = bindings.data();
+    VkDescriptorSetLayout descriptorSetLayout;
+    vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout);
+
+    const uint32_t pushBytes = uint32_t(sizeof(uint32_t) * w.pushConstants.size());
+    VkPushConstantRange pushConstantRange{}; pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT; pushConstantRange.offset = 0; pushConstantRange.size = pushBytes;
+    VkPipelineLayoutCreateInfo plInfo{}; plInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO; plInfo.setLayoutCount = 1; plInfo.pSetLayouts = &descriptorSetLayout; plInfo.pushConstantRangeCount = pushBytes ? 1 : 0; plInfo.pPushConstantRanges = &pushConstantRange;
+    VkPipelineLayout pipelineLayout;
+    vkCreatePipelineLayout(device, &plInfo, nullptr, &pipelineLayout);
+
+    std::vector<VkSpecializationMapEntry> specEntries(w.specConstants.size());
+    for (uint32_t c = 0; c < specEntries.size(); ++c) {
+        specEntries[c].constantID = c; specEntries[c].offset = c * sizeof(uint32_t); specEntries[c].size = sizeof(uint32_t);
+    }
+    VkSpecializationInfo specInfo{}; specInfo.mapEntryCount = uint32_t(specEntries.size()); specInfo.pMapEntries = specEntries.data(); specInfo.dataSize = sizeof(uint32_t) * w.specConstants.size(); specInfo.pData = w.specConstants.data();
+
+    VkShaderModule shaderModule = vulkan.loadShader(w.shader);
+    VkComputePipelineCreateInfo pInfo{}; pInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO; pInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO; pInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT; pInfo.stage.module = shaderModule; pInfo.stage.pName = "main"; pInfo.stage.pSpecializationInfo = &specInfo; pInfo.layout = pipelineLayout;
+    VkPipeline pipeline;
+    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pInfo, nullptr, &pipeline) != VK_SUCCESS) throw std::runtime_error("Failed to create the " + w.name + " pipeline");
+
+    VkDescriptorPool pool;
+    VkDescriptorPoolSize poolSize{}; poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; poolSize.descriptorCount = bindingCount;
+    VkDescriptorPoolCreateInfo poolInfo{}; poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO; poolInfo.poolSizeCount = 1; poolInfo.pPoolSizes = &poolSize; poolInfo.maxSets = 1;
+    vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool);
+    VkDescriptorSet dSet;
+    VkDescriptorSetAllocateInfo dsAllocInfo{}; dsAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO; dsAllocInfo.descriptorPool = pool; dsAllocInfo.descriptorSetCount = 1; dsAllocInfo.pSetLayouts = &descriptorSetLayout;
+    vkAllocateDescriptorSets(device, &dsAllocInfo, &dSet);
+    std::vector<VkDescriptorBufferInfo> bufferInfos(bindingCount);
+    std::vector<VkWriteDescriptorSet> writes(bindingCount);
+    for (uint32_t b = 0; b < bindingCount; ++b) {
+        bufferInfos[b].buffer = buffers[b]; bufferInfos[b].range = VK_WHOLE_SIZE;
+        writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; writes[b].dstSet = dSet; writes[b].dstBinding = b; writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; writes[b].descriptorCount = 1; writes[b].pBufferInfo = &bufferInfos[b];
+    }
+    vkUpdateDescriptorSets(device, bindingCount, writes.data(), 0, nullptr);
+
+    // --- 4. Frames: Command Buffers Recorded Once, Fences and Timestamps ---
+    const bool timed = vulkan.timestampValidBits != 0;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (timed) {
+        VkQueryPoolCreateInfo qpInfo{}; qpInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO; qpInfo.queryType = VK_QUERY_TYPE_TIMESTAMP; qpInfo.queryCount = 2 * options.inFlight;
+        vkCreateQueryPool(device, &qpInfo, nullptr, &queryPool);
+    } else {
+        std::cerr << "The compute queue has no timestamps; GPU times are left out of the report." << std::endl;
+    }
+
+    VkCommandPool cmdPool;
+    VkCommandPoolCreateInfo cpInfo{}; cpInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO; cpInfo.queueFamilyIndex = vulkan.queueFamilyIndex;
+    vkCreateCommandPool(device, &cpInfo, nullptr, &cmdPool);
+    std::vector<Frame> frames(options.inFlight);
+    for (uint32_t f = 0; f < options.inFlight; ++f) {
+        Frame& frame = frames[f];
+        frame.firstQuery = 2 * f;
+        VkCommandBufferAllocateInfo cbAllocInfo{}; cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO; cbAllocInfo.commandPool = cmdPool; cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbAllocInfo.commandBufferCount = 1;
+        vkAllocateCommandBuffers(device, &cbAllocInfo, &frame.commandBuffer);
+        VkFenceCreateInfo fenceInfo{}; fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        vkCreateFence(device, &fenceInfo, nullptr, &frame.fence);
+
+        VkCommandBuffer cb = frame.commandBuffer;
+        VkCommandBufferBeginInfo beginInfo{}; beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        vkBeginCommandBuffer(cb, &beginInfo);
+        if (timed) {
+            vkCmdResetQueryPool(cb, queryPool, frame.firstQuery, 2);
+            vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, frame.firstQuery);
+        }
+        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &dSet, 0, nullptr);
+        if (pushBytes) vkCmdPushConstants(cb, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, pushBytes, w.pushConstants.data());
+        vkCmdDispatch(cb, w.workgroups, 1, 1);
+        if (timed) vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, frame.firstQuery + 1);
+        vkEndCommandBuffer(cb);
+    }
+
+    // --- 5. Measured Submit Loop ---
+    uint64_t submitted = 0, completed = 0;
+    double gpuSeconds = 0.0;
+    RunningStats dispatchMs, latencyMs;
+    std::vector<double> windows;
+    double windowOps = 0.0;
+    const Clock::time_point start = Clock::now();
+    Clock::time_point windowStart = start;
+
+    // Waits for a frame and books its dispatch.
+    auto collect = [&](Frame& frame) {
+        vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+        Clock::time_point done = Clock::now();
+        vkResetFences(device, 1, &frame.fence);
+        frame.pending = false;
+        ++completed;
+        latencyMs.add(std::chrono::duration<double, std::milli>(done - frame.submitted).count());
+        if (timed) {
+            uint64_t ticks[2];
+            vkGetQueryPoolResults(device, queryPool, frame.firstQuery, 2, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+            double seconds = double((ticks[1] - ticks[0]) & vulkan.timestampMask()) * vulkan.timestampPeriodNs * 1e-9;
+            gpuSeconds += seconds;
+            dispatchMs.add(seconds * 1e3);
+        }
+        double windowSeconds = std::chrono::duration<double>(done - windowStart).count();
+        if (windowSeconds >= WINDOW_SECONDS) {
+            windows.push_back(windowOps / windowSeconds);
+            windowOps = 0.0;
+            windowStart = done;
+        }
+        windowOps += w.opsPerDispatch;
+    };
+
+    std::signal(SIGINT, onSigint);
+    std::cerr << "Running " << w.name << " for " << (options.duration > 0 ? std::to_string(options.duration) + " s" : std::string("unlimited time"))
+              << (options.iterations ? ", at most " + std::to_string(options.iterations) + " dispatches" : std::string()) << ". Press Ctrl+C to stop." << std::endl;
+    while (!stopRequested) {
+        Frame& frame = frames[submitted % options.inFlight];
+        if (frame.pending) collect(frame);
+        if (options.iterations && submitted >= options.iterations) break;
+        if (options.duration > 0 && std::chrono::duration<double>(Clock::now() - start).count() >= options.duration) break;
+
+        VkSubmitInfo submitInfo{}; submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; submitInfo.commandBufferCount = 1; submitInfo.pCommandBuffers = &frame.commandBuffer;
+        frame.submitted = Clock::now();
+        if (vkQueueSubmit(vulkan.computeQueue, 1, &submitInfo, frame.fence) != VK_SUCCESS) throw std::runtime_error("vkQueueSubmit failed (device lost?)");
+        frame.pending = true;
+        ++submitted;
+    }
+    for (uint64_t k = completed; k < submitted; ++k) {
+        Frame& frame = frames[k % options.inFlight];
+        if (frame.pending) collect(frame);
+    }
+    const double wallSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // --- 6. Report ---
+    std::cerr << "--- " << w.name << ": " << completed << " dispatches in " << wallSeconds << " s, "
+              << w.opsPerDispatch * completed / wallSeconds / 1e9 << " G" << w.opUnit << "/s";
+    if (w.bytesPerDispatch > 0) std::cerr << ", " << w.bytesPerDispatch * completed / wallSeconds / 1e9 << " GB/s";
+    if (timed && dispatchMs.count) std::cerr << ", " << dispatchMs.mean << " ms GPU per dispatch (stddev " << dispatchMs.stddev() << ")";
+    std::cerr << " ---" << std::endl;
+
+    if (options.jsonPath == "-") {
+        writeReport(std::cout, options, vulkan, w, completed, wallSeconds, gpuSeconds, dispatchMs, latencyMs, windows);
+    } else {
+        std::ofstream out(options.jsonPath);
+        if (!out) throw std::runtime_error("Cannot write " + options.jsonPath);
+        writeReport(out, options, vulkan, w, completed, wallSeconds, gpuSeconds, dispatchMs, latencyMs, windows);
+        std::cerr << "Report written to " << options.jsonPath << std::endl;
+    }
+
+    // --- 7. Cleanup ---
+    vkDeviceWaitIdle(device);
+    for (Frame& frame : frames) vkDestroyFence(device, frame.fence, nullptr);
+    vkDestroyCommandPool(device, cmdPool, nullptr);
+    if (queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(device, queryPool, nullptr);
+    vkDestroyDescriptorPool(device, pool, nullptr);
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyShaderModule(device, shaderModule, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    for (size_t b = 0; b < buffers.size(); ++b) {
+        vkDestroyBuffer(device, buffers[b], nullptr);
+        vkFreeMemory(device, memories[b], nullptr);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    bool listDevices = false;
+    auto usage = [&]() {
+        std::cerr << "Usage: " << argv[0] << " --workload <" << WORKLOAD_NAMES << "> [--device <index|name|uuid>] [--duration <seconds, 0 = no limit>]"
+                  << " [--iterations <dispatches>] [--in-flight <n>] [--slow-mulmod] [--intensity <gstress numbers per invocation, 1-" << MAX_INTENSITY << ">] [--start <n>]"
+                  << " [--json <file, - = stdout>]\n"
+                  << "       " << argv[0] << " --list-devices" << std::endl;
+        return 1;
+    };
+    int i = 1; // the option being parsed; argc once they all are
+    try {
+        for (; i < argc; ++i) {
+            bool hasValue = i + 1 < argc;
+            if (strcmp(argv[i], "--list-devices") == 0) listDevices = true;
+            else if (strcmp(argv[i], "--device") == 0 && hasValue) options.device = argv[++i];
+            else if (strcmp(argv[i], "--workload") == 0 && hasValue) options.workload = argv[++i];
+            else if (strcmp(argv[i], "--duration") == 0 && hasValue) options.duration = std::stod(argv[++i]);
+            else if (strcmp(argv[i], "--iterations") == 0 && hasValue) options.iterations = std::stoull(argv[++i]);
+            else if (strcmp(argv[i], "--in-flight") == 0 && hasValue) options.inFlight = uint32_t(std::stoul(argv[++i]));
+            else if (strcmp(argv[i], "--slow-mulmod") == 0) options.workloadOptions.slowMulmod = true;
+            else if (strcmp(argv[i], "--intensity") == 0 && hasValue) options.workloadOptions.intensity = uint32_t(std::stoul(argv[++i]));
+            else if (strcmp(argv[i], "--start") == 0 && hasValue) options.workloadOptions.start = std::stoull(argv[++i]);
+            else if (strcmp(argv[i], "--json") == 0 && hasValue) options.jsonPath = argv[++i];
+            else return usage();
+        }
+        if (listDevices) {
+            VulkanContext::listDevices(std::cout);
+            return 0;
+        }
+        if (options.workload.empty() || options.inFlight == 0) return usage();
+        if (options.workloadOptions.intensity == 0 || options.workloadOptions.intensity > MAX_INTENSITY) {
+            std::cerr << "--intensity must be 1 to " << MAX_INTENSITY << std::endl;
+            return 1;
+        }
+        return run(options);
+    } catch (const std::exception& e) {
+        if (i < argc) { // std::stoul and friends on argv[i], the value of argv[i - 1]
+            std::cerr << "Error: " << argv[i - 1] << " " << argv[i] << ": not a valid number" << std::endl;
+            return usage();
+        }
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <vulkan/vulkan.h>
+
+/*
+ * The compute workloads Vbench can run, described as data: which shader,
+ * which buffers, which constants, how many workgroups per dispatch and
+ * how much work one dispatch stands for. The runner builds one pipeline
+ * from a description and knows nothing else about the shader.
+ *
+ * The shaders are the ones of the stress tools (GSTRESS, HSTRESS,
+ * Memstress); cr.sh compiles them into Vbench/ and the binary opens them
+ * relative to the working directory, so run it from there
+ * (./build/Vbench ...). The work counts below mirror the loop bounds in
+ * those shaders and must follow them.
+ */
+
+struct Workload {
+    std::string name;
+    std::string shader;                  // SPIR-V file, relative to the working directory
+    std::vector<VkDeviceSize> buffers;   // device-local storage buffers at bindings 0, 1, ...
+    std::vector<uint32_t> pushConstants; // 32-bit words at offset 0
+    std::vector<uint32_t> specConstants; // constant_id 0, 1, ...
+    uint32_t workgroups = 0;             // of 256 invocations, the local size of every shader
+    const char* opUnit = "";             // what opsPerDispatch counts
+    double opsPerDispatch = 0;
+    double bytesPerDispatch = 0;         // buffer traffic the shader asks for, cached or not
+};
+
+struct WorkloadOptions {
+    bool slowMulmod = false;   // gstress: the twelve-base double-and-add test
+    uint32_t intensity = 64;   // gstress: numbers tested per invocation, up to MAX_INTENSITY
+    uint64_t start = (1ULL << 40) + 1; // gstress: first (odd) number
+};
+
+// GSTRESS's MAX_ITERATIONS: keeps stress.comp's per-workgroup mulmod count in 32 bits.
+const uint32_t MAX_INTENSITY = 4096;
+
+const char* const WORKLOAD_NAMES = "gstress, hstress, memstress";
+
+inline Workload makeWorkload(const std::string& name, const WorkloadOptions& options) {
+    const uint32_t WORKGROUP_SIZE = 256;
+    const uint32_t WORKGROUP_COUNT = 4096;
+    const uint32_t BUFFER_ELEMENTS = 64 * 1024 * 1024; // 64 Million uints = 256 MB per buffer
+    const double invocations = double(WORKGROUP_SIZE) * WORKGROUP_COUNT;
+
+    Workload w;
+    w.name = name;
+    w.workgroups = WORKGROUP_COUNT;
+    if (name == "gstress") {
+        // stress.comp: intensity odd numbers per invocation, a checksum per
+        // invocation and a mulmod count per workgroup. Every dispatch tests
+        // the same numbers; GSTRESS itself moves on and checks the results.
+        w.shader = "stress.spv";
+        w.buffers = {sizeof(uint32_t) * (WORKGROUP_COUNT * WORKGROUP_SIZE + WORKGROUP_COUNT)};
+        uint64_t first = options.start | 1;
+        w.pushConstants = {uint32_t(first), uint32_t(first >> 32), options.intensity, 0};
+        w.specConstants = {options.slowMulmod ? 1u : 0u};
+        w.opUnit = "numbers";
+        w.opsPerDispatch = invocations * options.intensity;
+    } else if (name == "hstress") {
+        // hybrid_stress.comp: 500 elements per invocation, read, 20 mul-mod rounds, written back.
+        w.shader = "hybrid_stress.spv";
+        w.buffers = {sizeof(uint32_t) * BUFFER_ELEMENTS, sizeof(uint32_t) * BUFFER_ELEMENTS};
+        w.pushConstants = {BUFFER_ELEMENTS};
+        w.opUnit = "elements";
+        w.opsPerDispatch = invocations * 500;
+        w.bytesPerDispatch = w.opsPerDispatch * 2 * sizeof(uint32_t);
+    } else if (name == "memstress") {
+        // memory_stress.comp: 5000 copied elements per invocation.
+        w.shader = "memory_stress.spv";
+        w.buffers = {sizeof(uint32_t) * BUFFER_ELEMENTS, sizeof(uint32_t) * BUFFER_ELEMENTS};
+        w.pushConstants = {BUFFER_ELEMENTS};
+        w.opUnit = "elements";
+        w.opsPerDispatch = invocations * 5000;
+        w.bytesPerDispatch = w.opsPerDispatch * 2 * sizeof(uint32_t);
+    } else {
+        throw std::runtime_error("Unknown workload '" + name + "' (one of " + WORKLOAD_NAMES + ")");
+    }
+    return w;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "prime_output.h"
+
+/*
+ * Resume file of a long Vsieve run. It is only written after the writer
+ * has synced, so it never claims more than is on disk: blocksDone counts
+ * the leading blocks of the run whose primes are all in the output file,
+ * and writer says how long that file is and where the gap encoding stands.
+ * A restart cuts the output back to that length and carries on from the
+ * next block, losing at most the blocks since the last checkpoint.
+ *
+ * The file is plain "key=value" lines and is replaced atomically (write a
+ * temporary, fsync, rename), so a crash leaves either the old or the new
+ * checkpoint, never half of one. With --stats the statistics of the same
+ * blocksDone follow a "[stats]" line in that one file, so they can never
+ * be ahead of or behind the checkpoint; the stats file is only a report.
+ */
+
+// Replaces path with data the way a checkpoint is replaced: temporary, fsync, rename.
+inline void replaceFile(const std::string& path, const std::string& data, const std::string& what) {
+    std::string tmp = path + ".tmp";
+    FILE* file = fopen(tmp.c_str(), "w");
+    if (!file) throw std::runtime_error("Failed to write " + what + ": " + tmp);
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size() && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) throw std::runtime_error("Failed to write " + what + ": " + path);
+}
+
+struct Checkpoint {
+    std::string range;  // RangePlan::describe() of the run
+    std::string format; // output format name
+    uint64_t blocksDone = 0;
+    WriterState writer;
+    std::string stats;  // PrimeStats::text() at blocksDone; empty without --stats
+
+    // Returns false when there is no checkpoint file yet.
+    bool load(const std::string& path) {
+        std::ifstream file(path);
+        if (!file.is_open()) return false;
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line == "[stats]") {
+                std::ostringstream rest;
+                rest << file.rdbuf();
+                stats = rest.str();
+                break;
+            }
+            size_t eq = line.find('=');
+            if (eq == std::string::npos) continue;
+            std::string key = line.substr(0, eq), value = line.substr(eq + 1);
+            if (key == "range") range = value;
+            else if (key == "format") format = value;
+            else if (key == "blocks_done") blocksDone = std::stoull(value);
+            else if (key == "primes") writer.primes = std::stoull(value);
+            else if (key == "last_prime") writer.lastPrime = std::stoull(value);
+            else if (key == "output_bytes") writer.outputBytes = std::stoull(value);
+        }
+        if (range.empty()) throw std::runtime_error("Not a Vsieve checkpoint: " + path);
+        return true;
+    }
+
+    void save(const std::string& path) const {
+        std::ostringstream text;
+        text << "range=" << range << "\nformat=" << format << "\nblocks_done=" << blocksDone << "\nprimes=" << writer.primes
+             << "\nlast_prime=" << writer.lastPrime << "\noutput_bytes=" << writer.outputBytes << "\n";
+        if (!stats.empty()) text << "[stats]\n" << stats;
+        replaceFile(path, text.str(), "checkpoint");
+    }
+};
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+
+/*
+ * CPU backend for Vsieve: a multithreaded segmented Sieve of Eratosthenes
+ * that fills the same odd-only block bitmaps as sieve.comp (bit i of a
+ * block is offset + 2*i + 1), so every readback and output path works on
+ * either engine and the two can be compared bit for bit.
+ *
+ * Each worker sieves a contiguous chunk of blocks in L1-sized segments:
+ *  - 3..13 come from a pre-sieved pattern copied into every segment,
+ *  - primes below the segment span cross off each segment directly and
+ *    carry their next multiple over to the next segment,
+ *  - larger primes hit a segment at most once and wait in a bucket for
+ *    the segment their next multiple falls in (primesieve's EratBig).
+ * Chunks of the run's block list are handed out round-robin and returned
+ * in order through next(). Blocks that sit next to each other on the
+ * number line are sieved as one range; a sharded run with gaps between
+ * its blocks sieves them one at a time.
+ *
+ * Each chunk still starts with one division per sieving prime, so the
+ * throughput drops once sqrt(x) gets large, above ~1e16.
+ */
+
+class CpuSieve {
+public:
+    // blockSize numbers per block (a multiple of 128); sieves the blocks
+    // offsetOf(0) .. offsetOf(blocks - 1), which must increase.
+    // With threads == 0 only sieveRange() is usable.
+    CpuSieve(unsigned threads, uint32_t blockSize, uint64_t blocks = 0, std::function<uint64_t(uint64_t)> offsetOf = nullptr)
+        : blockSize(blockSize), blockTotal(blocks), offsetOf(std::move(offsetOf)), window(2 * threads) {
+        buildPattern();
+        chunks.resize(window);
+        for (Chunk& c : chunks) c.bitmap.resize(size_t(CHUNK_BLOCKS) * wordsPerBlock());
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ~CpuSieve() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        chunkFree.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+
+    uint32_t wordsPerBlock() const { return blockSize / 128; }
+
+    // Hands out the next block in increasing order. The bitmap stays valid
+    // until the following call. Returns false after the last block.
+    bool next(uint64_t& offset, const uint64_t*& bitmap) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (blockInChunk == CHUNK_BLOCKS) {
+            // Done with the previous chunk; let a worker reuse its buffer.
+            chunks[consumed % window].ready = false;
+            ++consumed;
+            blockInChunk = 0;
+            chunkFree.notify_all();
+        }
+        Chunk& chunk = chunks[consumed % window];
+        chunkReady.wait(lock, [&] { return chunk.ready; });
+        if (blockInChunk >= chunk.blocks) return false;
+        offset = chunk.offsets[blockInChunk];
+        bitmap = chunk.bitmap.data() + size_t(blockInChunk) * wordsPerBlock();
+        ++blockInChunk;
+        return true;
+    }
+
+    // Sieves blocks consecutive blocks starting at lo (even) into out.
+    void sieveRange(uint64_t lo, uint32_t blocks, uint64_t* out) {
+        // Inclusive: lo + span is 0 when the range ends at 2^64.
+        uint64_t span = uint64_t(blocks) * blockSize;
+        uint64_t last = span - 1 > UINT64_MAX - lo ? UINT64_MAX : lo + span - 1;
+        uint64_t totalBits = span / 2;
+        auto primes = basePrimes(isqrt(last));
+        const uint64_t segBits = SEGMENT_BYTES * 8;
+
+        // Medium primes keep the bit index of their next multiple, relative to the segment.
+        std::vector<uint32_t> mediumPrimes;
+        std::vector<uint64_t> mediumNext;
+        // Large primes live in the bucket of the segment they hit next.
+        std::vector<std::vector<BucketEntry>> buckets((totalBits + segBits - 1) / segBits);
+        for (uint32_t p : *primes) {
+            if (p <= PATTERN_PRIMES_MAX) continue;
+            if (uint64_t(p) * p > last) break;
+            // First odd multiple in range, without stepping past 2^64 near the top.
+            uint64_t gap = (p - lo % p) % p;
+            if (gap > last - lo) continue;
+            uint64_t first = std::max(uint64_t(p) * p, lo + gap);
+            if (first % 2 == 0) {
+                if (last - first < p) continue;
+                first += p;
+            }
+            uint64_t index = (first - lo - 1) / 2;
+            if (p < segBits) {
+                mediumPrimes.push_back(p);
+                mediumNext.push_back(index);
+            } else {
+                buckets[index / segBits].push_back({p, uint32_t(index % segBits)});
+            }
+        }
+
+        for (uint64_t seg = 0; seg * segBits < totalBits; ++seg) {
+            uint64_t* bits = out + seg * (segBits / 64);
+            uint64_t nBits = std::min(segBits, totalBits - seg * segBits);
+            uint64_t firstIndex = (lo / 2) + seg * segBits; // global odd index of bit 0
+            copyPattern(bits, nBits / 64, firstIndex);
+            if (firstIndex == 0) {
+                // The pattern strikes 3..13 themselves and keeps 1.
+                bits[0] &= ~uint64_t(1);
+                bits[0] |= (1u << 1) | (1u << 2) | (1u << 3) | (1u << 5) | (1u << 6);
+            }
+
+            for (size_t k = 0; k < mediumPrimes.size(); ++k) {
+                uint64_t j = mediumNext[k];
+                uint32_t p = mediumPrimes[k];
+                for (; j < nBits; j += p) bits[j / 64] &= ~(uint64_t(1) << (j % 64));
+                mediumNext[k] = j - nBits;
+            }
+
+            std::vector<BucketEntry> bucket;
+            bucket.swap(buckets[seg]);
+            for (const BucketEntry& e : bucket) {
+                bits[e.index / 64] &= ~(uint64_t(1) << (e.index % 64));
+                uint64_t nextIndex = seg * segBits + e.index + e.prime;
+                if (nextIndex < totalBits) {
+                    buckets[nextIndex / segBits].push_back({e.prime, uint32_t(nextIndex % segBits)});
+                }
+            }
+        }
+    }
+
+    static uint64_t isqrt(uint64_t x) {
+        uint64_t r = uint64_t(std::sqrt(double(x)));
+        while (r > 0 && (r > UINT32_MAX || r * r > x)) --r;
+        while (r < UINT32_MAX && (r + 1) * (r + 1) <= x) ++r;
+        return r;
+    }
+
+private:
+    static const uint32_t SEGMENT_BYTES = 32 * 1024; // one L1 data cache
+    static const uint32_t CHUNK_BLOCKS = 64;         // blocks per work item
+    // The pattern period over odd indices is 3*5*7*11*13 bits.
+    static const uint32_t PATTERN_PERIOD = 15015;
+    static const uint32_t PATTERN_PRIMES_MAX = 13;
+
+    struct BucketEntry {
+        uint32_t prime;
+        uint32_t index; // bit within the segment
+    };
+
+    struct Chunk {
+        std::vector<uint64_t> offsets;
+        uint32_t blocks = 0;
+        bool ready = false;
+        std::vector<uint64_t> bitmap;
+    };
+
+    // pattern holds PATTERN_PERIOD 64-bit words (a whole number of periods)
+    // plus enough spare words to read 64 bits from any phase.
+    void buildPattern() {
+        size_t words = PATTERN_PERIOD + PATTERN_PERIOD / 64 + 2;
+        pattern.assign(words, 0);
+        for (size_t j = 0; j < words * 64; ++j) {
+            uint64_t n = 2 * (j % PATTERN_PERIOD) + 1;
+            if (n % 3 && n % 5 && n % 7 && n % 11 && n % 13) pattern[j / 64] |= uint64_t(1) << (j % 64);
+        }
+    }
+
+    void copyPattern(uint64_t* bits, uint64_t words, uint64_t firstIndex) const {
+        uint32_t phase = uint32_t(firstIndex % PATTERN_PERIOD);
+        uint32_t base = phase / 64, shift = phase % 64;
+        for (uint64_t k = 0; k < words; ++k) {
+            const uint64_t* p = &pattern[base + k % PATTERN_PERIOD];
+            bits[k] = shift ? (p[0] >> shift) | (p[1] << (64 - shift)) : p[0];
+        }
+    }
+
+    // Odd primes up to at least upTo, extended (and shared) as the sieve moves up.
+    std::shared_ptr<const std::vector<uint32_t>> basePrimes(uint64_t upTo) {
+        std::lock_guard<std::mutex> lock(primesMutex);
+        if (!primes || primesLimit < upTo) {
+            uint64_t newLimit = std::min<uint64_t>(std::max(upTo, 2 * primesLimit), UINT32_MAX);
+            std::vector<bool> composite(newLimit / 2 + 1, false); // odd numbers only
+            auto list = std::make_shared<std::vector<uint32_t>>();
+            for (uint64_t i = 3; i <= newLimit; i += 2) {
+                if (composite[i / 2]) continue;
+                list->push_back(uint32_t(i));
+                for (uint64_t m = i * i; m <= newLimit; m += 2 * i) composite[m / 2] = true;
+            }
+            primes = list;
+            primesLimit = newLimit;
+        }
+        return primes;
+    }
+
+    void work() {
+        for (;;) {
+            uint64_t c = nextChunk++;
+            Chunk& chunk = chunks[c % window];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                chunkFree.wait(lock, [&] { return stopping || c < consumed + window; });
+                if (stopping) return;
+            }
+
+            uint64_t firstBlock = c * CHUNK_BLOCKS;
+            uint32_t blocks = uint32_t(firstBlock < blockTotal ? std::min<uint64_t>(CHUNK_BLOCKS, blockTotal - firstBlock) : 0);
+            std::vector<uint64_t> offsets(blocks);
+            for (uint32_t b = 0; b < blocks; ++b) offsets[b] = offsetOf(firstBlock + b);
+            // Sieve each run of adjacent blocks in one go.
+            for (uint32_t b = 0; b < blocks;) {
+                uint32_t run = 1;
+                while (b + run < blocks && offsets[b + run] - offsets[b + run - 1] == blockSize) ++run;
+                sieveRange(offsets[b], run, chunk.bitmap.data() + size_t(b) * wordsPerBlock());
+                b += run;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                chunk.offsets = std::move(offsets);
+                chunk.blocks = blocks;
+                chunk.ready = true;
+            }
+            chunkReady.notify_all();
+            if (blocks < CHUNK_BLOCKS) return; // reached the end of the run
+        }
+    }
+
+    uint32_t blockSize;
+    uint64_t blockTotal;
+    std::function<uint64_t(uint64_t)> offsetOf;
+    uint64_t window; // chunks sieved ahead of the reader
+    std::vector<uint64_t> pattern;
+    std::vector<Chunk> chunks;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable chunkReady, chunkFree;
+    std::atomic<uint64_t> nextChunk{0};
+    uint64_t consumed = 0;    // chunks fully handed out by next()
+    uint32_t blockInChunk = 0;
+    bool stopping = false;
+
+    std::mutex primesMutex;
+    std::shared_ptr<const std::vector<uint32_t>> primes;
+    uint64_t primesLimit = 0;
+};
@@ -1,6 +1,11 @@
 #!/bin/bash
 
 glslc sieve.comp -o sieve.spv
+glslc compact.comp -o compact.spv
+glslc --target-env=vulkan1.1 compact_subgroup.comp -o compact_subgroup.spv
+glslc --target-env=vulkan1.1 count.comp -o count.spv
+glslc stats.comp -o stats.spv
+glslc segment.comp -o segment.spv
 mkdir build
 cd build
 cmake ..
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "../common/primality64.h"
+
+/*
+ * Goldbach verification on the odd-only block bitmaps, for --goldbach:
+ * every even n in [start, limit] above 2 gets its smallest prime p with
+ * n - p prime, and the run keeps the largest such p (with the first n
+ * that needs it) and every n that has none.
+ *
+ * The even numbers n_j = base + 2j of bitmap word w (base = the number
+ * just below its bit 0) are tested 64 at a time: n_j - p is bit
+ * j - (p + 1) / 2 relative to word w, so one unaligned 64-bit read of the
+ * bitmap answers "is n_j - p prime" for all 64 of them. The small odd
+ * primes are tried in order until every n of the word has its p, which
+ * typically takes a few dozen reads. The last HISTORY_WORDS words of the
+ * previous block stay in the window so that n - p can reach back across
+ * a block boundary; an n that the window cannot settle (at the start of
+ * the run, after a jump, or with a minimal p beyond the window) is done
+ * one by one with Primality64.
+ */
+
+class GoldbachSearch {
+public:
+    // Lookback of the window: 128 words, 16384 numbers. The minimal p stays
+    // below 10^4 for every n below 4 * 10^18.
+    static const uint32_t HISTORY_WORDS = 128;
+
+    struct Record {
+        uint64_t n, p; // minimal p of n, above that of every smaller n of the run
+    };
+
+    GoldbachSearch(uint64_t start = 0, uint64_t limit = UINT64_MAX) : start(start), limit(limit) {
+        const uint32_t bound = HISTORY_WORDS * 128;
+        std::vector<bool> composite(bound, false);
+        for (uint32_t i = 3; i < bound; i += 2) {
+            if (composite[i]) continue;
+            oddPrimes.push_back(i);
+            backs.push_back((i + 1) / 2);
+            for (uint32_t m = i * i; m < bound; m += 2 * i) composite[m] = true;
+        }
+    }
+
+    // Checks the even numbers of one block of blockWords bitmap words.
+    // New records go to records, even numbers without a decomposition to
+    // failures.
+    void scan(const uint64_t* bitmap, uint64_t offset, uint32_t blockWords, std::vector<Record>& records, std::vector<uint64_t>& failures) {
+        if (offset != nextOffset) history.clear();
+        nextOffset = offset + uint64_t(blockWords) * 128;
+
+        size_t kept = history.size();
+        window.resize(kept + blockWords);
+        std::copy(history.begin(), history.end(), window.begin());
+        std::memcpy(window.data() + kept, bitmap, sizeof(uint64_t) * blockWords);
+
+        for (uint32_t w = 0; w < blockWords; ++w) {
+            uint64_t base = offset + uint64_t(w) * 128;
+            if (base == 0 && start <= 4 && limit >= 4) {
+                // 4 = 2 + 2; 2 is not in the bitmap.
+                ++checked;
+                note(4, 2, records);
+            }
+            uint64_t todo = evenMask(base);
+            if (todo == 0) continue;
+            checked += __builtin_popcountll(todo);
+
+            // Fast path: which p resolves the last n of the word, nothing per n.
+            uint64_t available = (kept + w) * 64; // window bits before word w
+            size_t usable = available >= backs.back() ? backs.size()
+                                                      : size_t(std::upper_bound(backs.begin(), backs.end(), available) - backs.begin());
+            uint64_t open = todo;
+            uint32_t wordMax = 0;
+            size_t k = 0;
+            // Four primes per test of open: the reads do not depend on each other.
+            for (; k + 4 <= usable && open != 0; k += 4) {
+                uint64_t h0 = bitsAt(available - backs[k]) & open;
+                uint64_t h1 = bitsAt(available - backs[k + 1]) & open & ~h0;
+                uint64_t h2 = bitsAt(available - backs[k + 2]) & open & ~(h0 | h1);
+                uint64_t h3 = bitsAt(available - backs[k + 3]) & open & ~(h0 | h1 | h2);
+                open &= ~(h0 | h1 | h2 | h3);
+                wordMax = h3 ? oddPrimes[k + 3] : h2 ? oddPrimes[k + 2] : h1 ? oddPrimes[k + 1] : h0 ? oddPrimes[k] : wordMax;
+            }
+            for (; k < usable && open != 0; ++k) {
+                uint64_t hits = bitsAt(available - backs[k]) & open;
+                open &= ~hits;
+                wordMax = hits != 0 ? oddPrimes[k] : wordMax;
+            }
+            // Most words cannot hold a record and have no n left over.
+            if (open == 0 && wordMax <= maxP) continue;
+
+            uint32_t minimal[64] = {};
+            open = todo;
+            for (size_t k = 0; k < usable && open != 0; ++k) {
+                uint64_t hits = bitsAt(available - backs[k]) & open;
+                open &= ~hits;
+                for (; hits != 0; hits &= hits - 1) minimal[__builtin_ctzll(hits)] = oddPrimes[k];
+            }
+            for (; open != 0; open &= open - 1) {
+                uint32_t j = __builtin_ctzll(open);
+                minimal[j] = uint32_t(minimalPrime(base + 2 * j));
+                if (minimal[j] == 0) {
+                    failures.push_back(base + 2 * j);
+                    todo &= ~(uint64_t(1) << j);
+                }
+            }
+            // Records in order of n.
+            for (; todo != 0; todo &= todo - 1) {
+                uint32_t j = __builtin_ctzll(todo);
+                note(base + 2 * j, minimal[j], records);
+            }
+        }
+
+        size_t keep = std::min<size_t>(HISTORY_WORDS, window.size());
+        history.assign(window.end() - keep, window.end());
+    }
+
+    // Ends the stream; the next block starts without history.
+    void finish() { history.clear(); }
+
+    uint64_t evenChecked() const { return checked; }
+    uint64_t maxMinimalPrime() const { return maxP; }
+    uint64_t maxMinimalAt() const { return maxN; }
+
+private:
+    // Bit j set when base + 2j is an even number of [start, limit] above 4.
+    uint64_t evenMask(uint64_t base) const {
+        uint64_t first = std::max<uint64_t>(start, 6);
+        if (limit < base || limit < first || base + 126 < first) return 0;
+        uint32_t lo = first > base ? uint32_t((first - base + 1) / 2) : 0;
+        uint32_t hi = uint32_t(std::min<uint64_t>(63, (limit - base) / 2));
+        if (lo > hi) return 0;
+        uint64_t upper = hi == 63 ? ~uint64_t(0) : (uint64_t(1) << (hi + 1)) - 1;
+        return upper & (~uint64_t(0) << lo);
+    }
+
+    // 64 bits of the window starting at bit pos, without a branch on the
+    // alignment. Never reads past the current word.
+    uint64_t bitsAt(uint64_t pos) const {
+        const uint64_t* p = window.data() + pos / 64;
+        uint32_t sh = pos % 64;
+        return (p[0] >> sh) | ((p[1] << 1) << (63 - sh));
+    }
+
+    // Smallest prime p with n - p prime, 0 if there is none.
+    uint64_t minimalPrime(uint64_t n) const {
+        for (uint32_t p : oddPrimes) {
+            if (p > n / 2) return 0;
+            if (Primality64::isPrime(n - p)) return p;
+        }
+        for (uint64_t p = oddPrimes.back() + 2; p <= n / 2; p += 2) {
+            if (Primality64::isPrime(p) && Primality64::isPrime(n - p)) return p;
+        }
+        return 0;
+    }
+
+    void note(uint64_t n, uint64_t p, std::vector<Record>& records) {
+        if (p <= maxP) return;
+        maxP = p;
+        maxN = n;
+        records.push_back({n, p});
+    }
+
+    uint64_t start, limit;
+    std::vector<uint32_t> oddPrimes; // 3 .. HISTORY_WORDS * 128
+    std::vector<uint32_t> backs;     // (p + 1) / 2: how far n - p lies below n, in bits
+    std::vector<uint64_t> history;   // last words of the previous block
+    std::vector<uint64_t> window;    // history, then the current block
+    uint64_t nextOffset = 0;
+
+    uint64_t checked = 0;
+    uint64_t maxP = 0, maxN = 0;
+};
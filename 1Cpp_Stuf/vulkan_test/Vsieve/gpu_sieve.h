@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <vulkan/vulkan.h>
+
+#include "../common/vk_context.h"
+
+/*
+ * GPU engine of the prime library: sieve.comp alone, with the same
+ * contract as CpuSieve::next(), so a caller can take blocks from either.
+ *
+ * Every slot owns a host-visible bitmap that stays mapped for its whole
+ * life, and next() hands out a pointer straight into that mapping; the
+ * host never copies a block. Up to inFlight blocks are queued ahead of
+ * the one being read. The slot handed out last goes back to the GPU with
+ * the next pending block at the following call, which is why its pointer
+ * is only valid until then.
+ *
+ * The vsieve tool keeps its own pipeline with the compaction, counting
+ * and statistics kernels; this one only needs binding 0.
+ */
+
+class GpuSieve {
+public:
+    // blockSize numbers per block (a multiple of 2 * workgroupSize and of
+    // 128); sieves the blocks offsetOf(0) .. offsetOf(blocks - 1).
+    GpuSieve(const VulkanContext& vulkan, uint32_t blockSize, uint64_t blocks, std::function<uint64_t(uint64_t)> offsetOf,
+             uint32_t inFlight = 4, uint32_t workgroupSize = 256, const std::string& shaderPath = "sieve.spv")
+        : vulkan(vulkan), device(vulkan.device), blockSize(blockSize), workgroupSize(workgroupSize), blockTotal(blocks), offsetOf(std::move(offsetOf)) {
+        if (blockSize < 128 || blockSize % 128 != 0 || workgroupSize < 32 || workgroupSize % 32 != 0 || (blockSize / 2) % workgroupSize != 0) {
+            throw std::runtime_error("GpuSieve: block size must be a multiple of 128 and of twice the workgroup size");
+        }
+        if (!vulkan.enabledFeatures.shaderInt64) throw std::runtime_error("GpuSieve: the device has no shaderInt64");
+        if (blockSize / 2 / workgroupSize > vulkan.properties.limits.maxComputeWorkGroupCount[0] ||
+            workgroupSize > vulkan.properties.limits.maxComputeWorkGroupSize[0]) {
+            throw std::runtime_error("GpuSieve: block shape exceeds the device limits");
+        }
+        try {
+            create(std::max<uint32_t>(1, uint32_t(std::min<uint64_t>(inFlight, std::max<uint64_t>(blocks, 1)))), shaderPath);
+        } catch (...) {
+            destroy();
+            throw;
+        }
+        for (Slot& slot : slots) {
+            if (submitted == blockTotal) break;
+            submit(slot);
+        }
+    }
+
+    ~GpuSieve() { destroy(); }
+    GpuSieve(const GpuSieve&) = delete;
+    GpuSieve& operator=(const GpuSieve&) = delete;
+
+    uint32_t wordsPerBlock() const { return blockSize / 128; }
+
+    // Hands out the next block in increasing order. The bitmap points into
+    // mapped device memory and stays valid until the following call.
+    // Returns false after the last block.
+    bool next(uint64_t& offset, const uint64_t*& bitmap) {
+        if (handedOut != nullptr) {
+            // The caller is done with it: queue the next block in its place.
+            Slot* slot = handedOut;
+            handedOut = nullptr;
+            if (submitted < blockTotal) submit(*slot);
+        }
+        if (consumed == blockTotal) return false;
+        Slot& slot = slots[consumed % slots.size()];
+        vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+        slot.pending = false;
+        offset = slot.offset;
+        bitmap = slot.bitmap;
+        handedOut = &slot;
+        ++consumed;
+        return true;
+    }
+
+private:
+    struct Slot {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        const uint64_t* bitmap = nullptr; // persistently mapped
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        uint64_t offset = 0;
+        bool pending = false;
+    };
+
+    void create(uint32_t slotCount, const std::string& shaderPath) {
+        const VkDeviceSize bitmapBytes = blockSize / 16;
+        const VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+        VkDescriptorSetLayoutBinding binding{}; binding.binding = 0; binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; binding.descriptorCount = 1; binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        VkDescriptorSetLayoutCreateInfo layoutInfo{}; layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO; layoutInfo.bindingCount = 1; layoutInfo.pBindings = &binding;
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) throw std::runtime_error("GpuSieve: failed to create descriptor set layout");
+
+        VkPushConstantRange pushConstantRange{}; pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT; pushConstantRange.offset = 0; pushConstantRange.size = sizeof(uint64_t);
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{}; pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO; pipelineLayoutInfo.setLayoutCount = 1; pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout; pipelineLayoutInfo.pushConstantRangeCount = 1; pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) throw std::runtime_error("GpuSieve: failed to create pipeline layout");
+
+        // constant_id 0 = SLOW_MULMOD, 2 = workgroup size, 3 = odd numbers per block, as in vsieve.
+        shaderModule = vulkan.loadShader(shaderPath);
+        struct { VkBool32 slowMulmod; uint32_t workgroupSize; uint32_t oddPerBlock; } specData = {VK_FALSE, workgroupSize, blockSize / 2};
+        VkSpecializationMapEntry specEntries[3] = {};
+        specEntries[0].constantID = 0; specEntries[0].offset = 0; specEntries[0].size = sizeof(VkBool32);
+        specEntries[1].constantID = 2; specEntries[1].offset = sizeof(VkBool32); specEntries[1].size = sizeof(uint32_t);
+        specEntries[2].constantID = 3; specEntries[2].offset = sizeof(VkBool32) + sizeof(uint32_t); specEntries[2].size = sizeof(uint32_t);
+        VkSpecializationInfo specInfo{}; specInfo.mapEntryCount = 3; specInfo.pMapEntries = specEntries; specInfo.dataSize = sizeof(specData); specInfo.pData = &specData;
+        VkComputePipelineCreateInfo pipelineInfo{}; pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO; pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO; pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT; pipelineInfo.stage.module = shaderModule; pipelineInfo.stage.pName = "main"; pipelineInfo.stage.pSpecializationInfo = &specInfo; pipelineInfo.layout = pipelineLayout;
+        if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) throw std::runtime_error("GpuSieve: failed to create the sieve pipeline");
+
+        VkDescriptorPoolSize poolSize{}; poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; poolSize.descriptorCount = slotCount;
+        VkDescriptorPoolCreateInfo poolInfo{}; poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO; poolInfo.poolSizeCount = 1; poolInfo.pPoolSizes = &poolSize; poolInfo.maxSets = slotCount;
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) throw std::runtime_error("GpuSieve: failed to create descriptor pool");
+
+        VkCommandPoolCreateInfo cpInfo{}; cpInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO; cpInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; cpInfo.queueFamilyIndex = vulkan.queueFamilyIndex;
+        if (vkCreateCommandPool(device, &cpInfo, nullptr, &commandPool) != VK_SUCCESS) throw std::runtime_error("GpuSieve: failed to create command pool");
+
+        slots.resize(slotCount);
+        for (Slot& slot : slots) {
+            void* data;
+            vulkan.createBuffer(bitmapBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, slot.buffer, slot.memory);
+            vkMapMemory(device, slot.memory, 0, bitmapBytes, 0, &data);
+            slot.bitmap = static_cast<const uint64_t*>(data);
+
+            VkDescriptorSetAllocateInfo dsAllocInfo{}; dsAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO; dsAllocInfo.descriptorPool = descriptorPool; dsAllocInfo.descriptorSetCount = 1; dsAllocInfo.pSetLayouts = &descriptorSetLayout;
+            vkAllocateDescriptorSets(device, &dsAllocInfo, &slot.descriptorSet);
+            VkDescriptorBufferInfo bufferInfo{}; bufferInfo.buffer = slot.buffer; bufferInfo.range = VK_WHOLE_SIZE;
+            VkWriteDescriptorSet write{}; write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; write.dstSet = slot.descriptorSet; write.dstBinding = 0; write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; write.descriptorCount = 1; write.pBufferInfo = &bufferInfo;
+            vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+            VkCommandBufferAllocateInfo cbAllocInfo{}; cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO; cbAllocInfo.commandPool = commandPool; cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbAllocInfo.commandBufferCount = 1;
+            vkAllocateCommandBuffers(device, &cbAllocInfo, &slot.commandBuffer);
+
+            VkFenceCreateInfo fenceInfo{}; fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            vkCreateFence(device, &fenceInfo, nullptr, &slot.fence);
+        }
+    }
+
+    // Records and queues the next pending block into a free slot.
+    void submit(Slot& slot) {
+        slot.offset = offsetOf(submitted++);
+        slot.pending = true;
+        vkResetFences(device, 1, &slot.fence);
+        VkCommandBuffer commandBuffer = slot.commandBuffer;
+        vkResetCommandBuffer(commandBuffer, 0);
+        VkCommandBufferBeginInfo beginInfo{}; beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO; beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &slot.descriptorSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint64_t), &slot.offset);
+        vkCmdDispatch(commandBuffer, blockSize / 2 / workgroupSize, 1, 1);
+
+        // Make the shader writes visible to the host mapping before the fence signals.
+        VkMemoryBarrier hostBarrier{}; hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; hostBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT; hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+        vkEndCommandBuffer(commandBuffer);
+
+        VkSubmitInfo submitInfo{}; submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; submitInfo.commandBufferCount = 1; submitInfo.pCommandBuffers = &commandBuffer;
+        if (vkQueueSubmit(vulkan.computeQueue, 1, &submitInfo, slot.fence) != VK_SUCCESS) throw std::runtime_error("GpuSieve: queue submit failed");
+    }
+
+    void destroy() {
+        // Blocks still queued when the caller stops early have to finish first.
+        for (Slot& slot : slots) {
+            if (slot.pending) vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+            if (slot.fence != VK_NULL_HANDLE) vkDestroyFence(device, slot.fence, nullptr);
+            if (slot.buffer != VK_NULL_HANDLE) vkDestroyBuffer(device, slot.buffer, nullptr);
+            if (slot.memory != VK_NULL_HANDLE) {
+                vkUnmapMemory(device, slot.memory);
+                vkFreeMemory(device, slot.memory, nullptr);
+            }
+        }
+        slots.clear();
+        if (commandPool != VK_NULL_HANDLE) vkDestroyCommandPool(device, commandPool, nullptr);
+        if (descriptorPool != VK_NULL_HANDLE) vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+        if (pipeline != VK_NULL_HANDLE) vkDestroyPipeline(device, pipeline, nullptr);
+        if (shaderModule != VK_NULL_HANDLE) vkDestroyShaderModule(device, shaderModule, nullptr);
+        if (pipelineLayout != VK_NULL_HANDLE) vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+        if (descriptorSetLayout != VK_NULL_HANDLE) vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+        commandPool = VK_NULL_HANDLE;
+        descriptorPool = VK_NULL_HANDLE;
+        pipeline = VK_NULL_HANDLE;
+        shaderModule = VK_NULL_HANDLE;
+        pipelineLayout = VK_NULL_HANDLE;
+        descriptorSetLayout = VK_NULL_HANDLE;
+    }
+
+    const VulkanContext& vulkan;
+    VkDevice device;
+    uint32_t blockSize, workgroupSize;
+    uint64_t blockTotal;
+    std::function<uint64_t(uint64_t)> offsetOf;
+
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkShaderModule shaderModule = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    std::vector<Slot> slots;
+    Slot* handedOut = nullptr;
+    uint64_t submitted = 0, consumed = 0;
+};
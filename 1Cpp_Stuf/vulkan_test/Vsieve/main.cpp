@@ -1,102 +1,765 @@
 #include <iostream>
+#include <iomanip>
 #include <vector>
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <stdexcept>
+#include <exception>
 #include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <csignal>
+#include <memory>
 #include <vulkan/vulkan.h>
 
+#include "work_queue.h"
+#include "prime_output.h"
+#include "prime_pi.h"
+#include "cpu_sieve.h"
+#include "range_plan.h"
+#include "checkpoint.h"
+#include "prime_patterns.h"
+#include "goldbach.h"
+#include "tune_cache.h"
+#include "primality_check.h"
+#include "prime_stats.h"
+#include "segment_plan.h"
+#include "../common/vk_context.h"
+
 // --- Configuration ---
-const uint32_t BLOCK_SIZE = 1024 * 1024; // Test ~1 million numbers at a time.
-const uint32_t WORKGROUP_SIZE = 256;
-
-// Function to read a SPIR-V file
-std::vector<char> readFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-    if (!file.is_open()) throw std::runtime_error("Failed to open file: " + filename);
-    size_t fileSize = (size_t)file.tellg();
-    std::vector<char> buffer(fileSize);
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-    file.close();
-    return buffer;
+const uint32_t DEFAULT_BLOCK_SIZE = 1024 * 1024; // Test ~1 million numbers at a time.
+const uint32_t DEFAULT_WORKGROUP_SIZE = 256;
+const uint32_t DEFAULT_IN_FLIGHT = 3; // Blocks queued on the GPU or waiting for the consumer.
+const uint32_t BENCH_BLOCKS = 16;     // Blocks per variant in --bench-compact.
+const uint32_t SEGMENT_KERNEL_BLOCK_SIZE = 16 << 20; // --kernel segment: 64 workgroups of 16 KB per block
+const char* const DEFAULT_TUNE_CACHE = "vsieve_tune.cache";
+// --autotune times every configuration on this many numbers (at least TUNE_MIN_BLOCKS blocks).
+const uint64_t TUNE_NUMBERS = 64ull << 20;
+const uint32_t TUNE_MIN_BLOCKS = 8;
+const uint32_t TUNE_BLOCK_SIZES[] = {256 << 10, 512 << 10, 1 << 20, 2 << 20, 4 << 20, 8 << 20, 16 << 20};
+const uint32_t TUNE_LOCAL_SIZES[] = {64, 128, 256, 512, 1024};
+const uint32_t TUNE_IN_FLIGHT[] = {1, 2, 3, 4, 6, 8};
+
+// Geometry of a block. The kernels take the block and workgroup size as
+// specialization constants, so both can change per run (--autotune).
+struct BlockShape {
+    uint32_t blockSize = DEFAULT_BLOCK_SIZE;
+    uint32_t workgroupSize = DEFAULT_WORKGROUP_SIZE;
+
+    // The kernel only tests odd numbers and packs one bit per number.
+    uint32_t oddPerBlock() const { return blockSize / 2; }
+    uint32_t bitmapWords() const { return oddPerBlock() / 64; } // 64-bit words as seen by the host
+    size_t bitmapBytes() const { return sizeof(uint64_t) * bitmapWords(); }
+    uint32_t workgroups() const { return oddPerBlock() / workgroupSize; }
+    // Append buffer of the compaction kernels: a count word, padding, then the primes.
+    size_t primeListBytes() const { return sizeof(uint64_t) + sizeof(uint64_t) * oddPerBlock(); }
+
+    // Whole 64-bit bitmap words, whole workgroups and whole 32-bit shader words per workgroup.
+    bool valid() const {
+        return blockSize >= 128 && blockSize % 128 == 0 && workgroupSize >= 32 && workgroupSize % 32 == 0 && oddPerBlock() % workgroupSize == 0;
+    }
+};
+
+// How a block's result reaches the host.
+enum class SieveMode {
+    Bitmap,   // sieve.comp: one bit per odd number, scanned on the host
+    Atomic,   // compact.comp mode 0: one global atomic per prime
+    Subgroup, // compact_subgroup.comp: one global atomic per workgroup
+    Scan,     // compact.comp modes 2-4: count pass, scan of the counts, ordered scatter
+    Count,    // count.comp: one partial prime count per workgroup
+    Stats     // sieve.comp, then stats.comp: gap and residue histograms only (--stats)
+};
+
+const char* sieveModeName(SieveMode mode) {
+    switch (mode) {
+        case SieveMode::Bitmap: return "bitmap";
+        case SieveMode::Atomic: return "atomic";
+        case SieveMode::Subgroup: return "subgroup";
+        case SieveMode::Scan: return "scan";
+        case SieveMode::Count: return "count";
+        case SieveMode::Stats: return "stats";
+    }
+    return "?";
+}
+
+SieveMode parseSieveMode(const std::string& name) {
+    for (SieveMode mode : {SieveMode::Bitmap, SieveMode::Atomic, SieveMode::Subgroup, SieveMode::Scan, SieveMode::Count}) {
+        if (name == sieveModeName(mode)) return mode;
+    }
+    throw std::runtime_error("Unknown compaction mode: " + name + " (expected bitmap, atomic, subgroup, scan or count)");
+}
+
+// Set by Ctrl+C so the loop can drain the in-flight blocks and print a summary.
+std::atomic<bool> stopRequested{false};
+void onSigint(int) { stopRequested = true; }
+
+// Odd numbers of the block at offset that lie in [start, limit]: bits
+// [skip, valid), all of them except in the first and last block.
+void blockBitRange(uint32_t blockSize, uint64_t offset, uint64_t start, uint64_t limit, uint64_t& skip, uint64_t& valid) {
+    valid = blockSize / 2;
+    if (limit - offset < blockSize - 1) valid = (limit - offset + 1) / 2;
+    skip = start > offset ? std::min<uint64_t>((start - offset) / 2, valid) : 0;
 }
 
-// Helper to find a suitable memory type
-uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
+// Counts the primes of one odd-only block bitmap that lie in [start, limit]
+// and, when primes is non-null, appends them in increasing order. The same
+// layout comes out of sieve.comp and the CPU sieve. readbackBytes is how much
+// was scanned.
+uint64_t readBitmap(const uint64_t* bitmap, uint32_t blockSize, uint64_t offset, uint64_t start, uint64_t limit, std::vector<uint64_t>* primes, size_t& readbackBytes) {
+    bool hasTwo = offset == 0 && start <= 2 && limit >= 2; // 2 is not in the odd-only bitmap
+    uint64_t found = hasTwo ? 1 : 0;
+    if (primes && hasTwo) {
+        primes->push_back(2);
+    }
+
+    uint64_t skip, valid;
+    blockBitRange(blockSize, offset, start, limit, skip, valid);
+    uint32_t words = uint32_t((valid + 63) / 64);
+    auto word = [&](uint32_t w) {
+        uint64_t bits = bitmap[w];
+        if (valid - uint64_t(w) * 64 < 64) bits &= (uint64_t(1) << (valid - uint64_t(w) * 64)) - 1;
+        if (skip > uint64_t(w) * 64) bits &= skip - uint64_t(w) * 64 >= 64 ? 0 : ~uint64_t(0) << (skip - uint64_t(w) * 64);
+        return bits;
+    };
+
+    readbackBytes = sizeof(uint64_t) * words;
+    for (uint32_t w = 0; w < words; ++w) {
+        found += __builtin_popcountll(word(w));
+    }
+    if (primes) {
+        primes->reserve(primes->size() + found);
+        for (uint32_t w = 0; w < words; ++w) {
+            uint64_t bits = word(w);
+            while (bits != 0) {
+                uint32_t bit = __builtin_ctzll(bits);
+                bits &= bits - 1;
+                primes->push_back(offset + 2 * (uint64_t(w) * 64 + bit) + 1);
+            }
         }
     }
-    throw std::runtime_error("Failed to find suitable memory type!");
+    return found;
 }
 
-// Main application
-int main() {
-    // --- 1. Vulkan Setup (Instance, Device, Queue) ---
-    VkInstance instance;
-    VkApplicationInfo appInfo{}; appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO; appInfo.pApplicationName="Sieve"; appInfo.apiVersion = VK_API_VERSION_1_2;
-    VkInstanceCreateInfo instInfo{}; instInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO; instInfo.pApplicationInfo = &appInfo;
-    if (vkCreateInstance(&instInfo, nullptr, &instance) != VK_SUCCESS) throw std::runtime_error("Failed to create instance");
-
-    uint32_t deviceCount = 0;
-    vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
-    if (deviceCount == 0) throw std::runtime_error("No GPUs with Vulkan support found!");
-    std::vector<VkPhysicalDevice> devices(deviceCount);
-    vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
-    VkPhysicalDevice physicalDevice = devices[0];
-
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
-    uint32_t queueFamilyIndex = -1;
-    for(uint32_t i = 0; i < queueFamilyCount; ++i) {
-        if (queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
-            queueFamilyIndex = i;
-            break;
-        }
-    }
-    if (queueFamilyIndex == uint32_t(-1)) throw std::runtime_error("Failed to find a compute queue family!");
-
-    VkDevice device;
-    float queuePriority = 1.0f;
-    VkDeviceQueueCreateInfo queueCreateInfo{}; queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO; queueCreateInfo.queueFamilyIndex = queueFamilyIndex; queueCreateInfo.queueCount = 1; queueCreateInfo.pQueuePriorities = &queuePriority;
-    VkDeviceCreateInfo devInfo{}; devInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO; devInfo.queueCreateInfoCount = 1; devInfo.pQueueCreateInfos = &queueCreateInfo;
-    if (vkCreateDevice(physicalDevice, &devInfo, nullptr, &device) != VK_SUCCESS) throw std::runtime_error("Failed to create logical device");
-
-    VkQueue computeQueue;
-    vkGetDeviceQueue(device, queueFamilyIndex, 0, &computeQueue);
-
-    // --- 2. Create Result Buffer ---
+// Everything one in-flight block owns. A slot is either free, queued on the
+// GPU, or being read back by the consumer thread; never two at once.
+struct BlockSlot {
     VkBuffer resultBuffer;
     VkDeviceMemory resultMemory;
-    VkBufferCreateInfo bufferInfo{};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = sizeof(uint32_t) * BLOCK_SIZE;
-    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    vkCreateBuffer(device, &bufferInfo, nullptr, &resultBuffer);
-
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(device, resultBuffer, &memRequirements);
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    vkAllocateMemory(device, &allocInfo, nullptr, &resultMemory);
-    vkBindBufferMemory(device, resultBuffer, resultMemory, 0);
-
-    // --- 3. Create Compute Pipeline ---
-    auto shaderCode = readFile("sieve.spv");
-    VkShaderModule computeShaderModule;
-    VkShaderModuleCreateInfo smInfo{}; smInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO; smInfo.codeSize = shaderCode.size(); smInfo.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
-    vkCreateShaderModule(device, &smInfo, nullptr, &computeShaderModule);
-
-    VkDescriptorSetLayoutBinding binding{}; binding.binding = 0; binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; binding.descriptorCount = 1; binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-    VkDescriptorSetLayoutCreateInfo layoutInfo{}; layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO; layoutInfo.bindingCount = 1; layoutInfo.pBindings = &binding;
+    const uint64_t* bitmap; // persistently mapped
+    VkBuffer primeBuffer;
+    VkDeviceMemory primeMemory;
+    const uint32_t* primeCount; // persistently mapped append buffer
+    const uint64_t* primeList;
+    VkBuffer groupCountBuffer; // per-workgroup counts of the scan and count kernels
+    VkDeviceMemory groupCountMemory;
+    const uint32_t* groupCounts; // persistently mapped
+    VkBuffer statsBuffer; // histograms of stats.comp
+    VkDeviceMemory statsMemory;
+    const uint32_t* stats; // persistently mapped
+    VkBuffer bucketBuffer = VK_NULL_HANDLE; // large-prime hits for segment.comp, filled by the host
+    VkDeviceMemory bucketMemory = VK_NULL_HANDLE;
+    uint32_t* buckets = nullptr; // persistently mapped
+    VkDescriptorSet descriptorSet;
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    uint32_t firstQuery; // begin/end timestamp pair
+    uint64_t offset;
+    SieveMode mode; // kernel the block was submitted with
+};
+
+// Main application
+static int sieveMain(int argc, char* argv[]) {
+    // --slow-mulmod selects the original double-and-add mul_mod in the kernel,
+    // for comparing per-block Miller-Rabin cost against the Montgomery path.
+    VkBool32 slowMulmod = VK_FALSE;
+    // --kernel segment swaps sieve.comp for the shared-memory Eratosthenes kernel.
+    bool segmentKernel = false;
+    uint32_t inFlight = DEFAULT_IN_FLIGHT;
+    // --block-size/--local-size pick the geometry by hand; otherwise a GPU
+    // run takes what --autotune last found for the device.
+    BlockShape shape;
+    bool explicitShape = false, explicitInFlight = false;
+    bool autotune = false;
+    std::string tuneCachePath = DEFAULT_TUNE_CACHE;
+    OutputFormat outputFormat = OutputFormat::Text;
+    std::string outputPath = "-";
+    bool directIo = false;
+    SieveMode sieveMode = SieveMode::Bitmap;
+    bool explicitMode = false;
+    bool benchCompact = false;
+    uint64_t benchOffset = 0;
+    // --verify-pi X counts the primes up to X on the GPU and checks the total
+    // against the CPU Meissel-Lehmer pi(X); --pi X only runs the CPU side.
+    uint64_t limit = UINT64_MAX;
+    bool verifyPi = false;
+    // --cpu runs the segmented CPU sieve instead of the GPU; --diff-cpu OFFSET
+    // compares the GPU bitmap of a few blocks against it bit for bit.
+    bool cpuBackend = false;
+    unsigned cpuThreads = std::max(1u, std::thread::hardware_concurrency());
+    bool diffCpu = false;
+    uint64_t diffOffset = 0;
+    // --validate-primality N checks the CPU twin of the kernels' primality
+    // test on the known pseudoprimes plus N random inputs and the CPU sieve
+    // on the top block below 2^64, then the kernel.
+    bool validatePrimality = false;
+    uint64_t validateCount = 0;
+    // --start/--end pick a range, --shard i/N one of N pieces of it, and
+    // --checkpoint FILE lets an interrupted run carry on where it stopped.
+    uint64_t start = 0;
+    bool haveEnd = false;
+    uint64_t shard = 0, shards = 1;
+    bool contiguousShards = false;
+    std::string checkpointPath;
+    uint64_t checkpointEvery = 1;
+    // --tuples PATTERN and --gap-records / --min-gap G search the bitmaps
+    // and only write out the first prime of each match.
+    bool searching = false;
+    PatternSearch search;
+    std::string tupleSpec;
+    bool gapRecords = false;
+    uint64_t minGap = 0;
+    // --goldbach checks every even number of the range for a prime pair and
+    // writes out the n whose smallest p sets a new record.
+    bool checkGoldbach = false;
+    GoldbachSearch goldbach;
+    // --stats FILE aggregates gap, residue and Chebyshev statistics instead
+    // of writing the primes out.
+    std::string statsPath;
+    std::string deviceSelector; // --device: index, part of the name or UUID
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--slow-mulmod") == 0) {
+            slowMulmod = VK_TRUE;
+        } else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+            std::string kernel = argv[++i];
+            if (kernel != "mr" && kernel != "segment") throw std::runtime_error("Unknown kernel: " + kernel + " (expected mr or segment)");
+            segmentKernel = kernel == "segment";
+        } else if (strcmp(argv[i], "--in-flight") == 0 && i + 1 < argc) {
+            inFlight = std::max(1, std::stoi(argv[++i]));
+            explicitInFlight = true;
+        } else if (strcmp(argv[i], "--block-size") == 0 && i + 1 < argc) {
+            shape.blockSize = uint32_t(std::stoul(argv[++i]));
+            explicitShape = true;
+        } else if (strcmp(argv[i], "--local-size") == 0 && i + 1 < argc) {
+            shape.workgroupSize = uint32_t(std::stoul(argv[++i]));
+            explicitShape = true;
+        } else if (strcmp(argv[i], "--autotune") == 0) {
+            autotune = true;
+        } else if (strcmp(argv[i], "--tune-cache") == 0 && i + 1 < argc) {
+            tuneCachePath = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            outputFormat = parseOutputFormat(argv[++i]);
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (strcmp(argv[i], "--direct") == 0) {
+            directIo = true;
+        } else if (strcmp(argv[i], "--compact") == 0 && i + 1 < argc) {
+            sieveMode = parseSieveMode(argv[++i]);
+            explicitMode = true;
+        } else if (strcmp(argv[i], "--bench-compact") == 0 && i + 1 < argc) {
+            benchCompact = true;
+            benchOffset = std::stoull(argv[++i]) & ~uint64_t(1); // blocks start on an even number
+        } else if (strcmp(argv[i], "--pi") == 0 && i + 1 < argc) {
+            uint64_t x = std::stoull(argv[++i]);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            uint64_t count = PrimePi()(x);
+            auto t2 = std::chrono::high_resolution_clock::now();
+            std::cerr << "pi(" << x << ") computed in " << std::chrono::duration<double>(t2 - t1).count() << "s (Meissel-Lehmer, CPU)" << std::endl;
+            std::cout << count << std::endl;
+            return 0;
+        } else if (strcmp(argv[i], "--verify-pi") == 0 && i + 1 < argc) {
+            limit = std::stoull(argv[++i]);
+            verifyPi = true;
+            outputFormat = OutputFormat::Count;
+        } else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+            deviceSelector = argv[++i];
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            cpuBackend = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            cpuThreads = std::max(1, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--diff-cpu") == 0 && i + 1 < argc) {
+            diffCpu = true;
+            diffOffset = std::stoull(argv[++i]) & ~uint64_t(1);
+        } else if (strcmp(argv[i], "--validate-primality") == 0 && i + 1 < argc) {
+            validatePrimality = true;
+            validateCount = std::stoull(argv[++i]);
+        } else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+            start = std::stoull(argv[++i]);
+        } else if (strcmp(argv[i], "--end") == 0 && i + 1 < argc) {
+            uint64_t end = std::stoull(argv[++i]); // exclusive
+            if (end == 0) throw std::runtime_error("Empty range: --end must be above --start");
+            limit = end - 1;
+            haveEnd = true;
+        } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            std::string spec = argv[++i];
+            size_t slash = spec.find('/');
+            if (slash == std::string::npos) throw std::runtime_error("--shard expects i/N, e.g. 0/4");
+            shard = std::stoull(spec.substr(0, slash));
+            shards = std::stoull(spec.substr(slash + 1));
+        } else if (strcmp(argv[i], "--shard-layout") == 0 && i + 1 < argc) {
+            std::string layout = argv[++i];
+            if (layout != "interleaved" && layout != "contiguous") throw std::runtime_error("Unknown shard layout: " + layout + " (expected interleaved or contiguous)");
+            contiguousShards = layout == "contiguous";
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            checkpointPath = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            checkpointEvery = std::max<uint64_t>(1, std::stoull(argv[++i]));
+        } else if (strcmp(argv[i], "--tuples") == 0 && i + 1 < argc) {
+            tupleSpec = argv[++i];
+        } else if (strcmp(argv[i], "--gap-records") == 0) {
+            gapRecords = true;
+        } else if (strcmp(argv[i], "--min-gap") == 0 && i + 1 < argc) {
+            minGap = std::stoull(argv[++i]);
+        } else if (strcmp(argv[i], "--goldbach") == 0) {
+            checkGoldbach = true;
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            statsPath = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--device <index|name|uuid>] [--slow-mulmod] [--kernel mr|segment] [--in-flight N] [--format text|gaps|count] [--output FILE] [--direct]\n"
+                      << "       [--compact bitmap|atomic|subgroup|scan|count] [--bench-compact OFFSET] [--pi X] [--verify-pi X]\n"
+                      << "       [--cpu] [--threads N] [--diff-cpu OFFSET] [--validate-primality N]\n"
+                      << "       [--start A] [--end B] [--shard i/N] [--shard-layout interleaved|contiguous] [--checkpoint FILE] [--checkpoint-every N]\n"
+                      << "       [--tuples twin|cousin|sexy|triplet|triplet2|quadruplet|quintuplet|quintuplet2|sextuplet|0,d1,d2,...] [--gap-records] [--min-gap G] [--goldbach] [--stats FILE]\n"
+                      << "       [--block-size N] [--local-size N] [--autotune] [--tune-cache FILE]" << std::endl;
+            return 1;
+        }
+    }
+    if (int(benchCompact) + int(diffCpu) + int(verifyPi) + int(autotune) + int(validatePrimality) > 1) {
+        throw std::runtime_error("--bench-compact, --diff-cpu, --verify-pi, --autotune and --validate-primality cannot be combined");
+    }
+    if (cpuBackend && (benchCompact || diffCpu || autotune)) {
+        throw std::runtime_error("--bench-compact, --diff-cpu and --autotune need the GPU; drop --cpu");
+    }
+    if (autotune && (explicitShape || explicitInFlight || !checkpointPath.empty())) {
+        throw std::runtime_error("--autotune picks the block size, local size and in-flight depth itself");
+    }
+    if (sieveMode == SieveMode::Count && outputFormat != OutputFormat::Count) {
+        throw std::runtime_error("--compact count only produces a total; use it with --format count");
+    }
+    if (verifyPi && haveEnd) {
+        throw std::runtime_error("--verify-pi X already sets the end of the range");
+    }
+    if ((benchCompact || diffCpu || validatePrimality) && !checkpointPath.empty()) {
+        throw std::runtime_error("--checkpoint only applies to sieve runs");
+    }
+    const bool collectStats = !statsPath.empty();
+    if (collectStats) {
+        if (benchCompact || diffCpu || validatePrimality || autotune || !tupleSpec.empty() || gapRecords || minGap > 0 || checkGoldbach) {
+            throw std::runtime_error("--stats only applies to plain sieve runs");
+        }
+        if (explicitMode && sieveMode != SieveMode::Bitmap) {
+            throw std::runtime_error("--stats reads the bitmap; use --compact bitmap or leave --compact out");
+        }
+        outputFormat = OutputFormat::Count;
+    }
+    if (segmentKernel) {
+        // Only the bitmap comes out of segment.comp, and it needs every sieving prime up front.
+        if (cpuBackend || benchCompact || validatePrimality || autotune) {
+            throw std::runtime_error("--kernel segment only applies to GPU sieve runs and --diff-cpu");
+        }
+        if (explicitMode && sieveMode != SieveMode::Bitmap) {
+            throw std::runtime_error("--kernel segment fills the bitmap; drop --compact");
+        }
+        if (!haveEnd && !verifyPi && !diffCpu) {
+            throw std::runtime_error("--kernel segment needs --end (up to 2^50)");
+        }
+        if (!explicitShape) shape.blockSize = SEGMENT_KERNEL_BLOCK_SIZE;
+    }
+    if (int(!tupleSpec.empty()) + int(gapRecords || minGap > 0) + int(checkGoldbach) > 1) {
+        throw std::runtime_error("Search for one of tuples, gaps or Goldbach pairs");
+    }
+    if (!tupleSpec.empty()) {
+        search = PatternSearch::tuples(parseTuplePattern(tupleSpec));
+        searching = true;
+    } else if (gapRecords || minGap > 0) {
+        search = PatternSearch::gaps(minGap, gapRecords);
+        searching = true;
+    } else if (checkGoldbach) {
+        goldbach = GoldbachSearch(start, limit);
+        searching = true;
+    }
+    if (searching) {
+        // The searches carry state from one block to the next, so they need the whole bitmap of adjacent blocks.
+        if (benchCompact || diffCpu || validatePrimality || verifyPi || !checkpointPath.empty()) {
+            throw std::runtime_error("--tuples, --goldbach and the gap search cannot be combined with --bench-compact, --diff-cpu, --verify-pi or --checkpoint");
+        }
+        if (explicitMode && sieveMode != SieveMode::Bitmap) {
+            throw std::runtime_error("--tuples, --goldbach and the gap search read the bitmap; drop --compact");
+        }
+        if (shards > 1 && !contiguousShards) {
+            throw std::runtime_error("--tuples, --goldbach and the gap search need --shard-layout contiguous");
+        }
+        if (shards > 1) {
+            std::cerr << "Note: matches that straddle the edges of shard " << shard << "/" << shards << " are left to nobody." << std::endl;
+        }
+    }
+
+    // The twin has to be right before it can judge the kernel; --cpu stops here.
+    std::vector<PrimalityCase> primalityInputs;
+    if (validatePrimality) {
+        primalityInputs = primalityCases(validateCount, 1);
+        // Both twins: the Montgomery one and that of --slow-mulmod's double-and-add.
+        uint64_t wrong = 0, slowWrong = 0;
+        for (const PrimalityCase& c : primalityInputs) {
+            bool expected = referenceIsPrime(c.n);
+            if (Primality64::isPrime(c.n) != expected && wrong++ < 10) {
+                std::cerr << "CPU twin wrong on " << c.n << " (" << c.kind << "): the reference says " << (expected ? "prime" : "composite") << std::endl;
+            }
+            if (Primality64::isPrimeSlow(c.n) != expected && slowWrong++ < 10) {
+                std::cerr << "Double-and-add twin wrong on " << c.n << " (" << c.kind << "): the reference says " << (expected ? "prime" : "composite") << std::endl;
+            }
+        }
+        std::cerr << "Primality test, CPU twin: " << primalityInputs.size() << " inputs, "
+                  << (wrong == 0 ? "all agree with the reference" : std::to_string(wrong) + " wrong") << std::endl;
+        std::cerr << "Primality test, double-and-add twin: " << primalityInputs.size() << " inputs, "
+                  << (slowWrong == 0 ? "all agree with the reference" : std::to_string(slowWrong) + " wrong") << std::endl;
+        if (wrong != 0 || slowWrong != 0) return 1;
+
+        // The CPU sieve on the last block below 2^64, where the range end
+        // wraps, planned from --start as a run up to UINT64_MAX would be.
+        const uint64_t topOffset = uint64_t(0) - DEFAULT_BLOCK_SIZE;
+        RangePlan topPlan(topOffset + 1, UINT64_MAX, DEFAULT_BLOCK_SIZE, 0, 1, false);
+        if (topPlan.blockCount() != 1 || topPlan.blockOffset(0) != topOffset) {
+            std::cerr << "Range plan up to 2^64 - 1: " << topPlan.blockCount() << " blocks, expected the one at " << topOffset << std::endl;
+            return 1;
+        }
+        CpuSieve topSieve(0, DEFAULT_BLOCK_SIZE);
+        std::vector<uint64_t> topBits(DEFAULT_BLOCK_SIZE / 128);
+        topSieve.sieveRange(topOffset, 1, topBits.data());
+        uint64_t topWrong = 0;
+        for (uint64_t i = 0; i < DEFAULT_BLOCK_SIZE / 2; ++i) {
+            uint64_t n = topOffset + 2 * i + 1;
+            if (((topBits[i / 64] >> (i % 64)) & 1) == uint64_t(Primality64::isPrime(n))) continue;
+            if (topWrong++ < 10) std::cerr << "CPU sieve wrong on " << n << ": the twin says " << (Primality64::isPrime(n) ? "prime" : "composite") << std::endl;
+        }
+        std::cerr << "CPU sieve, top block from " << topOffset << ": " << (topWrong == 0 ? "agrees with the twin" : std::to_string(topWrong) + " wrong") << std::endl;
+        if (topWrong != 0) return 1;
+        if (cpuBackend) return 0;
+    }
+
+    // --- 1. Vulkan Setup (Instance, Device, Queue) ---
+    // Before the range is planned: a GPU run may take its block size from the tuning cache.
+    std::unique_ptr<VulkanContext> vulkan;
+    if (!cpuBackend) {
+        vulkan.reset(new VulkanContext(deviceSelector, "Sieve"));
+        if (!vulkan->enabledFeatures.shaderInt64) throw std::runtime_error(std::string(vulkan->properties.deviceName) + " has no shaderInt64; use --cpu");
+    }
+    const VkDevice device = vulkan ? vulkan->device : VK_NULL_HANDLE;
+    const VkQueue computeQueue = vulkan ? vulkan->computeQueue : VK_NULL_HANDLE;
+    const uint32_t queueFamilyIndex = vulkan ? vulkan->queueFamilyIndex : uint32_t(-1);
+    const VkPhysicalDeviceProperties deviceProperties = vulkan ? vulkan->properties : VkPhysicalDeviceProperties{};
+    const std::string deviceUuid = vulkan ? vulkan->uuid : "";
+    const double timestampPeriodNs = vulkan ? vulkan->timestampPeriodNs : 0.0;
+    const bool haveTimestamps = vulkan && vulkan->timestampValidBits != 0;
+    const bool haveSubgroupArithmetic = vulkan && (vulkan->subgroupOperations & VK_SUBGROUP_FEATURE_ARITHMETIC_BIT);
+    if (!cpuBackend) {
+        if ((sieveMode == SieveMode::Subgroup || sieveMode == SieveMode::Count) && !haveSubgroupArithmetic) {
+            throw std::runtime_error(std::string("--compact ") + sieveModeName(sieveMode) + " needs subgroup arithmetic in compute shaders");
+        }
+        // Counting never needs the primes themselves; without subgroup arithmetic the host popcounts the bitmap instead.
+        // --stats aggregates on the GPU too, unless --compact bitmap asks for the host to do it.
+        if (collectStats) {
+            if (!explicitMode) sieveMode = SieveMode::Stats;
+        } else if (outputFormat == OutputFormat::Count && !explicitMode && !searching && !segmentKernel && haveSubgroupArithmetic) {
+            sieveMode = SieveMode::Count;
+        }
+    }
+    // Only the compacting kernels write the prime list; --bench-compact runs them all.
+    const bool needPrimeList = benchCompact || sieveMode == SieveMode::Atomic || sieveMode == SieveMode::Subgroup || sieveMode == SieveMode::Scan;
+
+    // Whether the kernels can run a shape on this device.
+    auto fitsDevice = [&](const BlockShape& candidate) {
+        const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+        return candidate.valid() && candidate.workgroupSize <= limits.maxComputeWorkGroupSize[0] &&
+               candidate.workgroupSize <= limits.maxComputeWorkGroupInvocations && candidate.workgroups() <= limits.maxComputeWorkGroupCount[0] &&
+               (!needPrimeList || candidate.primeListBytes() <= limits.maxStorageBufferRange);
+    };
+
+    // A tuned device starts from its cached shape unless the command line says otherwise.
+    // The cache is tuned for sieve.comp.
+    if (!cpuBackend && !autotune && !segmentKernel && (!explicitShape || !explicitInFlight)) {
+        TunedShape tuned;
+        BlockShape cached;
+        if (loadTunedShape(tuneCachePath, deviceUuid, tuned)) {
+            cached.blockSize = tuned.blockSize;
+            cached.workgroupSize = tuned.localSize;
+            if (!fitsDevice(cached)) {
+                std::cerr << "Ignoring the tuned shape in " << tuneCachePath << ": it does not fit this device any more." << std::endl;
+            } else {
+                if (!explicitShape) shape = cached;
+                if (!explicitInFlight) inFlight = tuned.inFlight;
+                std::cerr << "Tuned for " << deviceProperties.deviceName << " (" << tuneCachePath << "): block " << shape.blockSize << ", local size "
+                          << shape.workgroupSize << ", " << inFlight << " in flight" << std::endl;
+            }
+        }
+    }
+    if (!shape.valid()) {
+        throw std::runtime_error("--block-size must be a multiple of 128 and of twice --local-size, which must be a multiple of 32");
+    }
+    if (!cpuBackend && !fitsDevice(shape)) {
+        throw std::runtime_error("Block size " + std::to_string(shape.blockSize) + " with local size " + std::to_string(shape.workgroupSize) + " exceeds the limits of this device");
+    }
+    const RangePlan plan(start, limit, shape.blockSize, shard, shards, contiguousShards);
+
+    // A checkpoint of the same run picks up after its last flushed block.
+    Checkpoint checkpoint;
+    checkpoint.range = plan.describe();
+    checkpoint.format = outputFormatName(outputFormat);
+    bool resuming = false;
+    if (!checkpointPath.empty() && checkpoint.load(checkpointPath)) {
+        if (checkpoint.range != plan.describe() || checkpoint.format != outputFormatName(outputFormat)) {
+            throw std::runtime_error("Checkpoint " + checkpointPath + " belongs to a different run (" + checkpoint.range + ", " + checkpoint.format + ")");
+        }
+        resuming = true;
+    }
+    const uint64_t resumeBlocks = resuming ? checkpoint.blocksDone : 0;
+
+    // Statistics are saved inside every checkpoint, so a resumed run has them up to the same block.
+    PrimeStats primeStats;
+    if (collectStats && resuming) {
+        std::istringstream saved(checkpoint.stats);
+        if (!checkpoint.stats.empty()) primeStats.load(saved, plan.describe());
+        if (checkpoint.stats.empty() || primeStats.blockCount() != resumeBlocks) {
+            throw std::runtime_error("Checkpoint " + checkpointPath + " has no statistics of block " + std::to_string(resumeBlocks) + " (was it written without --stats?)");
+        }
+    }
+
+    // Primes go to the writer (stdout by default); progress goes to stderr.
+    PrimeWriter writer((benchCompact || diffCpu || validatePrimality) ? OutputFormat::Count : outputFormat, outputPath, directIo, 8, resuming ? &checkpoint.writer : nullptr);
+    if (!benchCompact && !diffCpu && !validatePrimality) {
+        std::cerr << "Range " << plan.describe() << ": " << plan.blockCount() << " blocks";
+        if (resuming) std::cerr << ", resuming after block " << resumeBlocks << " (" << checkpoint.writer.primes << " primes so far)";
+        std::cerr << std::endl;
+    }
+
+    // Records that the first resumeBlocks + blocksDone blocks are complete,
+    // every checkpointEvery blocks or when forced. Called from whichever
+    // thread queues blocks to the writer.
+    auto saveCheckpoint = [&](uint64_t blocksDone, bool force) {
+        if (checkpointPath.empty() || (!force && blocksDone % checkpointEvery != 0)) return;
+        checkpoint.writer = writer.sync();
+        checkpoint.blocksDone = resumeBlocks + blocksDone;
+        if (collectStats) checkpoint.stats = primeStats.text(plan.describe());
+        checkpoint.save(checkpointPath);
+        if (collectStats) replaceFile(statsPath, checkpoint.stats, "statistics");
+    };
+
+    // Feeds one finished block to --stats: the histograms of stats.comp when
+    // there are any, else the bitmap, masked to [start, limit].
+    auto collectBlockStats = [&](const uint64_t* bitmap, const uint32_t* deviceStats, uint64_t offset) {
+        bool withTwo = offset == 0 && start <= 2 && limit >= 2;
+        if (deviceStats) {
+            primeStats.addDevice(deviceStats, offset, shape.blockSize, withTwo);
+        } else {
+            uint64_t skip, valid;
+            blockBitRange(shape.blockSize, offset, start, limit, skip, valid);
+            primeStats.addBitmap(bitmap, offset, shape.blockSize, skip, valid, withTwo);
+        }
+    };
+
+    // Hands the matches of one search step to the writer and logs every gap.
+    auto emitMatches = [&](std::vector<uint64_t>& firsts, const std::vector<uint64_t>& gapSizes) {
+        for (size_t g = 0; g < gapSizes.size(); ++g) {
+            std::cerr << "\n--- Gap of " << gapSizes[g] << " after " << firsts[g] << (gapRecords ? " (record)" : "") << " ---\n";
+        }
+        uint64_t found = firsts.size();
+        if (writer.wantsPrimes()) {
+            writer.write(std::move(firsts));
+        } else {
+            writer.addCount(found);
+        }
+        return found;
+    };
+    // Runs the search over one block bitmap (or, with nullptr, ends it) and returns the matches.
+    uint64_t goldbachFailures = 0;
+    auto searchBlock = [&](const uint64_t* bitmap, uint64_t offset) {
+        std::vector<uint64_t> firsts, gapSizes;
+        if (checkGoldbach) {
+            std::vector<GoldbachSearch::Record> records;
+            std::vector<uint64_t> failures;
+            if (bitmap) {
+                goldbach.scan(bitmap, offset, shape.bitmapWords(), records, failures);
+            } else {
+                goldbach.finish();
+            }
+            for (uint64_t n : failures) std::cerr << "\n--- Goldbach FAILURE: " << n << " is not a sum of two primes ---\n";
+            for (const GoldbachSearch::Record& r : records) {
+                std::cerr << "\n--- Goldbach record: " << r.n << " = " << r.p << " + " << r.n - r.p << " ---\n";
+                firsts.push_back(r.n);
+            }
+            goldbachFailures += failures.size();
+            return emitMatches(firsts, gapSizes);
+        }
+        if (bitmap) {
+            uint64_t skip, valid;
+            blockBitRange(shape.blockSize, offset, start, limit, skip, valid);
+            search.scan(bitmap, offset, shape.bitmapWords(), skip, valid, firsts, &gapSizes);
+        } else {
+            search.finish(firsts, &gapSizes);
+        }
+        return emitMatches(firsts, gapSizes);
+    };
+    const char* itemName = searching ? "matches" : "primes";
+
+    // Prints the run summary and, for --verify-pi, checks the total against
+    // Meissel-Lehmer. Shared by both engines; returns the exit code.
+    auto finishRun = [&](const char* engine, uint64_t blocksDone, double wall, const std::string& extra) {
+        std::cerr << "\n--- Summary: " << blocksDone << " blocks in " << wall << "s, sustained " << blocksDone * shape.blockSize / wall / 1e6 << "M nums/s, "
+                  << writer.primesWritten() << " " << itemName << " (" << writer.primesWritten() / wall / 1e6 << "M " << itemName << "/s), " << writer.bytesWritten() << " bytes written"
+                  << extra << " ---" << std::endl;
+        if (outputFormat == OutputFormat::Count) {
+            std::cout << writer.primesWritten() << std::endl;
+        }
+        if (collectStats) {
+            replaceFile(statsPath, primeStats.text(plan.describe()), "statistics");
+            std::cerr << "Statistics of " << primeStats.primeCount() << " primes in " << primeStats.blockCount() << " blocks written to " << statsPath << std::endl;
+        }
+        if (checkGoldbach) {
+            std::cerr << "Goldbach: " << goldbach.evenChecked() << " even numbers checked, largest minimal p " << goldbach.maxMinimalPrime()
+                      << " (n = " << goldbach.maxMinimalAt() << "), " << goldbachFailures << " failures" << std::endl;
+            if (goldbachFailures != 0) return 1;
+        }
+
+        if (verifyPi && resumeBlocks + blocksDone < plan.blockCount()) {
+            std::cerr << "Interrupted before " << limit << ", pi(x) not cross-checked." << std::endl;
+        } else if (verifyPi && shards > 1) {
+            std::cerr << "Shard " << shard << "/" << shards << " holds only part of pi(" << limit << "); add up the shards to cross-check." << std::endl;
+        } else if (verifyPi) {
+            auto t1 = std::chrono::high_resolution_clock::now();
+            PrimePi primePi;
+            uint64_t expected = primePi(limit) - (start > 1 ? primePi(start - 1) : 0);
+            auto t2 = std::chrono::high_resolution_clock::now();
+            bool match = expected == writer.primesWritten();
+            std::cerr << "pi(" << limit << ")" << (start > 1 ? " - pi(" + std::to_string(start - 1) + ")" : "") << ": "
+                      << engine << " " << writer.primesWritten() << ", Meissel-Lehmer " << expected << " ("
+                      << std::chrono::duration<double>(t2 - t1).count() << "s on the CPU) -> " << (match ? "MATCH" : "MISMATCH") << std::endl;
+            if (!match) return 1;
+        }
+        return 0;
+    };
+
+    if (cpuBackend) {
+        // --- CPU Engine: Same Blocks, Output and Summary, No Vulkan ---
+        std::signal(SIGINT, onSigint);
+        CpuSieve cpu(cpuThreads, shape.blockSize, plan.blockCount() - resumeBlocks, [&](uint64_t k) { return plan.blockOffset(resumeBlocks + k); });
+        std::cerr << "Starting prime sieve on the CPU (" << cpuThreads << " threads). Press Ctrl+C to stop." << std::endl;
+
+        uint64_t blocksDone = 0;
+        auto startTime = std::chrono::high_resolution_clock::now();
+        uint64_t offset;
+        const uint64_t* bitmap;
+        while (!stopRequested && cpu.next(offset, bitmap)) {
+            std::vector<uint64_t> primes;
+            size_t scannedBytes;
+            uint64_t block_primes = searching ? searchBlock(bitmap, offset)
+                                              : readBitmap(bitmap, shape.blockSize, offset, start, limit, writer.wantsPrimes() ? &primes : nullptr, scannedBytes);
+            if (collectStats) collectBlockStats(bitmap, nullptr, offset);
+
+            ++blocksDone;
+            double wall = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+            std::cerr << "\n--- Block [" << offset << " - " << offset + shape.blockSize - 1 << "] (" << shape.blockSize/1e6 << "M nums) sieved on the CPU, "
+                      << block_primes << " " << itemName << ", sustained " << blocksDone * shape.blockSize / wall / 1e6 << "M nums/s ---\n";
+            if (searching) {
+                // searchBlock already handed the matches to the writer.
+            } else if (writer.wantsPrimes()) {
+                writer.write(std::move(primes));
+            } else {
+                writer.addCount(block_primes);
+            }
+            saveCheckpoint(blocksDone, false);
+        }
+        if (searching) searchBlock(nullptr, 0);
+        saveCheckpoint(blocksDone, true);
+        writer.finish();
+
+        double wall = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+        return finishRun("CPU", blocksDone, wall, "");
+    }
+
+    // --- 2. Create the Buffers of Each In-Flight Block ---
+    auto createBuffer = [&](VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& memory) {
+        vulkan->createBuffer(size, usage, properties, buffer, memory);
+    };
+    const VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    // segment.comp sieves with every prime up to the square root of the last block it will see.
+    std::unique_ptr<SegmentPlan> segmentPlan;
+    VkBuffer patternBuffer = VK_NULL_HANDLE, mediumBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory patternMemory = VK_NULL_HANDLE, mediumMemory = VK_NULL_HANDLE;
+    if (segmentKernel) {
+        uint64_t top = diffCpu ? diffOffset + uint64_t(BENCH_BLOCKS) * shape.blockSize - 1
+                               : plan.blockOffset(plan.blockCount() - 1) + shape.blockSize - 1;
+        segmentPlan.reset(new SegmentPlan(top, shape.oddPerBlock()));
+        auto upload = [&](const std::vector<uint32_t>& words, VkBuffer& buffer, VkDeviceMemory& memory) {
+            void* data;
+            createBuffer(sizeof(uint32_t) * words.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, buffer, memory);
+            vkMapMemory(device, memory, 0, sizeof(uint32_t) * words.size(), 0, &data);
+            memcpy(data, words.data(), sizeof(uint32_t) * words.size());
+            vkUnmapMemory(device, memory);
+        };
+        upload(segmentPlan->patternWords(), patternBuffer, patternMemory);
+        upload(segmentPlan->mediumPrimes(), mediumBuffer, mediumMemory);
+    }
+
+    // --autotune runs every candidate through the same slots, so they are
+    // sized for the largest block, the smallest workgroup and the deepest queue.
+    BlockShape capacity = shape;
+    uint32_t slotCount = inFlight;
+    if (autotune) {
+        for (uint32_t blockSize : TUNE_BLOCK_SIZES) {
+            for (uint32_t localSize : TUNE_LOCAL_SIZES) {
+                BlockShape candidate{blockSize, localSize};
+                if (!fitsDevice(candidate)) continue;
+                capacity.blockSize = std::max(capacity.blockSize, blockSize);
+                capacity.workgroupSize = std::min(capacity.workgroupSize, localSize);
+            }
+        }
+        slotCount = *std::max_element(std::begin(TUNE_IN_FLIGHT), std::end(TUNE_IN_FLIGHT));
+    }
+
+    std::vector<BlockSlot> slots(slotCount);
+    for (uint32_t s = 0; s < slotCount; ++s) {
+        BlockSlot& slot = slots[s];
+        void* data;
+        createBuffer(capacity.bitmapBytes(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, slot.resultBuffer, slot.resultMemory);
+        vkMapMemory(device, slot.resultMemory, 0, capacity.bitmapBytes(), 0, &data);
+        slot.bitmap = static_cast<const uint64_t*>(data);
+
+        // Sized for the worst case, but the host only reads the first 8 + 8 * count bytes.
+        // A run that never compacts (segment.comp always) gets a stub.
+        createBuffer(needPrimeList ? capacity.primeListBytes() : 2 * sizeof(uint64_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, hostVisible, slot.primeBuffer, slot.primeMemory);
+        vkMapMemory(device, slot.primeMemory, 0, VK_WHOLE_SIZE, 0, &data);
+        slot.primeCount = static_cast<const uint32_t*>(data);
+        slot.primeList = reinterpret_cast<const uint64_t*>(static_cast<const char*>(data) + sizeof(uint64_t));
+
+        createBuffer(sizeof(uint32_t) * capacity.workgroups(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, slot.groupCountBuffer, slot.groupCountMemory);
+        vkMapMemory(device, slot.groupCountMemory, 0, sizeof(uint32_t) * capacity.workgroups(), 0, &data);
+        slot.groupCounts = static_cast<const uint32_t*>(data);
+
+        createBuffer(sizeof(uint32_t) * PrimeStats::DEVICE_WORDS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, hostVisible, slot.statsBuffer, slot.statsMemory);
+        vkMapMemory(device, slot.statsMemory, 0, sizeof(uint32_t) * PrimeStats::DEVICE_WORDS, 0, &data);
+        slot.stats = static_cast<const uint32_t*>(data);
+
+        if (segmentPlan) {
+            createBuffer(sizeof(uint32_t) * segmentPlan->bucketWords(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, slot.bucketBuffer, slot.bucketMemory);
+            vkMapMemory(device, slot.bucketMemory, 0, sizeof(uint32_t) * segmentPlan->bucketWords(), 0, &data);
+            slot.buckets = static_cast<uint32_t*>(data);
+        }
+        slot.firstQuery = 2 * s;
+    }
+
+    // --- 3. Create Compute Pipelines ---
+    // binding 0: bitmap, 1: append buffer, 2: per-workgroup counts, 3: statistics,
+    // 4-6: pattern, medium primes and large-prime buckets of segment.comp.
+    // All kernels share this layout and simply leave out the bindings they do not use.
+    const uint32_t BINDINGS = 7;
+    VkDescriptorSetLayoutBinding bindings[BINDINGS] = {};
+    for (uint32_t b = 0; b < BINDINGS; ++b) {
+        bindings[b].binding = b; bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; bindings[b].descriptorCount = 1; bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo layoutInfo{}; layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO; layoutInfo.bindingCount = BINDINGS; layoutInfo.pBindings = bindings;
     VkDescriptorSetLayout descriptorSetLayout;
     vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout);
 
@@ -109,91 +772,567 @@ int main() {
     VkPipelineLayout pipelineLayout;
     vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout);
 
-    VkPipeline computePipeline;
-    VkComputePipelineCreateInfo pipelineInfo{}; pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO; pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO; pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT; pipelineInfo.stage.module = computeShaderModule; pipelineInfo.stage.pName = "main"; pipelineInfo.layout = pipelineLayout;
-    vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline);
+    std::vector<VkShaderModule> shaderModules;
+    auto loadShader = [&](const std::string& path) {
+        VkShaderModule module = vulkan->loadShader(path);
+        shaderModules.push_back(module);
+        return module;
+    };
 
-    // --- 4. Descriptor Set & Command Pool/Buffer ---
-    VkDescriptorPool descriptorPool;
-    VkDescriptorPoolSize poolSize{}; poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; poolSize.descriptorCount = 1;
-    VkDescriptorPoolCreateInfo poolInfo{}; poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO; poolInfo.poolSizeCount = 1; poolInfo.pPoolSizes = &poolSize; poolInfo.maxSets = 1;
-    vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
+    // constant_id 0 = SLOW_MULMOD, 1 = COMPACT_MODE (ignored by the other kernels),
+    // 2 = workgroup size (local_size_x_id), 3 = odd numbers per block,
+    // 4 = words per segment (segment.comp only).
+    std::vector<VkPipeline> pipelines;
+    auto createPipeline = [&](VkShaderModule module, uint32_t compactMode, const BlockShape& blockShape) {
+        uint32_t segmentWords = segmentPlan ? segmentPlan->segmentWordCount() : SegmentPlan::MAX_SEGMENT_WORDS;
+        struct { VkBool32 slowMulmod; uint32_t compactMode; uint32_t workgroupSize; uint32_t oddPerBlock; uint32_t segmentWords; } specData = {slowMulmod, compactMode, blockShape.workgroupSize, blockShape.oddPerBlock(), segmentWords};
+        VkSpecializationMapEntry specEntries[5] = {};
+        specEntries[0].constantID = 0; specEntries[0].offset = 0; specEntries[0].size = sizeof(VkBool32);
+        for (uint32_t c = 1; c < 5; ++c) {
+            specEntries[c].constantID = c; specEntries[c].offset = sizeof(VkBool32) + (c - 1) * sizeof(uint32_t); specEntries[c].size = sizeof(uint32_t);
+        }
+        VkSpecializationInfo specInfo{}; specInfo.mapEntryCount = 5; specInfo.pMapEntries = specEntries; specInfo.dataSize = sizeof(specData); specInfo.pData = &specData;
 
-    VkDescriptorSet descriptorSet;
-    VkDescriptorSetAllocateInfo dsAllocInfo{}; dsAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO; dsAllocInfo.descriptorPool = descriptorPool; dsAllocInfo.descriptorSetCount = 1; dsAllocInfo.pSetLayouts = &descriptorSetLayout;
-    vkAllocateDescriptorSets(device, &dsAllocInfo, &descriptorSet);
+        VkPipeline pipeline;
+        VkComputePipelineCreateInfo pipelineInfo{}; pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO; pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO; pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT; pipelineInfo.stage.module = module; pipelineInfo.stage.pName = "main"; pipelineInfo.stage.pSpecializationInfo = &specInfo; pipelineInfo.layout = pipelineLayout;
+        vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+        pipelines.push_back(pipeline);
+        return pipeline;
+    };
+
+    VkShaderModule sieveModule = loadShader(segmentKernel ? "segment.spv" : "sieve.spv");
+    VkShaderModule compactModule = loadShader("compact.spv");
+    VkShaderModule subgroupModule = haveSubgroupArithmetic ? loadShader("compact_subgroup.spv") : VK_NULL_HANDLE;
+    VkShaderModule countModule = haveSubgroupArithmetic ? loadShader("count.spv") : VK_NULL_HANDLE;
+    VkShaderModule statsModule = collectStats ? loadShader("stats.spv") : VK_NULL_HANDLE;
 
-    VkDescriptorBufferInfo bufferDescInfo{}; bufferDescInfo.buffer = resultBuffer; bufferDescInfo.offset = 0; bufferDescInfo.range = VK_WHOLE_SIZE;
-    VkWriteDescriptorSet descriptorWrite{}; descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; descriptorWrite.dstSet = descriptorSet; descriptorWrite.dstBinding = 0; descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; descriptorWrite.descriptorCount = 1; descriptorWrite.pBufferInfo = &bufferDescInfo;
-    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+    // Every kernel specialized for one block shape.
+    struct Kernels {
+        VkPipeline sieve, atomic, scanCount, scanPrefix, scanScatter;
+        VkPipeline subgroup = VK_NULL_HANDLE, count = VK_NULL_HANDLE;
+        VkPipeline stats = VK_NULL_HANDLE;
+    };
+    auto createKernels = [&](const BlockShape& blockShape) {
+        Kernels k;
+        k.sieve = createPipeline(sieveModule, 0, blockShape);
+        k.atomic = createPipeline(compactModule, 0, blockShape);
+        k.scanCount = createPipeline(compactModule, 2, blockShape);
+        k.scanPrefix = createPipeline(compactModule, 3, blockShape);
+        k.scanScatter = createPipeline(compactModule, 4, blockShape);
+        if (haveSubgroupArithmetic) {
+            k.subgroup = createPipeline(subgroupModule, 1, blockShape);
+            k.count = createPipeline(countModule, 0, blockShape);
+        }
+        if (collectStats) k.stats = createPipeline(statsModule, 0, blockShape);
+        return k;
+    };
+    Kernels kernels = createKernels(shape);
+
+    // --- 4. Descriptor Sets, Command Buffers, Fences & Timestamps per Slot ---
+    VkDescriptorPool descriptorPool;
+    VkDescriptorPoolSize poolSize{}; poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; poolSize.descriptorCount = BINDINGS * slotCount;
+    VkDescriptorPoolCreateInfo poolInfo{}; poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO; poolInfo.poolSizeCount = 1; poolInfo.pPoolSizes = &poolSize; poolInfo.maxSets = slotCount;
+    vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
 
     VkCommandPool commandPool;
-    VkCommandPoolCreateInfo cpInfo{}; cpInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO; cpInfo.queueFamilyIndex = queueFamilyIndex;
+    VkCommandPoolCreateInfo cpInfo{}; cpInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO; cpInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; cpInfo.queueFamilyIndex = queueFamilyIndex;
     vkCreateCommandPool(device, &cpInfo, nullptr, &commandPool);
 
-    VkCommandBuffer commandBuffer;
-    VkCommandBufferAllocateInfo cbAllocInfo{}; cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO; cbAllocInfo.commandPool = commandPool; cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbAllocInfo.commandBufferCount = 1;
-    vkAllocateCommandBuffers(device, &cbAllocInfo, &commandBuffer);
+    VkQueryPool queryPool;
+    VkQueryPoolCreateInfo qpInfo{}; qpInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO; qpInfo.queryType = VK_QUERY_TYPE_TIMESTAMP; qpInfo.queryCount = 2 * slotCount;
+    vkCreateQueryPool(device, &qpInfo, nullptr, &queryPool);
+
+    for (BlockSlot& slot : slots) {
+        VkDescriptorSetAllocateInfo dsAllocInfo{}; dsAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO; dsAllocInfo.descriptorPool = descriptorPool; dsAllocInfo.descriptorSetCount = 1; dsAllocInfo.pSetLayouts = &descriptorSetLayout;
+        vkAllocateDescriptorSets(device, &dsAllocInfo, &slot.descriptorSet);
 
-    // --- 5. Main Sieve Loop ---
-    uint64_t current_offset = 0;
-    std::cout << "Starting prime sieve. Press Ctrl+C to stop." << std::endl;
+        VkDescriptorBufferInfo bufferDescInfos[BINDINGS] = {};
+        bufferDescInfos[0].buffer = slot.resultBuffer; bufferDescInfos[0].range = VK_WHOLE_SIZE;
+        bufferDescInfos[1].buffer = slot.primeBuffer; bufferDescInfos[1].range = VK_WHOLE_SIZE;
+        bufferDescInfos[2].buffer = slot.groupCountBuffer; bufferDescInfos[2].range = VK_WHOLE_SIZE;
+        bufferDescInfos[3].buffer = slot.statsBuffer; bufferDescInfos[3].range = VK_WHOLE_SIZE;
+        bufferDescInfos[4].buffer = patternBuffer; bufferDescInfos[4].range = VK_WHOLE_SIZE;
+        bufferDescInfos[5].buffer = mediumBuffer; bufferDescInfos[5].range = VK_WHOLE_SIZE;
+        bufferDescInfos[6].buffer = slot.bucketBuffer; bufferDescInfos[6].range = VK_WHOLE_SIZE;
+        // Bindings 4-6 only exist for segment.comp.
+        const uint32_t writes = segmentPlan ? BINDINGS : 4;
+        VkWriteDescriptorSet descriptorWrites[BINDINGS] = {};
+        for (uint32_t b = 0; b < writes; ++b) {
+            descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; descriptorWrites[b].dstSet = slot.descriptorSet; descriptorWrites[b].dstBinding = b; descriptorWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; descriptorWrites[b].descriptorCount = 1; descriptorWrites[b].pBufferInfo = &bufferDescInfos[b];
+        }
+        vkUpdateDescriptorSets(device, writes, descriptorWrites, 0, nullptr);
+
+        VkCommandBufferAllocateInfo cbAllocInfo{}; cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO; cbAllocInfo.commandPool = commandPool; cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbAllocInfo.commandBufferCount = 1;
+        vkAllocateCommandBuffers(device, &cbAllocInfo, &slot.commandBuffer);
 
-    while (true) {
-        auto t1 = std::chrono::high_resolution_clock::now();
+        VkFenceCreateInfo fenceInfo{}; fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        vkCreateFence(device, &fenceInfo, nullptr, &slot.fence);
+    }
 
-        VkCommandBufferBeginInfo beginInfo{}; beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    // --- 5. Per-Block Recording and Readback ---
+    // Workgroups of the sieve kernel: one per segment for segment.comp.
+    const uint32_t sieveGroups = segmentPlan ? segmentPlan->segments() : shape.workgroups();
+    auto submitBlock = [&](BlockSlot& slot, SieveMode mode) {
+        slot.mode = mode;
+        if (segmentPlan) segmentPlan->fillBuckets(slot.offset, slot.buckets);
+        VkCommandBuffer commandBuffer = slot.commandBuffer;
+        vkResetCommandBuffer(commandBuffer, 0);
+        VkCommandBufferBeginInfo beginInfo{}; beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO; beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
         vkBeginCommandBuffer(commandBuffer, &beginInfo);
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        if (haveTimestamps) {
+            vkCmdResetQueryPool(commandBuffer, queryPool, slot.firstQuery, 2);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, slot.firstQuery);
+        }
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &slot.descriptorSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint64_t), &slot.offset);
 
-        //
-        // --- THIS IS THE LINE THAT MUST BE CORRECT ---
-        //
-        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint64_t), &current_offset);
+        if (mode == SieveMode::Atomic || mode == SieveMode::Subgroup) {
+            // The appending kernels bump the count from zero.
+            vkCmdFillBuffer(commandBuffer, slot.primeBuffer, 0, sizeof(uint32_t), 0);
+            VkMemoryBarrier fillBarrier{}; fillBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; fillBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &fillBarrier, 0, nullptr, 0, nullptr);
+        }
+        if (mode == SieveMode::Stats) {
+            // Histograms accumulate from zero; the first prime bit is an atomicMin.
+            // Three disjoint fills: overlapping ones would need a barrier between them.
+            vkCmdFillBuffer(commandBuffer, slot.statsBuffer, 0, sizeof(uint32_t), 0);
+            vkCmdFillBuffer(commandBuffer, slot.statsBuffer, sizeof(uint32_t), sizeof(uint32_t), PrimeStats::NO_PRIME);
+            vkCmdFillBuffer(commandBuffer, slot.statsBuffer, 2 * sizeof(uint32_t), sizeof(uint32_t) * (PrimeStats::DEVICE_WORDS - 2), 0);
+            VkMemoryBarrier fillBarrier{}; fillBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; fillBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &fillBarrier, 0, nullptr, 0, nullptr);
+        }
 
-        vkCmdDispatch(commandBuffer, BLOCK_SIZE / WORKGROUP_SIZE, 1, 1);
+        switch (mode) {
+            case SieveMode::Bitmap:
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernels.sieve);
+                vkCmdDispatch(commandBuffer, sieveGroups, 1, 1);
+                break;
+            case SieveMode::Atomic:
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernels.atomic);
+                vkCmdDispatch(commandBuffer, shape.workgroups(), 1, 1);
+                break;
+            case SieveMode::Subgroup:
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernels.subgroup);
+                vkCmdDispatch(commandBuffer, shape.workgroups(), 1, 1);
+                break;
+            case SieveMode::Count:
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernels.count);
+                vkCmdDispatch(commandBuffer, shape.workgroups(), 1, 1);
+                break;
+            case SieveMode::Scan: {
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernels.scanCount);
+                vkCmdDispatch(commandBuffer, shape.workgroups(), 1, 1);
+                // Pass 2, one workgroup, turns the workgroup counts of pass 1 into
+                // offsets in place; pass 3 reads them and the bitmap.
+                VkMemoryBarrier passBarrier{}; passBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; passBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT; passBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &passBarrier, 0, nullptr, 0, nullptr);
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernels.scanPrefix);
+                vkCmdDispatch(commandBuffer, 1, 1, 1);
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &passBarrier, 0, nullptr, 0, nullptr);
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernels.scanScatter);
+                vkCmdDispatch(commandBuffer, shape.workgroups(), 1, 1);
+                break;
+            }
+            case SieveMode::Stats: {
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernels.sieve);
+                vkCmdDispatch(commandBuffer, sieveGroups, 1, 1);
+                // The statistics pass reads the whole bitmap, one 32-bit word per invocation.
+                VkMemoryBarrier passBarrier{}; passBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; passBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT; passBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &passBarrier, 0, nullptr, 0, nullptr);
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernels.stats);
+                vkCmdDispatch(commandBuffer, (shape.oddPerBlock() / 32 + shape.workgroupSize - 1) / shape.workgroupSize, 1, 1);
+                break;
+            }
+        }
+        if (haveTimestamps) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, slot.firstQuery + 1);
+        }
+
+        // Make the shader writes visible to the host mapping before the fence signals.
+        VkMemoryBarrier hostBarrier{}; hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; hostBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT; hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
         vkEndCommandBuffer(commandBuffer);
 
         VkSubmitInfo submitInfo{}; submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; submitInfo.commandBufferCount = 1; submitInfo.pCommandBuffers = &commandBuffer;
-        vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
-        vkQueueWaitIdle(computeQueue);
+        vkQueueSubmit(computeQueue, 1, &submitInfo, slot.fence);
+    };
 
-        vkResetCommandBuffer(commandBuffer, 0);
+    // Begin/end GPU ticks of a finished block; both 0 without timestamp support.
+    auto readTicks = [&](const BlockSlot& slot, uint64_t ticks[2]) {
+        ticks[0] = ticks[1] = 0;
+        if (haveTimestamps) {
+            vkGetQueryPoolResults(device, queryPool, slot.firstQuery, 2, 2 * sizeof(uint64_t), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        }
+    };
 
-        auto t2 = std::chrono::high_resolution_clock::now();
-        double duration = std::chrono::duration<double>(t2 - t1).count();
+    // Counts the primes of a finished block and, when primes is non-null, appends
+    // them in increasing order. readbackBytes is how much of the mapping was read.
+    // Only the bitmap path handles a block that sticks out of [start, limit].
+    auto readBlock = [&](const BlockSlot& slot, std::vector<uint64_t>* primes, size_t& readbackBytes) {
+        if (slot.mode == SieveMode::Bitmap) {
+            return readBitmap(slot.bitmap, shape.blockSize, slot.offset, start, limit, primes, readbackBytes);
+        }
 
-        void* data;
-        vkMapMemory(device, resultMemory, 0, sizeof(uint32_t) * BLOCK_SIZE, 0, &data);
-        uint32_t* results = static_cast<uint32_t*>(data);
+        bool hasTwo = slot.offset == 0 && limit >= 2; // 2 is not in the odd-only results
+        uint64_t found = hasTwo ? 1 : 0;
+        if (primes && hasTwo) {
+            primes->push_back(2);
+        }
+
+        if (slot.mode == SieveMode::Stats) {
+            readbackBytes = sizeof(uint32_t) * PrimeStats::DEVICE_WORDS;
+            return found + slot.stats[0];
+        }
+        if (slot.mode == SieveMode::Count) {
+            readbackBytes = sizeof(uint32_t) * shape.workgroups();
+            for (uint32_t g = 0; g < shape.workgroups(); ++g) {
+                found += slot.groupCounts[g];
+            }
+            return found;
+        }
+
+        uint32_t count = *slot.primeCount;
+        readbackBytes = sizeof(uint64_t) + sizeof(uint64_t) * size_t(count);
+        if (primes) {
+            size_t first = primes->size();
+            primes->insert(primes->end(), slot.primeList, slot.primeList + count);
+            if (slot.mode != SieveMode::Scan) {
+                // Workgroups append in whatever order they happen to finish.
+                std::sort(primes->begin() + first, primes->end());
+            }
+        }
+        return found + count;
+    };
+
+    std::signal(SIGINT, onSigint);
+    int exitCode = 0;
+
+    if (autotune) {
+        // --- 6. Autotune: Local Size, Then Block Size, Then In-Flight Depth ---
+        // Three passes instead of the whole grid. The timestamps span from the
+        // first block's start to the last block's end, so the rate includes
+        // the bubbles between blocks that a deeper queue hides.
+        uint64_t tuneOffset = std::min(start, UINT64_MAX - (uint64_t(1) << 32)) & ~uint64_t(1);
+        std::cerr << "Autotuning " << sieveModeName(sieveMode) << " blocks on " << deviceProperties.deviceName << " from " << tuneOffset << ":\n"
+                  << std::setw(10) << "block" << std::setw(8) << "local" << std::setw(11) << "in flight" << std::setw(14) << "M nums/s" << std::endl;
 
-        std::cout << "\n--- Block [" << current_offset << " - " << current_offset + BLOCK_SIZE - 1 << "] (" << BLOCK_SIZE/1e6 << "M nums) processed in " << duration << "s ---\n";
-        for(uint32_t i=0; i < BLOCK_SIZE; ++i) {
-            if (results[i] == 1) {
-                std::cout << "Found prime: " << current_offset + i << "\n";
+        auto measure = [&](const BlockShape& candidate, const Kernels& candidateKernels, uint32_t depth) {
+            shape = candidate;
+            kernels = candidateKernels;
+            uint32_t blocks = uint32_t(std::max<uint64_t>(TUNE_MIN_BLOCKS, TUNE_NUMBERS / candidate.blockSize));
+            uint64_t firstTick = UINT64_MAX, lastTick = 0;
+            auto retire = [&](BlockSlot& slot) {
+                vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+                vkResetFences(device, 1, &slot.fence);
+                uint64_t ticks[2];
+                readTicks(slot, ticks);
+                firstTick = std::min(firstTick, ticks[0]);
+                lastTick = std::max(lastTick, ticks[1]);
+            };
+
+            // One untimed block first, for pipeline compilation and clocks ramping up.
+            slots[0].offset = tuneOffset;
+            submitBlock(slots[0], sieveMode);
+            retire(slots[0]);
+            firstTick = UINT64_MAX;
+            lastTick = 0;
+
+            auto t0 = std::chrono::high_resolution_clock::now();
+            for (uint32_t b = 0; b < blocks; ++b) {
+                BlockSlot& slot = slots[b % depth];
+                if (b >= depth) retire(slot);
+                slot.offset = tuneOffset + uint64_t(b) * candidate.blockSize;
+                submitBlock(slot, sieveMode);
+            }
+            for (uint32_t b = blocks > depth ? blocks - depth : 0; b < blocks; ++b) retire(slots[b % depth]);
+            double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+            if (haveTimestamps && lastTick > firstTick) seconds = (lastTick - firstTick) * timestampPeriodNs * 1e-9;
+
+            double rate = double(blocks) * candidate.blockSize / seconds / 1e6;
+            std::cerr << std::setw(10) << candidate.blockSize << std::setw(8) << candidate.workgroupSize << std::setw(11) << depth
+                      << std::fixed << std::setprecision(1) << std::setw(14) << rate << std::defaultfloat << std::endl;
+            return rate;
+        };
+
+        BlockShape bestShape = shape;
+        Kernels bestKernels = kernels;
+        double bestRate = 0.0;
+        auto tryShape = [&](const BlockShape& candidate) {
+            if (!fitsDevice(candidate)) return;
+            Kernels candidateKernels = createKernels(candidate);
+            double rate = measure(candidate, candidateKernels, inFlight);
+            if (rate > bestRate) {
+                bestRate = rate;
+                bestShape = candidate;
+                bestKernels = candidateKernels;
+            }
+        };
+        const uint32_t baseBlockSize = shape.blockSize;
+        for (uint32_t localSize : TUNE_LOCAL_SIZES) tryShape(BlockShape{baseBlockSize, localSize});
+        const uint32_t bestLocalSize = bestShape.workgroupSize;
+        for (uint32_t blockSize : TUNE_BLOCK_SIZES) {
+            if (blockSize != baseBlockSize) tryShape(BlockShape{blockSize, bestLocalSize});
+        }
+
+        TunedShape tuned;
+        tuned.blockSize = bestShape.blockSize;
+        tuned.localSize = bestShape.workgroupSize;
+        for (uint32_t depth : TUNE_IN_FLIGHT) {
+            double rate = measure(bestShape, bestKernels, depth);
+            if (rate > tuned.mnumsPerSecond) {
+                tuned.mnumsPerSecond = rate;
+                tuned.inFlight = depth;
             }
         }
-        vkUnmapMemory(device, resultMemory);
+        saveTunedShape(tuneCachePath, deviceUuid, tuned, deviceProperties.deviceName);
+        std::cerr << "Best: block " << tuned.blockSize << ", local size " << tuned.localSize << ", " << tuned.inFlight << " in flight, "
+                  << tuned.mnumsPerSecond << "M nums/s. Saved to " << tuneCachePath << " for device " << deviceUuid << "." << std::endl;
+    } else if (benchCompact) {
+        // --- 6. Compaction Benchmark: the Same Blocks Through Every Readback Variant ---
+        std::cerr << "Compaction benchmark, " << BENCH_BLOCKS << " blocks from " << benchOffset << ":\n"
+                  << std::left << std::setw(10) << "variant" << std::right << std::setw(14) << "GPU ms/block" << std::setw(15) << "host ms/block"
+                  << std::setw(18) << "readback B/block" << std::setw(14) << "primes/block" << std::endl;
+        BlockSlot& slot = slots[0];
+        uint64_t referencePrimes = 0;
+        for (SieveMode mode : {SieveMode::Bitmap, SieveMode::Atomic, SieveMode::Subgroup, SieveMode::Scan, SieveMode::Count}) {
+            if ((mode == SieveMode::Subgroup || mode == SieveMode::Count) && !haveSubgroupArithmetic) {
+                std::cerr << std::left << std::setw(10) << sieveModeName(mode) << std::right << "  not supported on this device" << std::endl;
+                continue;
+            }
+            uint64_t gpuTicks = 0, primesFound = 0, bytes = 0;
+            double hostSeconds = 0.0;
+            for (uint32_t b = 0; b < BENCH_BLOCKS; ++b) {
+                slot.offset = benchOffset + uint64_t(b) * shape.blockSize;
+                submitBlock(slot, mode);
+                vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+                vkResetFences(device, 1, &slot.fence);
+                uint64_t ticks[2];
+                readTicks(slot, ticks);
+                gpuTicks += ticks[1] - ticks[0];
 
-        current_offset += BLOCK_SIZE;
-        if (current_offset > (UINT64_MAX - BLOCK_SIZE)) {
-            std::cout << "Reached the limit of 64-bit integers. Stopping." << std::endl;
-            break;
+                // Host cost of turning the block into a sorted prime list (or a total).
+                auto h0 = std::chrono::high_resolution_clock::now();
+                std::vector<uint64_t> primes;
+                size_t readbackBytes;
+                primesFound += readBlock(slot, mode == SieveMode::Count ? nullptr : &primes, readbackBytes);
+                hostSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - h0).count();
+                bytes += readbackBytes;
+            }
+            if (mode == SieveMode::Bitmap) referencePrimes = primesFound;
+            std::cerr << std::left << std::setw(10) << sieveModeName(mode) << std::right << std::fixed << std::setprecision(3)
+                      << std::setw(14) << gpuTicks * timestampPeriodNs * 1e-6 / BENCH_BLOCKS
+                      << std::setw(15) << hostSeconds * 1e3 / BENCH_BLOCKS
+                      << std::setw(18) << bytes / BENCH_BLOCKS
+                      << std::setw(14) << primesFound / BENCH_BLOCKS
+                      << (primesFound != referencePrimes ? "  MISMATCH" : "") << std::defaultfloat << std::endl;
         }
+    } else if (diffCpu) {
+        // --- 6. Differential Test: sieve.comp Against the CPU Sieve, Bit for Bit ---
+        CpuSieve cpu(0, shape.blockSize);
+        std::vector<uint64_t> expected(shape.bitmapWords());
+        BlockSlot& slot = slots[0];
+        uint64_t badWords = 0;
+        for (uint32_t b = 0; b < BENCH_BLOCKS && !stopRequested; ++b) {
+            slot.offset = diffOffset + uint64_t(b) * shape.blockSize;
+            submitBlock(slot, SieveMode::Bitmap);
+            cpu.sieveRange(slot.offset, 1, expected.data());
+            vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+            vkResetFences(device, 1, &slot.fence);
+
+            for (uint32_t w = 0; w < shape.bitmapWords(); ++w) {
+                uint64_t diff = slot.bitmap[w] ^ expected[w];
+                if (diff == 0) continue;
+                if (badWords++ < 10) {
+                    uint64_t n = slot.offset + 2 * (uint64_t(w) * 64 + __builtin_ctzll(diff)) + 1;
+                    std::cerr << "Mismatch at " << n << ": GPU says " << ((slot.bitmap[w] & (diff & -diff)) ? "prime" : "composite")
+                              << ", CPU says " << ((expected[w] & (diff & -diff)) ? "prime" : "composite") << std::endl;
+                }
+            }
+        }
+        std::cerr << "Differential test, " << BENCH_BLOCKS << " blocks from " << diffOffset << ": "
+                  << (badWords == 0 ? "GPU and CPU agree" : std::to_string(badWords) + " differing words") << std::endl;
+        exitCode = badWords == 0 ? 0 : 1;
+    } else if (validatePrimality) {
+        // --- 6. Primality Validation: the Kernel's Bits Against the CPU Twin ---
+        // One bitmap block around each known case and the first random ones:
+        // the case itself is checked, and a sample of its neighbours.
+        const size_t gpuCases = std::min(primalityInputs.size(), knownPseudoprimes().size() + 64);
+        std::mt19937_64 rng(2);
+        BlockSlot& slot = slots[0];
+        uint64_t wrong = 0, checked = 0, blocks = 0;
+        auto check = [&](uint64_t n, const char* kind) {
+            uint64_t bit = (n - slot.offset - 1) / 2;
+            bool prime = (slot.bitmap[bit / 64] >> (bit % 64)) & 1;
+            ++checked;
+            if (prime == Primality64::isPrime(n)) return;
+            if (wrong++ < 10) std::cerr << "Kernel wrong on " << n << " (" << kind << "): it says " << (prime ? "prime" : "composite") << std::endl;
+        };
+        for (size_t c = 0; c < gpuCases && !stopRequested; ++c) {
+            uint64_t n = primalityInputs[c].n;
+            if (n < 3 || n % 2 == 0) continue; // the bitmap only holds odd numbers
+            // The block has to end inside 64 bits.
+            slot.offset = std::min(n - n % shape.blockSize, UINT64_MAX - shape.blockSize + 1);
+            submitBlock(slot, SieveMode::Bitmap);
+            vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+            vkResetFences(device, 1, &slot.fence);
+            ++blocks;
+
+            check(n, primalityInputs[c].kind);
+            for (int k = 0; k < 1024; ++k) check(slot.offset + 2 * (rng() % shape.oddPerBlock()) + 1, "neighbour");
+        }
+        std::cerr << "Primality test, " << (slowMulmod ? "double-and-add" : "Montgomery") << " kernel: " << checked << " numbers in " << blocks << " blocks, "
+                  << (wrong == 0 ? "all agree with the CPU twin" : std::to_string(wrong) + " wrong") << std::endl;
+        exitCode = wrong == 0 ? 0 : 1;
+    } else {
+        // --- 6. Consumer Thread: Waits for Blocks in Submit Order and Reads Them Back ---
+        WorkQueue<uint32_t> freeSlots, pendingSlots;
+        for (uint32_t s = 0; s < inFlight; ++s) freeSlots.push(s);
+
+        uint64_t blocksDone = 0;
+        // GPU busy time is the union of the blocks' [begin, end] intervals:
+        // with several slots in flight they overlap, and a plain sum would
+        // count the overlap twice. One queue starts the blocks in submit
+        // order, so a running end is enough to merge them.
+        uint64_t gpuBusyTicks = 0;
+        uint64_t firstGpuTick = 0, lastGpuTick = 0;
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        std::exception_ptr consumerError; // the consumer's, rethrown here once it is joined
+        std::thread consumer([&] {
+            uint32_t s;
+            while (pendingSlots.pop(s)) {
+                BlockSlot& slot = slots[s];
+                vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+
+                // A failed write stops the run: the rest of the slots are
+                // drained unread and the error is rethrown after the join.
+                if (consumerError) {
+                    vkResetFences(device, 1, &slot.fence);
+                    freeSlots.push(s);
+                    continue;
+                }
+                try {
+                    uint64_t ticks[2];
+                    readTicks(slot, ticks);
+                    if (blocksDone == 0) firstGpuTick = lastGpuTick = ticks[0];
+                    if (ticks[1] > lastGpuTick) {
+                        gpuBusyTicks += ticks[1] - std::max(ticks[0], lastGpuTick);
+                        lastGpuTick = ticks[1];
+                    }
+                    double gpuSeconds = (ticks[1] - ticks[0]) * timestampPeriodNs * 1e-9;
+
+                    std::vector<uint64_t> primes;
+                    size_t readbackBytes = shape.bitmapBytes();
+                    uint64_t block_primes = searching ? searchBlock(slot.bitmap, slot.offset)
+                                                      : readBlock(slot, writer.wantsPrimes() ? &primes : nullptr, readbackBytes);
+                    if (collectStats) collectBlockStats(slot.bitmap, slot.mode == SieveMode::Stats ? slot.stats : nullptr, slot.offset);
+
+                    ++blocksDone;
+                    double wall = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+                    std::cerr << "\n--- Block [" << slot.offset << " - " << slot.offset + shape.blockSize - 1 << "] (" << shape.blockSize/1e6 << "M nums) computed in " << gpuSeconds << "s on the GPU ("
+                              << gpuSeconds * 1e9 / shape.oddPerBlock() << (segmentKernel ? " ns per odd number), " : " ns per primality test), ")
+                              << block_primes << " " << itemName << ", " << readbackBytes << " bytes read back, sustained "
+                              << blocksDone * shape.blockSize / wall / 1e6 << "M nums/s ---\n";
+                    if (searching) {
+                        // searchBlock already handed the matches to the writer.
+                    } else if (writer.wantsPrimes()) {
+                        writer.write(std::move(primes));
+                    } else {
+                        writer.addCount(block_primes);
+                    }
+                    saveCheckpoint(blocksDone, false);
+                } catch (...) {
+                    consumerError = std::current_exception();
+                    stopRequested = true;
+                }
+
+                vkResetFences(device, 1, &slot.fence);
+                freeSlots.push(s);
+            }
+            if (consumerError) return;
+            try {
+                if (searching) searchBlock(nullptr, 0);
+                saveCheckpoint(blocksDone, true);
+            } catch (...) {
+                consumerError = std::current_exception();
+            }
+        });
+
+        // --- 7. Main Sieve Loop: Keeps up to inFlight Blocks Queued on the GPU ---
+        std::cerr << "Starting prime sieve (" << (segmentKernel ? "segmented Eratosthenes" : slowMulmod ? "double-and-add mul_mod" : "Montgomery mul_mod") << ", " << sieveModeName(sieveMode) << " readback, "
+                  << inFlight << " blocks in flight). Press Ctrl+C to stop." << std::endl;
+
+        for (uint64_t k = resumeBlocks; !stopRequested && k < plan.blockCount(); ++k) {
+            uint32_t s;
+            freeSlots.pop(s);
+            BlockSlot& slot = slots[s];
+            slot.offset = plan.blockOffset(k);
+            // The blocks holding start and limit go through the bitmap so the host can drop what lies outside.
+            submitBlock(slot, plan.isPartial(slot.offset) ? SieveMode::Bitmap : sieveMode);
+            pendingSlots.push(s);
+        }
+
+        // Let the consumer drain whatever is still in flight.
+        pendingSlots.close();
+        consumer.join();
+        if (consumerError) std::rethrow_exception(consumerError);
+        writer.finish();
+
+        double wall = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+        std::string gpuIdle;
+        if (haveTimestamps && lastGpuTick > firstGpuTick) {
+            double idle = std::clamp(1.0 - double(gpuBusyTicks) / double(lastGpuTick - firstGpuTick), 0.0, 1.0);
+            gpuIdle = ", GPU idle " + std::to_string(idle * 100.0) + "%";
+        }
+        exitCode = finishRun("GPU", blocksDone, wall, gpuIdle);
     }
 
     // --- Cleanup ---
+    vkDeviceWaitIdle(device);
+    vkDestroyQueryPool(device, queryPool, nullptr);
+    for (BlockSlot& slot : slots) {
+        vkDestroyFence(device, slot.fence, nullptr);
+        vkUnmapMemory(device, slot.resultMemory);
+        vkDestroyBuffer(device, slot.resultBuffer, nullptr);
+        vkFreeMemory(device, slot.resultMemory, nullptr);
+        vkUnmapMemory(device, slot.primeMemory);
+        vkDestroyBuffer(device, slot.primeBuffer, nullptr);
+        vkFreeMemory(device, slot.primeMemory, nullptr);
+        vkUnmapMemory(device, slot.groupCountMemory);
+        vkDestroyBuffer(device, slot.groupCountBuffer, nullptr);
+        vkFreeMemory(device, slot.groupCountMemory, nullptr);
+        vkUnmapMemory(device, slot.statsMemory);
+        vkDestroyBuffer(device, slot.statsBuffer, nullptr);
+        vkFreeMemory(device, slot.statsMemory, nullptr);
+        if (slot.bucketBuffer != VK_NULL_HANDLE) {
+            vkUnmapMemory(device, slot.bucketMemory);
+            vkDestroyBuffer(device, slot.bucketBuffer, nullptr);
+            vkFreeMemory(device, slot.bucketMemory, nullptr);
+        }
+    }
+    if (segmentPlan) {
+        vkDestroyBuffer(device, patternBuffer, nullptr);
+        vkFreeMemory(device, patternMemory, nullptr);
+        vkDestroyBuffer(device, mediumBuffer, nullptr);
+        vkFreeMemory(device, mediumMemory, nullptr);
+    }
     vkDestroyCommandPool(device, commandPool, nullptr);
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-    vkDestroyPipeline(device, computePipeline, nullptr);
+    for (VkPipeline pipeline : pipelines) vkDestroyPipeline(device, pipeline, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
-    vkDestroyShaderModule(device, computeShaderModule, nullptr);
-    vkDestroyBuffer(device, resultBuffer, nullptr);
-    vkFreeMemory(device, resultMemory, nullptr);
-    vkDestroyDevice(device, nullptr);
-    vkDestroyInstance(instance, nullptr);
+    for (VkShaderModule module : shaderModules) vkDestroyShaderModule(device, module, nullptr);
 
-    return 0;
+    return exitCode;
+}
+
+// Errors end the run with a message instead of std::terminate, including
+// a write error of the output thread, rethrown on this one.
+int main(int argc, char* argv[]) {
+    try {
+        return sieveMain(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
 }
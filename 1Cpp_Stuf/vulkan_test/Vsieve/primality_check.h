@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <random>
+
+#include "../common/primality64.h"
+
+/*
+ * Inputs and reference for --validate-primality. The reference is the
+ * plain twelve-base Miller-Rabin test (bases 2..37, deterministic below
+ * 3.3e24) on __int128 remainders, so it shares no arithmetic with the
+ * Montgomery code in Primality64 or the kernels.
+ *
+ * The inputs lean towards the numbers a cheap test gets wrong: strong
+ * pseudoprimes to base 2 and to the first few prime bases, strong Lucas
+ * pseudoprimes (both kinds also above 2^32 and on either side of 2^63,
+ * where the slow mulmod changes method), Carmichael numbers (some of them
+ * above 2^62), squares of primes and semiprimes with two large factors,
+ * plus random numbers of every bit length and the primes just below 2^64.
+ */
+
+struct PrimalityCase {
+    uint64_t n;
+    const char* kind;
+};
+
+inline const std::vector<PrimalityCase>& knownPseudoprimes() {
+    static const std::vector<PrimalityCase> cases = {
+        // Strong pseudoprimes to base 2.
+        {2047, "spsp(2)"}, {3277, "spsp(2)"}, {4033, "spsp(2)"}, {4681, "spsp(2)"}, {8321, "spsp(2)"},
+        {15841, "spsp(2)"}, {29341, "spsp(2)"}, {42799, "spsp(2)"}, {49141, "spsp(2)"}, {52633, "spsp(2)"},
+        // The first ones above 2^32, where the Lucas test takes over from bases 7 and 61.
+        {4294967297, "spsp(2)"}, {4297078001, "spsp(2)"}, {4297753027, "spsp(2)"}, {4304942281, "spsp(2)"},
+        // Smallest strong pseudoprimes to the first k prime bases.
+        {1373653, "spsp(2,3)"}, {25326001, "spsp(2..5)"}, {3215031751, "spsp(2..7)"}, {2152302898747, "spsp(2..11)"},
+        {3474749660383, "spsp(2..13)"}, {341550071728321, "spsp(2..17)"}, {3825123056546413051, "spsp(2..23)"},
+        // The first number above 2^32 that passes bases 2, 7 and 61.
+        {4759123141, "spsp(2,7,61)"},
+        // Strong Lucas pseudoprimes (Selfridge parameters).
+        {5459, "slpsp"}, {5777, "slpsp"}, {10877, "slpsp"}, {16109, "slpsp"}, {18971, "slpsp"},
+        {22499, "slpsp"}, {24569, "slpsp"}, {25199, "slpsp"}, {40309, "slpsp"}, {58519, "slpsp"},
+        // ... and p*q with q = k(p +- 1) +- 1 above 2^32, around 2^63 and just below 2^64.
+        {10674867419, "slpsp"}, {12780924281, "slpsp"}, {28554055919, "slpsp"}, {76922913763, "slpsp"},
+        {567610496777, "slpsp"}, {9333901003327334839ULL, "slpsp"}, {9655399490354711999ULL, "slpsp"},
+        {16642999804312340939ULL, "slpsp"}, {18360923537509280027ULL, "slpsp"},
+        // Carmichael numbers.
+        {561, "carmichael"}, {1105, "carmichael"}, {1729, "carmichael"}, {41041, "carmichael"}, {825265, "carmichael"},
+        {321197185, "carmichael"}, {5394826801, "carmichael"}, {232250619601, "carmichael"}, {9746347772161, "carmichael"},
+        // Chernick Carmichael numbers (6k+1)(12k+1)(18k+1) that are also spsp(2).
+        {4662697838094976681, "carmichael spsp(2)"}, {4694354915758208929, "carmichael spsp(2)"},
+        {4825217480940723241, "carmichael spsp(2)"}, {5178711013122746089, "carmichael spsp(2)"},
+        // p(2p - 1) with both factors prime and the product spsp(2).
+        {14093568681658486021ULL, "semiprime spsp(2)"}, {15007403944911933253ULL, "semiprime spsp(2)"},
+        {13671034648899134653ULL, "semiprime spsp(2)"}, {17414967196202207941ULL, "semiprime spsp(2)"},
+        // ... on either side of 2^63 and just below 2^64.
+        {9223346514029275981ULL, "semiprime spsp(2)"}, {9223367129855292781ULL, "semiprime spsp(2)"},
+        {9223378056252423253ULL, "semiprime spsp(2)"}, {9223393930463559421ULL, "semiprime spsp(2)"},
+        {18446725861112997001ULL, "semiprime spsp(2)"}, {18446743208455367653ULL, "semiprime spsp(2)"},
+        // Largest primes and the very top of the range.
+        {18446744073709551557ULL, "prime"}, {18446744073709551533ULL, "prime"}, {18446744073709551521ULL, "prime"},
+        {18446744073709551615ULL, "2^64-1"}, {4294967291, "prime"}, {4294967311, "prime"},
+    };
+    return cases;
+}
+
+inline bool referenceIsPrime(uint64_t n) {
+    static const uint64_t bases[12] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+    if (n < 2) return false;
+    for (uint64_t p : bases) {
+        if (n % p == 0) return n == p;
+    }
+    uint64_t d = n - 1;
+    int s = 0;
+    while ((d & 1) == 0) {
+        d >>= 1;
+        ++s;
+    }
+    auto mulMod = [n](uint64_t a, uint64_t b) { return uint64_t((unsigned __int128)a * b % n); };
+    for (uint64_t a : bases) {
+        uint64_t x = 1, base = a;
+        for (uint64_t e = d; e > 0; e >>= 1) {
+            if (e & 1) x = mulMod(x, base);
+            base = mulMod(base, base);
+        }
+        if (x == 1 || x == n - 1) continue;
+        bool passes = false;
+        for (int r = 1; r < s && !passes; ++r) {
+            x = mulMod(x, x);
+            passes = x == n - 1;
+        }
+        if (!passes) return false;
+    }
+    return true;
+}
+
+// The known cases followed by count random ones, the same for a given seed.
+inline std::vector<PrimalityCase> primalityCases(uint64_t count, uint64_t seed) {
+    std::vector<PrimalityCase> cases = knownPseudoprimes();
+    std::mt19937_64 rng(seed);
+    auto randomPrime = [&](int bits) {
+        for (;;) {
+            uint64_t p = (rng() >> (64 - bits)) | (uint64_t(1) << (bits - 1)) | 1;
+            if (referenceIsPrime(p)) return p;
+        }
+    };
+    for (uint64_t i = 0; i < count; ++i) {
+        switch (i % 4) {
+            case 0: cases.push_back({rng() | 1, "random"}); break;
+            case 1: cases.push_back({(rng() >> (rng() % 60)) | 1, "random"}); break;
+            case 2: cases.push_back({randomPrime(32) * randomPrime(31), "semiprime"}); break;
+            default: {
+                uint64_t p = randomPrime(32);
+                cases.push_back({p * p, "prime square"});
+                break;
+            }
+        }
+    }
+    return cases;
+}
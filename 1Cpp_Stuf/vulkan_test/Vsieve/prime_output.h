@@ -0,0 +1,335 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <exception>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "work_queue.h"
+
+/*
+ * Prime output subsystem. The sieve hands over one batch of primes per
+ * block; a dedicated I/O thread formats and writes them, so neither the
+ * GPU pipeline nor the readback thread ever waits on formatting or on the
+ * terminal. The batch queue is bounded, so a slow sink throttles the
+ * sieve instead of buffering without limit.
+ *
+ * Formats:
+ *  text  - one decimal prime per line.
+ *  gaps  - binary: the 8-byte magic "VSGAPS1\n", then one unsigned LEB128
+ *          varint per prime holding the difference to the previous prime
+ *          (the first value is the difference to 0). Gaps below 128 take
+ *          one byte, so a prime costs about 1 byte instead of ~20.
+ *  count - nothing per prime; the total is printed at the end.
+ *
+ * sync() makes everything queued so far durable and returns a WriterState
+ * that a later run can pass back in to continue the same output file.
+ *
+ * A write error on the I/O thread (a full disk, a closed pipe) stops the
+ * output there; the thread drains the rest of the queue unwritten and the
+ * next write(), sync() or finish() rethrows the error to its caller.
+ */
+
+enum class OutputFormat { Text, Gaps, Count };
+
+inline OutputFormat parseOutputFormat(const std::string& name) {
+    if (name == "text") return OutputFormat::Text;
+    if (name == "gaps") return OutputFormat::Gaps;
+    if (name == "count") return OutputFormat::Count;
+    throw std::runtime_error("Unknown output format: " + name + " (expected text, gaps or count)");
+}
+
+inline const char* outputFormatName(OutputFormat format) {
+    switch (format) {
+        case OutputFormat::Text: return "text";
+        case OutputFormat::Gaps: return "gaps";
+        case OutputFormat::Count: return "count";
+    }
+    return "?";
+}
+
+// Writes the decimal digits of v at out and returns the new end.
+inline char* formatUint64(char* out, uint64_t v) {
+    static const char digitPairs[201] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+    while (v >= 100) {
+        unsigned pair = unsigned(v % 100) * 2;
+        v /= 100;
+        *--p = digitPairs[pair + 1];
+        *--p = digitPairs[pair];
+    }
+    if (v >= 10) {
+        unsigned pair = unsigned(v) * 2;
+        *--p = digitPairs[pair + 1];
+        *--p = digitPairs[pair];
+    } else {
+        *--p = char('0' + v);
+    }
+    size_t len = tmp + sizeof(tmp) - p;
+    memcpy(out, p, len);
+    return out + len;
+}
+
+inline char* encodeVarint(char* out, uint64_t v) {
+    while (v >= 0x80) {
+        *out++ = char((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    *out++ = char(v);
+    return out;
+}
+
+// Where an output stream stood after the last sync().
+struct WriterState {
+    uint64_t primes = 0;      // primes written or counted
+    uint64_t lastPrime = 0;   // base of the next gap
+    uint64_t outputBytes = 0; // durable length of the output file
+};
+
+class PrimeWriter {
+public:
+    // path "-" writes to stdout. directIo opens the file with O_DIRECT and
+    // writes page-aligned chunks, bypassing the page cache. With resume the
+    // file is cut back to resume->outputBytes and appended to instead.
+    PrimeWriter(OutputFormat format, const std::string& path, bool directIo, size_t queueDepth = 8, const WriterState* resume = nullptr)
+        : format(format), batches(queueDepth), direct(directIo), path(path) {
+        if (resume) {
+            total = resume->primes;
+            previous = resume->lastPrime;
+        }
+        if (format != OutputFormat::Count) {
+            buffer = static_cast<char*>(aligned_alloc(ALIGNMENT, BUFFER_BYTES));
+            if (!buffer) throw std::runtime_error("Failed to allocate output buffer");
+            if (path == "-") {
+                if (direct) throw std::runtime_error("O_DIRECT output needs a file, not stdout");
+                fd = STDOUT_FILENO;
+                // A pipe cannot be rewound; the reader already has everything up to the sync.
+                if (resume) written = resume->outputBytes;
+            } else {
+                int flags = O_WRONLY | O_CREAT | (resume ? 0 : O_TRUNC);
+                fd = open(path.c_str(), flags, 0644);
+                if (fd < 0) throw std::runtime_error("Failed to open output file: " + path);
+                ownsFd = true;
+                if (resume) reopenAt(resume->outputBytes);
+                if (direct) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT);
+            }
+            if (format == OutputFormat::Gaps && !resume) {
+                memcpy(buffer, "VSGAPS1\n", 8);
+                used = 8;
+            }
+        }
+        ioThread = std::thread([this] { run(); });
+    }
+
+    // An error finish() would have rethrown is dropped here; call finish()
+    // to see it.
+    ~PrimeWriter() {
+        try {
+            finish();
+        } catch (...) {
+        }
+    }
+
+    // The readback thread can skip decoding the bitmap when nothing is written per prime.
+    bool wantsPrimes() const { return format != OutputFormat::Count; }
+
+    // Queues one block's primes, in increasing order. Blocks while the queue is full.
+    void write(std::vector<uint64_t> primes) {
+        rethrowError();
+        batches.push(Batch{std::move(primes), false});
+    }
+
+    // Waits until every batch queued so far is on disk (fdatasync'd) and
+    // returns the state to resume from.
+    WriterState sync() {
+        batches.push(Batch{{}, true});
+        std::unique_lock<std::mutex> lock(syncMutex);
+        uint64_t ticket = ++syncRequested;
+        syncDone.wait(lock, [&] { return syncCompleted >= ticket; });
+        if (error) std::rethrow_exception(error);
+        return syncedState;
+    }
+
+    // Count-only mode: record primes that were counted but not decoded.
+    void addCount(uint64_t n) { total += n; }
+
+    // Drains the queue, flushes and closes the sink, then rethrows the
+    // first write error if there was one. Safe to call twice.
+    void finish() {
+        if (!ioThread.joinable()) return;
+        batches.close();
+        ioThread.join();
+        std::exception_ptr failure = error;
+        if (format != OutputFormat::Count) {
+            if (!failure) {
+                try {
+                    flushTail();
+                } catch (...) {
+                    failure = std::current_exception();
+                }
+            }
+            if (ownsFd) close(fd);
+            free(buffer);
+            buffer = nullptr;
+        }
+        if (failure) std::rethrow_exception(failure);
+    }
+
+    uint64_t primesWritten() const { return total; }
+    uint64_t bytesWritten() const { return written; }
+
+private:
+    static const size_t ALIGNMENT = 4096;
+    static const size_t BUFFER_BYTES = 4 << 20;
+    static const size_t MAX_RECORD = 24; // longest text line or varint, with margin
+
+    struct Batch {
+        std::vector<uint64_t> primes;
+        bool sync;
+    };
+
+    void run() {
+        Batch batch;
+        bool failed = false;
+        while (batches.pop(batch)) {
+            // After an error the batches are dropped: write() must not block
+            // on a full queue and every sync() still has to return.
+            WriterState state;
+            if (!failed) {
+                try {
+                    if (batch.sync) state = durableState();
+                    else append(batch.primes);
+                } catch (...) {
+                    failed = true;
+                    std::lock_guard<std::mutex> lock(syncMutex);
+                    error = std::current_exception();
+                }
+            }
+            if (batch.sync) {
+                std::lock_guard<std::mutex> lock(syncMutex);
+                syncedState = state;
+                ++syncCompleted;
+                syncDone.notify_all();
+            }
+        }
+    }
+
+    void append(const std::vector<uint64_t>& primes) {
+        total += primes.size();
+        if (format == OutputFormat::Count) return;
+        for (uint64_t p : primes) {
+            if (used + MAX_RECORD > BUFFER_BYTES) flushAligned();
+            if (format == OutputFormat::Text) {
+                char* end = formatUint64(buffer + used, p);
+                *end++ = '\n';
+                used = end - buffer;
+            } else {
+                used = encodeVarint(buffer + used, p - previous) - buffer;
+            }
+            previous = p;
+        }
+    }
+
+    void rethrowError() {
+        std::lock_guard<std::mutex> lock(syncMutex);
+        if (error) std::rethrow_exception(error);
+    }
+
+    // Flushes what can be flushed and makes the logical end of the stream
+    // durable. With O_DIRECT the unaligned tail stays in the buffer for the
+    // next aligned write, so a copy of it goes through the page cache.
+    WriterState durableState() {
+        WriterState state;
+        state.primes = total;
+        state.lastPrime = previous;
+        if (format == OutputFormat::Count) return state;
+        flushAligned();
+        if (used > 0) {
+            if (ownsFd) {
+                int tailFd = open(path.c_str(), O_WRONLY);
+                bool ok = tailFd >= 0 && pwrite(tailFd, buffer, used, written) == ssize_t(used) && fdatasync(tailFd) == 0;
+                if (tailFd >= 0) close(tailFd);
+                if (!ok) throw std::runtime_error("Failed to write checkpoint tail: " + path);
+            } else {
+                writeAll(buffer, used); // stdout: not rewindable, so just write it out
+                used = 0;
+            }
+        }
+        if (ownsFd && fdatasync(fd) != 0) throw std::runtime_error("Failed to sync output file: " + path);
+        state.outputBytes = written + used;
+        return state;
+    }
+
+    // Cuts the file back to size bytes and positions the stream there. The
+    // unaligned tail is read back into the buffer so O_DIRECT can rewrite it.
+    void reopenAt(uint64_t size) {
+        if (ftruncate(fd, size) != 0) throw std::runtime_error("Failed to truncate output file: " + path);
+        uint64_t aligned = size / ALIGNMENT * ALIGNMENT;
+        used = size - aligned;
+        int readFd = open(path.c_str(), O_RDONLY);
+        if (readFd < 0 || pread(readFd, buffer, used, aligned) != ssize_t(used)) throw std::runtime_error("Failed to read back output tail: " + path);
+        close(readFd);
+        lseek(fd, aligned, SEEK_SET);
+        written = aligned;
+    }
+
+    // Writes the largest aligned prefix of the buffer and keeps the rest.
+    void flushAligned() {
+        size_t n = direct ? used / ALIGNMENT * ALIGNMENT : used;
+        writeAll(buffer, n);
+        memmove(buffer, buffer + n, used - n);
+        used -= n;
+    }
+
+    void flushTail() {
+        if (direct && used % ALIGNMENT != 0) {
+            // O_DIRECT cannot write a partial block; finish with buffered I/O.
+            flushAligned();
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            direct = false;
+        }
+        flushAligned();
+    }
+
+    void writeAll(const char* data, size_t n) {
+        while (n > 0) {
+            ssize_t r = ::write(fd, data, n);
+            if (r < 0) throw std::runtime_error("Failed to write prime output");
+            data += r;
+            n -= r;
+            written += r;
+        }
+    }
+
+    OutputFormat format;
+    WorkQueue<Batch> batches;
+    std::thread ioThread;
+    bool direct;
+    std::string path;
+    int fd = -1;
+    bool ownsFd = false;
+    char* buffer = nullptr;
+    size_t used = 0;
+    uint64_t previous = 0;
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> written{0};
+
+    std::mutex syncMutex;
+    std::condition_variable syncDone;
+    uint64_t syncRequested = 0, syncCompleted = 0;
+    WriterState syncedState;
+    std::exception_ptr error; // the first write error of the I/O thread
+};
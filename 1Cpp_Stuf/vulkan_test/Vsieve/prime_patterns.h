@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+/*
+ * Pattern searches that run straight on the odd-only block bitmaps (bit i
+ * is offset + 2*i + 1) instead of on a decoded prime list.
+ *
+ * k-tuples: an admissible pattern 0 = d_0 < d_1 < ... < d_{k-1} (all even)
+ * turns into bit shifts d_j / 2, so one 64-bit AND of the shifted words
+ * tests 64 candidate starts at once. The last few words of a block are
+ * kept until the next block arrives, so tuples that straddle a block
+ * boundary are found too.
+ *
+ * Gaps: the tracker carries the last prime across words and blocks. Two
+ * primes inside one word are at most 126 apart, so once the threshold is
+ * above that only the first and last set bit of every non-zero word
+ * matter and the scan is word by word.
+ *
+ * Blocks have to arrive in increasing, adjacent order; after a jump the
+ * search restarts as if the numbers in between were composite. The prime
+ * 2 is not in the bitmap and never takes part.
+ */
+
+struct TuplePattern {
+    const char* name;
+    std::vector<uint32_t> offsets;
+};
+
+// The densest admissible constellations up to six members.
+inline const std::vector<TuplePattern>& namedTuplePatterns() {
+    static const std::vector<TuplePattern> patterns = {
+        {"twin", {0, 2}},
+        {"cousin", {0, 4}},
+        {"sexy", {0, 6}},
+        {"triplet", {0, 2, 6}},
+        {"triplet2", {0, 4, 6}},
+        {"quadruplet", {0, 2, 6, 8}},
+        {"quintuplet", {0, 2, 6, 8, 12}},
+        {"quintuplet2", {0, 4, 6, 10, 12}},
+        {"sextuplet", {0, 4, 6, 10, 12, 16}},
+    };
+    return patterns;
+}
+
+// Accepts a pattern name or a comma-separated offset list such as "0,2,6,8".
+inline std::vector<uint32_t> parseTuplePattern(const std::string& spec) {
+    for (const TuplePattern& p : namedTuplePatterns()) {
+        if (spec == p.name) return p.offsets;
+    }
+    std::vector<uint32_t> offsets;
+    size_t pos = 0;
+    while (pos <= spec.size()) {
+        size_t comma = std::min(spec.find(',', pos), spec.size());
+        offsets.push_back(uint32_t(std::stoul(spec.substr(pos, comma - pos))));
+        pos = comma + 1;
+    }
+    if (offsets.size() < 2 || offsets[0] != 0) throw std::runtime_error("Tuple pattern " + spec + " must start at 0 and have two members or more");
+    for (size_t j = 1; j < offsets.size(); ++j) {
+        if (offsets[j] <= offsets[j - 1] || offsets[j] % 2 != 0) throw std::runtime_error("Tuple pattern " + spec + " needs even, increasing offsets");
+    }
+    // Admissible: no prime q <= k has every residue class mod q covered,
+    // otherwise some member is always a multiple of q.
+    for (uint32_t q = 3; q <= offsets.size(); q += 2) {
+        bool isPrime = true;
+        for (uint32_t f = 3; f * f <= q; f += 2) isPrime = isPrime && q % f != 0;
+        if (!isPrime) continue;
+        std::vector<bool> covered(q, false);
+        for (uint32_t d : offsets) covered[d % q] = true;
+        if (std::find(covered.begin(), covered.end(), false) == covered.end()) {
+            throw std::runtime_error("Tuple pattern " + spec + " is not admissible (covers every residue mod " + std::to_string(q) + ")");
+        }
+    }
+    return offsets;
+}
+
+class PatternSearch {
+public:
+    // Every start p with p + d prime for all d in offsets.
+    static PatternSearch tuples(std::vector<uint32_t> offsets) {
+        PatternSearch s;
+        s.kind = Kind::Tuples;
+        for (uint32_t d : offsets) s.shifts.push_back(d / 2);
+        s.lookahead = s.shifts.back() / 64 + 1;
+        return s;
+    }
+
+    // Every gap of at least minGap; with records only those that also beat
+    // every earlier gap of the run.
+    static PatternSearch gaps(uint64_t minGap, bool records) {
+        PatternSearch s;
+        s.kind = Kind::Gaps;
+        s.threshold = std::max<uint64_t>(minGap, 1);
+        s.records = records;
+        return s;
+    }
+
+    bool findsTuples() const { return kind == Kind::Tuples; }
+
+    // Scans one block whose in-range numbers are bits [skip, valid). For
+    // every match the first prime goes to firsts and, for gaps, the gap
+    // size to gapSizes. Returns the number of matches.
+    uint64_t scan(const uint64_t* bitmap, uint64_t offset, uint32_t blockWords, uint64_t skip, uint64_t valid,
+                  std::vector<uint64_t>& firsts, std::vector<uint64_t>* gapSizes = nullptr) {
+        size_t before = firsts.size();
+        if (started && offset != nextOffset) finish(firsts, gapSizes);
+        started = true;
+        nextOffset = offset + uint64_t(blockWords) * 128;
+
+        if (kind == Kind::Tuples) {
+            // window = the unscanned words of the previous block, then this block.
+            size_t pending = window.size();
+            window.resize(pending + blockWords);
+            for (uint32_t w = 0; w < blockWords; ++w) window[pending + w] = maskedWord(bitmap, w, skip, valid);
+            if (pending == 0) windowBase = offset;
+            if (window.size() > lookahead) scanWindow(window.size() - lookahead, firsts);
+        } else {
+            for (uint32_t w = 0; w < blockWords; ++w) {
+                uint64_t bits = maskedWord(bitmap, w, skip, valid);
+                if (bits != 0) scanGapWord(bits, offset + uint64_t(w) * 128, firsts, gapSizes);
+            }
+        }
+        return firsts.size() - before;
+    }
+
+    // Ends the stream: tuples that would need numbers past the last block
+    // are dropped and the gap tracker forgets its last prime.
+    uint64_t finish(std::vector<uint64_t>& firsts, std::vector<uint64_t>* = nullptr) {
+        size_t before = firsts.size();
+        if (kind == Kind::Tuples && !window.empty()) {
+            size_t words = window.size();
+            window.resize(words + lookahead, 0);
+            scanWindow(words, firsts);
+            window.clear();
+        }
+        lastPrime = 0;
+        started = false;
+        return firsts.size() - before;
+    }
+
+private:
+    enum class Kind { Tuples, Gaps };
+
+    static uint64_t maskedWord(const uint64_t* bitmap, uint32_t w, uint64_t skip, uint64_t valid) {
+        uint64_t lo = uint64_t(w) * 64;
+        if (lo >= valid || lo + 64 <= skip) return 0;
+        uint64_t bits = bitmap[w];
+        if (valid - lo < 64) bits &= (uint64_t(1) << (valid - lo)) - 1;
+        if (skip > lo) bits &= ~uint64_t(0) << (skip - lo);
+        return bits;
+    }
+
+    // 64 bits of the window starting at bit pos.
+    uint64_t bitsAt(uint64_t pos) const {
+        size_t w = pos / 64;
+        uint32_t sh = pos % 64;
+        return sh ? (window[w] >> sh) | (window[w + 1] << (64 - sh)) : window[w];
+    }
+
+    // Tests the starts in words [0, words) of the window and keeps the rest.
+    void scanWindow(size_t words, std::vector<uint64_t>& firsts) {
+        for (size_t w = 0; w < words; ++w) {
+            uint64_t match = window[w];
+            for (size_t j = 1; j < shifts.size() && match; ++j) match &= bitsAt(w * 64 + shifts[j]);
+            while (match) {
+                uint32_t bit = __builtin_ctzll(match);
+                match &= match - 1;
+                firsts.push_back(windowBase + 2 * (uint64_t(w) * 64 + bit) + 1);
+            }
+        }
+        window.erase(window.begin(), window.begin() + words);
+        windowBase += uint64_t(words) * 128;
+    }
+
+    // base is the number just below bit 0 of the word.
+    void scanGapWord(uint64_t bits, uint64_t base, std::vector<uint64_t>& firsts, std::vector<uint64_t>* gapSizes) {
+        if (threshold > 126) {
+            // No gap inside the word can qualify.
+            checkGap(base + 2 * __builtin_ctzll(bits) + 1, firsts, gapSizes);
+            lastPrime = base + 2 * (63 - __builtin_clzll(bits)) + 1;
+            return;
+        }
+        while (bits) {
+            uint32_t bit = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            uint64_t p = base + 2 * bit + 1;
+            checkGap(p, firsts, gapSizes);
+            lastPrime = p;
+        }
+    }
+
+    void checkGap(uint64_t p, std::vector<uint64_t>& firsts, std::vector<uint64_t>* gapSizes) {
+        if (lastPrime == 0 || p - lastPrime < threshold) return;
+        firsts.push_back(lastPrime);
+        if (gapSizes) gapSizes->push_back(p - lastPrime);
+        if (records) threshold = p - lastPrime + 1;
+    }
+
+    Kind kind = Kind::Tuples;
+    bool started = false;
+    uint64_t nextOffset = 0;
+
+    std::vector<uint32_t> shifts; // d_j / 2
+    size_t lookahead = 1;         // words needed past the last tested one
+    std::vector<uint64_t> window;
+    uint64_t windowBase = 0;      // number just below bit 0 of window[0]
+
+    uint64_t threshold = 1;
+    bool records = false;
+    uint64_t lastPrime = 0;
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <array>
+#include <algorithm>
+
+/*
+ * CPU prime-counting function pi(x) using the Meissel-Lehmer formula
+ *
+ *     pi(x) = phi(x, a) + a - 1 - P2(x, a),   a = pi(x^(1/3))
+ *
+ * phi(y, b) counts the integers <= y free of the first b primes; P2 counts
+ * the integers <= x with exactly two prime factors, both above p_a. Both
+ * only ever need pi(y) for y <= x^(2/3), which comes from an odd-only sieve
+ * with a running count every 64 bits. That table is the memory bound,
+ * about x^(2/3) / 8 bytes: 1e13 takes ~60 MB and a few seconds, 1e15
+ * over a gigabyte.
+ *
+ * Used by Vsieve to cross-check the GPU count and as a fast path when only
+ * pi(x) is wanted.
+ */
+
+class PrimePi {
+public:
+    uint64_t operator()(uint64_t x) {
+        if (x <= SMALL_LIMIT) {
+            buildTable(x, 0);
+            return pi(x);
+        }
+        uint64_t cbrtX = iroot(x, 3);
+        uint64_t sqrtX = iroot(x, 2);
+        // x / p for every p > x^(1/3) stays below x / cbrt(x), roughly x^(2/3).
+        buildTable(std::max(x / cbrtX, sqrtX) + 1, sqrtX);
+
+        uint64_t a = pi(cbrtX);
+        uint64_t b = pi(sqrtX);
+        uint64_t p2 = 0;
+        for (uint64_t i = a + 1; i <= b; ++i) {
+            p2 += pi(x / primes[i - 1]) - (i - 1);
+        }
+        return phi(x, a) + a - 1 - p2;
+    }
+
+    // Integer k-th root, exact for every 64-bit x.
+    static uint64_t iroot(uint64_t x, int k) {
+        uint64_t r = uint64_t(std::pow(double(x), 1.0 / k));
+        auto powFits = [&](uint64_t v) { // v^k <= x without overflow
+            uint64_t acc = 1;
+            for (int i = 0; i < k; ++i) {
+                if (v != 0 && acc > x / v) return false;
+                acc *= v;
+            }
+            return true;
+        };
+        while (r > 0 && !powFits(r)) --r;
+        while (powFits(r + 1)) ++r;
+        return r;
+    }
+
+private:
+    static const uint64_t SMALL_LIMIT = 1 << 20;
+    // phi(y, c) for c <= WHEEL_PRIMES is periodic in y with period 2*3*5*7*11*13.
+    static const int WHEEL_PRIMES = 6;
+    static const uint32_t WHEEL = 30030;
+
+    // Odd-only sieve of [0, limit]: bit i of bits stands for 2*i + 1, and
+    // counts[w] holds the number of set bits before word w. Also lists the
+    // primes up to primeLimit <= limit.
+    void buildTable(uint64_t limit, uint64_t primeLimit) {
+        tableLimit = limit;
+        uint64_t oddCount = limit / 2 + 1;
+        bits.assign((oddCount + 63) / 64, ~uint64_t(0));
+        bits[0] &= ~uint64_t(1); // 1 is not prime
+        if (oddCount % 64 != 0) bits.back() &= (uint64_t(1) << (oddCount % 64)) - 1;
+        for (uint64_t p = 3; p * p <= limit; p += 2) {
+            if (!(bits[p / 128] >> ((p / 2) % 64) & 1)) continue;
+            for (uint64_t m = p * p; m <= limit; m += 2 * p) {
+                bits[m / 128] &= ~(uint64_t(1) << ((m / 2) % 64));
+            }
+        }
+        counts.resize(bits.size());
+        uint64_t running = 0;
+        for (size_t w = 0; w < bits.size(); ++w) {
+            counts[w] = running;
+            running += __builtin_popcountll(bits[w]);
+        }
+
+        primes.clear();
+        if (primeLimit >= 2) primes.push_back(2);
+        for (uint64_t p = 3; p <= primeLimit; p += 2) {
+            if (bits[p / 128] >> ((p / 2) % 64) & 1) primes.push_back(p);
+        }
+        buildWheel();
+    }
+
+    // pi(n) for n <= tableLimit.
+    uint64_t pi(uint64_t n) const {
+        if (n < 2) return 0;
+        uint64_t i = (n - 1) / 2; // index of the largest odd number <= n
+        uint64_t w = i / 64;
+        uint64_t mask = (i % 64 == 63) ? ~uint64_t(0) : (uint64_t(1) << (i % 64 + 1)) - 1;
+        return 1 + counts[w] + __builtin_popcountll(bits[w] & mask);
+    }
+
+    void buildWheel() {
+        for (int c = 0; c <= WHEEL_PRIMES; ++c) {
+            wheel[c].assign(WHEEL + 1, 0);
+            for (uint32_t y = 1; y <= WHEEL; ++y) {
+                bool coprime = true;
+                for (int j = 0; j < c; ++j) coprime = coprime && (y % SMALL_PRIMES[j] != 0);
+                wheel[c][y] = wheel[c][y - 1] + (coprime ? 1 : 0);
+            }
+        }
+    }
+
+    // phi(y, b) = phi(y, b - 1) - phi(y / p_b, b - 1), unrolled over b.
+    uint64_t phi(uint64_t y, uint64_t b) const {
+        if (b <= WHEEL_PRIMES) {
+            return (y / WHEEL) * wheel[b][WHEEL] + wheel[b][y % WHEEL];
+        }
+        // Below p_{b+1}^2 the survivors are 1 and the primes in (p_b, y].
+        if (y <= tableLimit && b < primes.size() && y < primes[b] * primes[b]) {
+            uint64_t piY = pi(y);
+            return piY > b ? piY - b + 1 : 1;
+        }
+        uint64_t result = phi(y, WHEEL_PRIMES);
+        for (uint64_t i = WHEEL_PRIMES + 1; i <= b; ++i) {
+            uint64_t p = primes[i - 1];
+            uint64_t q = y / p;
+            if (q < p) {
+                // phi(q, i - 1) == 1 for this and every later prime.
+                result -= b - i + 1;
+                break;
+            }
+            result -= phi(q, i - 1);
+        }
+        return result;
+    }
+
+    static constexpr uint32_t SMALL_PRIMES[WHEEL_PRIMES] = {2, 3, 5, 7, 11, 13};
+
+    uint64_t tableLimit = 0;
+    std::vector<uint64_t> bits;
+    std::vector<uint64_t> counts;
+    std::vector<uint64_t> primes; // every prime <= sqrt(x)
+    std::array<std::vector<uint32_t>, WHEEL_PRIMES + 1> wheel;
+};
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+/*
+ * Distribution statistics of all primes in a run, for --stats: the gap
+ * histogram, the counts by residue mod 840 (every modulus dividing 840 =
+ * lcm(3, 4, 5, 7, 8) follows from it) and two Chebyshev races,
+ * pi(x; 4, 3) - pi(x; 4, 1) and pi(x; 3, 2) - pi(x; 3, 1).
+ *
+ * Whole blocks arrive as the output of stats.comp (DEVICE_WORDS words:
+ * count, first and last bit index, then the histograms, with every gap
+ * that lies inside the block); the blocks at the edges of the range and
+ * the CPU backend hand over their bitmap instead. Either way only the gap
+ * from the last prime of one block to the first of the next is left, and
+ * it is added here when the blocks are adjacent. The races are sampled
+ * at every block end, so "behind" counts block ends, not primes.
+ *
+ * text() lists only non-zero bins and load() reads it back: a checkpoint
+ * carries it, so a resumed run keeps its statistics across restarts.
+ */
+
+class PrimeStats {
+public:
+    static const uint32_t GAP_BINS = 1024;       // bin k holds gap 2k; bin 0 the gap 1 from 2 to 3
+    static const uint32_t RESIDUE_MODULUS = 840;
+    static const uint32_t HEADER_WORDS = 4;      // count, first bit, last bit, padding
+    static const uint32_t DEVICE_WORDS = HEADER_WORDS + GAP_BINS + RESIDUE_MODULUS / 2; // odd residues only
+    static const uint32_t NO_PRIME = 0xFFFFFFFFu; // first bit of a block without primes
+
+    PrimeStats() : gaps(GAP_BINS, 0), residues(RESIDUE_MODULUS, 0) {}
+
+    // One block of stats.comp output; the block lies entirely in the range.
+    void addDevice(const uint32_t* words, uint64_t offset, uint32_t blockSize, bool withTwo) {
+        beginBlock(offset);
+        std::vector<uint64_t> blockResidues(RESIDUE_MODULUS, 0);
+        if (withTwo) addPrime(2, blockResidues);
+        if (words[0] != 0) {
+            joinGap(offset + 2 * uint64_t(words[1]) + 1);
+            for (uint32_t k = 1; k < GAP_BINS; ++k) gaps[k] += words[HEADER_WORDS + k];
+            for (uint32_t r = 0; r < RESIDUE_MODULUS / 2; ++r) blockResidues[2 * r + 1] += words[HEADER_WORDS + GAP_BINS + r];
+            primes += words[0];
+            lastPrime = previous = offset + 2 * uint64_t(words[2]) + 1;
+        }
+        endBlock(offset, blockSize, blockResidues);
+    }
+
+    // One block bitmap whose numbers in range are bits [skip, valid).
+    void addBitmap(const uint64_t* bitmap, uint64_t offset, uint32_t blockSize, uint64_t skip, uint64_t valid, bool withTwo) {
+        beginBlock(offset);
+        std::vector<uint64_t> blockResidues(RESIDUE_MODULUS, 0);
+        if (withTwo) addPrime(2, blockResidues);
+        for (uint64_t w = skip / 64; w * 64 < valid; ++w) {
+            uint64_t bits = bitmap[w];
+            if (valid - w * 64 < 64) bits &= (uint64_t(1) << (valid - w * 64)) - 1;
+            if (skip > w * 64) bits &= ~uint64_t(0) << (skip - w * 64);
+            while (bits) {
+                uint32_t bit = __builtin_ctzll(bits);
+                bits &= bits - 1;
+                addPrime(offset + 2 * (w * 64 + bit) + 1, blockResidues);
+            }
+        }
+        endBlock(offset, blockSize, blockResidues);
+    }
+
+    uint64_t primeCount() const { return primes; }
+    uint64_t blockCount() const { return blocks; }
+
+    // The stats file: a report, and what a checkpoint keeps to resume from.
+    std::string text(const std::string& range) const {
+        std::ostringstream text;
+        text << "# Vsieve prime statistics\nrange=" << range << "\nblocks=" << blocks << "\nprimes=" << primes
+             << "\nfirst_prime=" << firstPrime << "\nlast_prime=" << lastPrime << "\nnext_offset=" << nextOffset;
+        uint32_t maxGap = 0;
+        for (uint32_t k = 0; k < GAP_BINS; ++k) {
+            if (gaps[k] != 0) maxGap = std::max<uint32_t>(maxGap, k == 0 ? 1 : 2 * k);
+        }
+        text << "\nmax_gap=" << maxGap << "\n";
+        race(text, "chebyshev_4", "3 vs 1 mod 4", race4);
+        race(text, "chebyshev_3", "2 vs 1 mod 3", race3);
+        // Derived counts for the usual small moduli; only mod840 is read back.
+        for (uint32_t m : {3u, 4u, 5u, 6u, 7u, 8u, 10u, 12u, 30u}) {
+            std::vector<uint64_t> byClass(m, 0);
+            for (uint32_t r = 0; r < RESIDUE_MODULUS; ++r) byClass[r % m] += residues[r];
+            text << "mod" << m;
+            for (uint32_t r = 0; r < m; ++r) {
+                if (byClass[r] != 0) text << " " << r << ":" << byClass[r];
+            }
+            text << "\n";
+        }
+        for (uint32_t r = 0; r < RESIDUE_MODULUS; ++r) {
+            if (residues[r] != 0) text << "mod840 " << r << " " << residues[r] << "\n";
+        }
+        for (uint32_t k = 0; k < GAP_BINS; ++k) {
+            if (gaps[k] != 0) text << "gap " << (k == 0 ? 1 : 2 * k) << " " << gaps[k] << "\n";
+        }
+        return text.str();
+    }
+
+    // Reads text() back; throws if it belongs to another range.
+    void load(std::istream& file, const std::string& range) {
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            std::string key;
+            fields >> key;
+            size_t eq = key.find('=');
+            std::string value = eq == std::string::npos ? "" : key.substr(eq + 1);
+            key = key.substr(0, eq);
+            if (key == "range") {
+                std::string full = line.substr(line.find('=') + 1);
+                if (full != range) throw std::runtime_error("Statistics belong to a different run (" + full + ")");
+            } else if (key == "blocks") blocks = std::stoull(value);
+            else if (key == "primes") primes = std::stoull(value);
+            else if (key == "first_prime") firstPrime = std::stoull(value);
+            else if (key == "last_prime") lastPrime = previous = std::stoull(value);
+            else if (key == "next_offset") nextOffset = std::stoull(value);
+            else if (key == "chebyshev_4") loadRace(fields, race4);
+            else if (key == "chebyshev_3") loadRace(fields, race3);
+            else if (key == "mod840") {
+                uint32_t r;
+                fields >> r >> residues.at(r);
+            } else if (key == "gap") {
+                uint32_t g;
+                fields >> g;
+                fields >> gaps.at(g / 2);
+            }
+        }
+    }
+
+private:
+    struct Race {
+        int64_t lead = 0; // leader minus the other class
+        int64_t maxLead = 0, minLead = 0;
+        uint64_t samples = 0, behind = 0; // block ends, and those where lead <= 0
+    };
+
+    void addPrime(uint64_t p, std::vector<uint64_t>& blockResidues) {
+        joinGap(p);
+        ++blockResidues[p % RESIDUE_MODULUS];
+        ++primes;
+        lastPrime = previous = p;
+    }
+
+    // After a jump (an interleaved shard) the gaps start over.
+    void beginBlock(uint64_t offset) {
+        if (offset != nextOffset) previous = 0;
+    }
+
+    // The gap from the previous prime of the chain, if there is one.
+    void joinGap(uint64_t p) {
+        if (firstPrime == 0) firstPrime = p;
+        if (previous != 0) gaps[std::min<uint64_t>((p - previous) / 2, GAP_BINS - 1)] += 1;
+    }
+
+    void endBlock(uint64_t offset, uint32_t blockSize, const std::vector<uint64_t>& blockResidues) {
+        nextOffset = offset + blockSize;
+        ++blocks;
+        for (uint32_t r = 0; r < RESIDUE_MODULUS; ++r) residues[r] += blockResidues[r];
+
+        int64_t mod4[4] = {}, mod3[3] = {};
+        for (uint32_t r = 0; r < RESIDUE_MODULUS; ++r) {
+            mod4[r % 4] += int64_t(blockResidues[r]);
+            mod3[r % 3] += int64_t(blockResidues[r]);
+        }
+        step(race4, mod4[3] - mod4[1]);
+        step(race3, mod3[2] - mod3[1]);
+    }
+
+    static void step(Race& race, int64_t delta) {
+        race.lead += delta;
+        race.maxLead = race.samples == 0 ? race.lead : std::max(race.maxLead, race.lead);
+        race.minLead = race.samples == 0 ? race.lead : std::min(race.minLead, race.lead);
+        ++race.samples;
+        if (race.lead <= 0) ++race.behind;
+    }
+
+    static void race(std::ostringstream& text, const char* key, const char* what, const Race& r) {
+        text << key << " lead=" << r.lead << " max=" << r.maxLead << " min=" << r.minLead << " samples=" << r.samples
+             << " behind=" << r.behind << " # " << what << ", sampled at block ends\n";
+    }
+
+    static void loadRace(std::istringstream& fields, Race& r) {
+        std::string field;
+        while (fields >> field && field != "#") {
+            size_t eq = field.find('=');
+            if (eq == std::string::npos) continue;
+            std::string name = field.substr(0, eq);
+            int64_t value = std::stoll(field.substr(eq + 1));
+            if (name == "lead") r.lead = value;
+            else if (name == "max") r.maxLead = value;
+            else if (name == "min") r.minLead = value;
+            else if (name == "samples") r.samples = uint64_t(value);
+            else if (name == "behind") r.behind = uint64_t(value);
+        }
+    }
+
+    std::vector<uint64_t> gaps, residues;
+    uint64_t blocks = 0, primes = 0;
+    uint64_t firstPrime = 0, lastPrime = 0;
+    uint64_t previous = 0; // last prime of the current gap chain, 0 after a jump
+    uint64_t nextOffset = 0;
+    Race race4, race3;
+};
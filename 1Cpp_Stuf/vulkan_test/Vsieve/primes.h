@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <thread>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+#include "range_plan.h"
+#include "cpu_sieve.h"
+#include "prime_pi.h"
+#include "../common/vk_context.h"
+#include "gpu_sieve.h"
+
+/*
+ * Library front end of Vsieve: the primes of [lo, hi) as a lazy range.
+ *
+ *     for (uint64_t p : primes(lo, hi)) ...
+ *     uint64_t n = primes(lo, hi).count();
+ *
+ * Nothing is sieved until the range is first iterated or counted. Then
+ * the blocks are produced ahead of the reader, by GpuSieve (up to
+ * inFlight blocks queued) or by the CpuSieve workers, and the iterator
+ * decodes the primes straight out of the block bitmap the engine hands
+ * over, in mapped device memory for the GPU. No prime list is built.
+ *
+ * A PrimeRange is a single pass, like an input stream: iterating it or
+ * counting it uses it up. count() skips the sieve for long ranges below
+ * PI_LIMIT and takes pi(hi - 1) - pi(lo - 1) from PrimePi instead.
+ *
+ * Backend::Auto takes the GPU when a device and sieve.spv are there and
+ * falls back to the CPU otherwise; backendName() tells which one it was.
+ */
+
+struct SieveOptions {
+    enum class Backend { Auto, Gpu, Cpu };
+    Backend backend = Backend::Auto;
+    uint32_t blockSize = 1 << 20;   // numbers per block, a multiple of 512
+    uint32_t inFlight = 4;          // GPU blocks queued ahead of the reader
+    unsigned threads = 0;           // CPU workers, 0 = one per core
+    std::string shaderPath = "sieve.spv";
+    std::string device;             // GPU selector, as --device: index, part of the name or UUID
+};
+
+class PrimeRange {
+public:
+    // count() asks PrimePi when hi <= PI_LIMIT and the range is at least PI_MIN_SPAN long.
+    static const uint64_t PI_LIMIT = 10000000000000ULL; // 1e13, a ~60 MB table
+    static const uint64_t PI_MIN_SPAN = uint64_t(1) << 30;
+
+    PrimeRange(uint64_t lo, uint64_t hi, SieveOptions options = {}) : lo(lo), hi(hi), options(std::move(options)) {
+        if (this->options.blockSize < 512 || this->options.blockSize % 512 != 0) {
+            throw std::runtime_error("PrimeRange: block size must be a multiple of 512");
+        }
+        // A short range does not need a whole default block.
+        if (hi > lo) {
+            uint32_t fit = 512;
+            while (fit < this->options.blockSize && fit < hi - lo) fit *= 2;
+            this->options.blockSize = std::min(this->options.blockSize, fit);
+        }
+    }
+
+    PrimeRange(PrimeRange&&) = default;
+    PrimeRange(const PrimeRange&) = delete;
+    PrimeRange& operator=(const PrimeRange&) = delete;
+
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = uint64_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const uint64_t*;
+        using reference = const uint64_t&;
+
+        iterator() = default;
+        const uint64_t& operator*() const { return prime; }
+        iterator& operator++() {
+            if (!range->advance(prime)) range = nullptr;
+            return *this;
+        }
+        // Post-increment of an input iterator: the copy only keeps the value.
+        iterator operator++(int) {
+            iterator before = *this;
+            ++*this;
+            return before;
+        }
+        bool operator==(const iterator& other) const { return range == other.range; }
+        bool operator!=(const iterator& other) const { return range != other.range; }
+
+    private:
+        friend class PrimeRange;
+        explicit iterator(PrimeRange* range) : range(range) { ++*this; }
+        PrimeRange* range = nullptr;
+        uint64_t prime = 0;
+    };
+
+    iterator begin() {
+        if (used) throw std::runtime_error("PrimeRange is single-pass and was already read");
+        used = true;
+        return iterator(this);
+    }
+    iterator end() { return iterator(); }
+
+    // Number of primes in [lo, hi).
+    uint64_t count() {
+        if (used) throw std::runtime_error("PrimeRange is single-pass and was already read");
+        used = true;
+        if (hi <= lo) return 0;
+        if (hi <= PI_LIMIT && hi - lo >= PI_MIN_SPAN) {
+            PrimePi pi;
+            uint64_t below = lo <= 2 ? 0 : pi(lo - 1);
+            return pi(hi - 1) - below;
+        }
+        uint64_t found = 0;
+        while (nextBlock()) {
+            if (hasTwo) ++found;
+            for (uint32_t w = 0; w < words; ++w) found += __builtin_popcountll(word(w));
+        }
+        return found;
+    }
+
+    // "gpu" or "cpu" once the range has started, "" before.
+    const char* backendName() const { return gpu ? "gpu" : cpu ? "cpu" : ""; }
+
+private:
+    // Starts the engine on the first block.
+    void start() {
+        started = true;
+        if (hi <= lo) return;
+        plan = RangePlan(lo, hi - 1, options.blockSize, 0, 1, false);
+        auto offsetOf = [plan = plan](uint64_t k) { return plan.blockOffset(k); };
+        if (options.backend != SieveOptions::Backend::Cpu) {
+            try {
+                vulkan.reset(new VulkanContext(options.device, "Sieve"));
+                gpu.reset(new GpuSieve(*vulkan, options.blockSize, plan.blockCount(), offsetOf, options.inFlight, 256, options.shaderPath));
+            } catch (const std::exception&) {
+                gpu.reset();
+                vulkan.reset();
+                if (options.backend == SieveOptions::Backend::Gpu) throw;
+            }
+        }
+        if (!gpu) {
+            unsigned threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+            cpu.reset(new CpuSieve(threads, options.blockSize, plan.blockCount(), offsetOf));
+        }
+    }
+
+    // Moves to the next block and sets up its edge masks; false at the end.
+    bool nextBlock() {
+        if (!started) start();
+        if (!gpu && !cpu) return false;
+        bool more = gpu ? gpu->next(offset, bitmap) : cpu->next(offset, bitmap);
+        if (!more) return false;
+        uint64_t limit = hi - 1;
+        valid = options.blockSize / 2;
+        if (limit - offset < options.blockSize - 1) valid = (limit - offset + 1) / 2;
+        skip = lo > offset ? std::min<uint64_t>((lo - offset) / 2, valid) : 0;
+        words = uint32_t((valid + 63) / 64);
+        hasTwo = offset == 0 && lo <= 2 && hi > 2; // 2 is not in the odd-only bitmap
+        return true;
+    }
+
+    // Word w of the current block, without the numbers outside [lo, hi).
+    uint64_t word(uint32_t w) const {
+        uint64_t bits = bitmap[w];
+        uint64_t first = uint64_t(w) * 64;
+        if (valid - first < 64) bits &= (uint64_t(1) << (valid - first)) - 1;
+        if (skip > first) bits &= skip - first >= 64 ? 0 : ~uint64_t(0) << (skip - first);
+        return bits;
+    }
+
+    // The next prime of the range into p; false after the last one.
+    bool advance(uint64_t& p) {
+        while (bits == 0) {
+            if (bitmap != nullptr && wordIndex + 1 < words) {
+                bits = word(++wordIndex);
+                continue;
+            }
+            if (!nextBlock()) return false;
+            wordIndex = 0;
+            bits = words != 0 ? word(0) : 0;
+            if (hasTwo) {
+                hasTwo = false;
+                p = 2;
+                return true;
+            }
+        }
+        uint32_t bit = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        p = offset + 2 * (uint64_t(wordIndex) * 64 + bit) + 1;
+        return true;
+    }
+
+    uint64_t lo, hi;
+    SieveOptions options;
+    RangePlan plan;
+    bool used = false, started = false;
+
+    std::unique_ptr<VulkanContext> vulkan;
+    std::unique_ptr<GpuSieve> gpu;
+    std::unique_ptr<CpuSieve> cpu;
+
+    // The block being read.
+    uint64_t offset = 0;
+    const uint64_t* bitmap = nullptr;
+    uint64_t skip = 0, valid = 0;
+    uint32_t words = 0, wordIndex = 0;
+    uint64_t bits = 0;
+    bool hasTwo = false;
+};
+
+// The primes p with lo <= p < hi.
+inline PrimeRange primes(uint64_t lo, uint64_t hi, SieveOptions options = {}) {
+    return PrimeRange(lo, hi, std::move(options));
+}
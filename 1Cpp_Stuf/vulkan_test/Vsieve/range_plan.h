@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+/*
+ * Which blocks one Vsieve run covers. Blocks sit on a fixed grid of
+ * blockSize-aligned offsets, so every machine agrees on what "block k"
+ * is; [start, limit] is widened to whole blocks here and the edges are
+ * masked when the results are read back.
+ *
+ * A shard i of N either takes every N-th block (interleaved, which keeps
+ * the load even without an end) or one contiguous slice of the range.
+ */
+
+struct RangePlan {
+    uint64_t start = 0;
+    uint64_t limit = UINT64_MAX; // last number, inclusive
+    uint32_t blockSize = 0;
+    uint64_t shard = 0, shards = 1;
+    bool contiguous = false;
+
+    RangePlan() = default;
+    RangePlan(uint64_t start, uint64_t limit, uint32_t blockSize, uint64_t shard, uint64_t shards, bool contiguous)
+        : start(start), limit(limit), blockSize(blockSize), shard(shard), shards(shards), contiguous(contiguous) {
+        if (limit < start) throw std::runtime_error("Empty range: --end must be above --start");
+        if (shards == 0 || shard >= shards) throw std::runtime_error("Shard index must be below the shard count");
+        if (contiguous && limit == UINT64_MAX) throw std::runtime_error("Contiguous sharding needs --end");
+        firstBlock = start / blockSize;
+        // The last block has to end inside 64 bits.
+        lastBlock = std::min(limit / blockSize, (UINT64_MAX - blockSize + 1) / blockSize);
+        uint64_t total = lastBlock - firstBlock + 1;
+        if (contiguous) {
+            uint64_t base = total / shards, extra = total % shards;
+            shardFirst = firstBlock + base * shard + std::min(shard, extra);
+            shardCount = base + (shard < extra ? 1 : 0);
+        } else {
+            shardFirst = firstBlock + shard;
+            shardCount = (shard < total) ? (total - shard - 1) / shards + 1 : 0;
+        }
+    }
+
+    uint64_t blockCount() const { return shardCount; }
+
+    // Offset of the k-th block of this shard, k < blockCount().
+    uint64_t blockOffset(uint64_t k) const {
+        uint64_t block = contiguous ? shardFirst + k : shardFirst + k * shards;
+        return block * blockSize;
+    }
+
+    // True when the block also holds numbers outside [start, limit].
+    bool isPartial(uint64_t offset) const {
+        return offset < start || limit - offset < blockSize - 1;
+    }
+
+    // Identifies the run in a checkpoint, so a resume cannot pick up a different range.
+    std::string describe() const {
+        return "start=" + std::to_string(start) + " limit=" + std::to_string(limit) + " block=" + std::to_string(blockSize) +
+               " shard=" + std::to_string(shard) + "/" + std::to_string(shards) + (contiguous ? " contiguous" : " interleaved");
+    }
+
+private:
+    uint64_t firstBlock = 0, lastBlock = 0;
+    uint64_t shardFirst = 0, shardCount = 0;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+
+/*
+ * Host side of segment.comp, the shared-memory Eratosthenes kernel behind
+ * --kernel segment. Each workgroup owns one segment of SEGMENT_WORDS
+ * 32-bit words of a block, in the same odd-only layout as sieve.comp,
+ * and the primes reach it three ways:
+ *  - 3..19 through the pattern: bit q is set when 2q + 1 is coprime to
+ *    3*5*7*11*13*17*19, tiled into the segment instead of crossed off;
+ *    23..61 are folded into the same pass, one word at a time.
+ *  - medium primes (67 up to the segment span): uploaded once, one prime
+ *    per invocation, crossing off with a stride of p bits.
+ *  - large primes (at most one hit per segment): their hits in a block
+ *    are listed here before the block is submitted, bucketed by segment.
+ *
+ * The large-prime list costs one division per prime and block, so the
+ * kernel is meant for ranges up to MAX_TOP; above that the per-block
+ * setup outgrows the sieve and the Miller-Rabin kernel is the better fit.
+ */
+
+class SegmentPlan {
+public:
+    static const uint32_t PATTERN_PERIOD = 4849845; // 3*5*7*11*13*17*19 odd numbers
+    static const uint32_t MAX_SEGMENT_WORDS = 4096;  // 16 KB, the shared memory every device has
+    static constexpr uint64_t MAX_TOP = uint64_t(1) << 50;
+
+    // top is the last number any block will hold.
+    SegmentPlan(uint64_t top, uint32_t oddPerBlock) : oddPerBlock(oddPerBlock) {
+        if (top > MAX_TOP) throw std::runtime_error("--kernel segment covers numbers up to 2^50; use the default kernel above that");
+        segmentWords = std::min(MAX_SEGMENT_WORDS, oddPerBlock / 32);
+        if (segmentWords == 0 || oddPerBlock % (segmentWords * 32) != 0) {
+            throw std::runtime_error("--kernel segment needs a block size that is a multiple of " + std::to_string(2 * 32 * MAX_SEGMENT_WORDS));
+        }
+
+        // bit q of the pattern is 2q + 1; one period plus a word to read across its end.
+        pattern.assign((PATTERN_PERIOD + 63) / 32 + 1, 0);
+        for (uint32_t q = 0; q < PATTERN_PERIOD + 64; ++q) {
+            uint32_t n = 2 * (q % PATTERN_PERIOD) + 1;
+            if (n % 3 && n % 5 && n % 7 && n % 11 && n % 13 && n % 17 && n % 19) pattern[q / 32] |= 1u << (q % 32);
+        }
+
+        uint64_t root = uint64_t(std::sqrt(double(top)));
+        while (root * root > top) --root;
+        while ((root + 1) * (root + 1) <= top) ++root;
+        std::vector<bool> composite(root / 2 + 1, false); // odd numbers only
+        for (uint64_t i = 3; i <= root; i += 2) {
+            if (composite[i / 2]) continue;
+            for (uint64_t m = i * i; m <= root; m += 2 * i) composite[m / 2] = true;
+            if (i < 67) continue;
+            if (i < segmentBits()) {
+                medium.push_back(uint32_t(i));
+            } else {
+                large.push_back(uint32_t(i));
+                capacity += oddPerBlock / i + 1;
+            }
+        }
+        // The kernel binds the list even when it is empty.
+        if (medium.empty()) medium.push_back(UINT32_MAX);
+    }
+
+    uint32_t segmentWordCount() const { return segmentWords; }
+    uint32_t segmentBits() const { return segmentWords * 32; }
+    uint32_t segments() const { return oddPerBlock / segmentBits(); }
+
+    const std::vector<uint32_t>& patternWords() const { return pattern; }
+    const std::vector<uint32_t>& mediumPrimes() const { return medium; }
+
+    // Bucket buffer: segments() + 1 start indices, then the bit of every
+    // hit within its segment, grouped by segment.
+    size_t bucketWords() const { return segments() + 1 + capacity; }
+
+    // Lists the large-prime hits of the block at offset into out.
+    void fillBuckets(uint64_t offset, uint32_t* out) {
+        const uint64_t firstIndex = offset / 2; // bit 0 is 2 * firstIndex + 1
+        const uint64_t blockHi = offset + 2 * uint64_t(oddPerBlock) - 1;
+        hits.clear();
+        for (uint32_t p : large) {
+            if (uint64_t(p) * p > blockHi) break;
+            uint64_t square = (uint64_t(p) * p - 1) / 2;
+            uint64_t j = square >= firstIndex ? square - firstIndex : ((p - 1) / 2 + p - firstIndex % p) % p;
+            for (; j < oddPerBlock; j += p) hits.push_back(uint32_t(j));
+        }
+
+        const uint32_t segs = segments(), bits = segmentBits();
+        std::fill(out, out + segs + 1, 0);
+        for (uint32_t j : hits) ++out[j / bits + 1];
+        for (uint32_t s = 0; s < segs; ++s) out[s + 1] += out[s];
+        cursor.assign(out, out + segs);
+        uint32_t* entries = out + segs + 1;
+        for (uint32_t j : hits) entries[cursor[j / bits]++] = j % bits;
+    }
+
+private:
+    uint32_t oddPerBlock;
+    uint32_t segmentWords = MAX_SEGMENT_WORDS;
+    std::vector<uint32_t> pattern;
+    std::vector<uint32_t> medium, large;
+    size_t capacity = 0; // most hits any block can have
+    std::vector<uint32_t> hits, cursor;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+/*
+ * Per-device results of --autotune. One line per device, keyed by the
+ * Vulkan device UUID so a machine with several GPUs (or a driver that
+ * changes the UUID) keeps separate entries:
+ *
+ *   <uuid> block=2097152 local=128 in_flight=4 mnums=812.5 device=<name>
+ *
+ * Runs on a device with an entry start from it unless --block-size,
+ * --local-size or --in-flight override it.
+ */
+
+struct TunedShape {
+    uint32_t blockSize = 0;
+    uint32_t localSize = 0;
+    uint32_t inFlight = 0;
+    double mnumsPerSecond = 0.0;
+};
+
+inline std::string uuidString(const uint8_t* uuid, size_t size) {
+    static const char hex[] = "0123456789abcdef";
+    std::string s;
+    for (size_t i = 0; i < size; ++i) {
+        s += hex[uuid[i] >> 4];
+        s += hex[uuid[i] & 15];
+    }
+    return s;
+}
+
+// Returns false when the cache has no entry for the device.
+inline bool loadTunedShape(const std::string& path, const std::string& uuid, TunedShape& shape) {
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string key, field;
+        if (!(fields >> key) || key != uuid) continue;
+        while (fields >> field) {
+            size_t eq = field.find('=');
+            if (eq == std::string::npos) continue;
+            std::string name = field.substr(0, eq), value = field.substr(eq + 1);
+            if (name == "block") shape.blockSize = uint32_t(std::stoul(value));
+            else if (name == "local") shape.localSize = uint32_t(std::stoul(value));
+            else if (name == "in_flight") shape.inFlight = uint32_t(std::stoul(value));
+            else if (name == "mnums") shape.mnumsPerSecond = std::stod(value);
+            else if (name == "device") break; // the name may contain spaces
+        }
+        return shape.blockSize != 0 && shape.localSize != 0 && shape.inFlight != 0;
+    }
+    return false;
+}
+
+// Replaces the device's entry and keeps every other line.
+inline void saveTunedShape(const std::string& path, const std::string& uuid, const TunedShape& shape, const std::string& deviceName) {
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.compare(0, uuid.size(), uuid) != 0) lines.push_back(line);
+        }
+    }
+    std::ostringstream entry;
+    entry << uuid << " block=" << shape.blockSize << " local=" << shape.localSize << " in_flight=" << shape.inFlight
+          << " mnums=" << shape.mnumsPerSecond << " device=" << deviceName;
+    lines.push_back(entry.str());
+
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::trunc);
+        for (const std::string& line : lines) file << line << "\n";
+        if (!file) throw std::runtime_error("Failed to write tuning cache: " + tmp);
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) throw std::runtime_error("Failed to write tuning cache: " + path);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// Blocking FIFO shared between the Vsieve threads. A capacity of 0 means
+// unbounded; otherwise push() blocks while the queue is full, which is how
+// a slow consumer applies back-pressure to its producer.
+template <typename T>
+class WorkQueue {
+public:
+    explicit WorkQueue(size_t capacity = 0) : capacity(capacity) {}
+
+    void push(T item) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            notFull.wait(lock, [&] { return capacity == 0 || items.size() < capacity; });
+            items.push_back(std::move(item));
+        }
+        notEmpty.notify_one();
+    }
+
+    // Returns false once the queue is closed and drained.
+    bool pop(T& item) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            notEmpty.wait(lock, [&] { return !items.empty() || closed; });
+            if (items.empty()) return false;
+            item = std::move(items.front());
+            items.pop_front();
+        }
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        { std::lock_guard<std::mutex> lock(mutex); closed = true; }
+        notEmpty.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable notEmpty, notFull;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <limits>
+#include <ostream>
+#include <algorithm>
+
+/*
+ * Measurement plumbing of the benchmark tools: running statistics over a
+ * stream of samples and a small JSON writer for the machine-readable
+ * reports, so results from different machines can be diffed and plotted.
+ */
+
+// Mean and variance by Welford's update; no samples are kept.
+struct RunningStats {
+    uint64_t count = 0;
+    double mean = 0.0, m2 = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void add(double x) {
+        ++count;
+        double delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+        min = std::min(min, x);
+        max = std::max(max, x);
+    }
+
+    double stddev() const { return count > 1 ? std::sqrt(m2 / (count - 1)) : 0.0; }
+    // Coefficient of variation: stddev relative to the mean.
+    double cv() const { return mean != 0.0 ? stddev() / mean : 0.0; }
+};
+
+// Streams pretty-printed JSON. Keys are given inside objects and left out
+// inside arrays; the writer places the commas. NaN and infinities, which
+// JSON has no literal for, come out as null.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::ostream& out) : out(out) {}
+
+    JsonWriter& beginObject(const char* key = nullptr) { open(key, '{'); return *this; }
+    JsonWriter& endObject() { close('}'); return *this; }
+    JsonWriter& beginArray(const char* key = nullptr) { open(key, '['); return *this; }
+    JsonWriter& endArray() { close(']'); return *this; }
+
+    JsonWriter& value(const char* key, const std::string& s) { item(key); string(s); return *this; }
+    JsonWriter& value(const char* key, const char* s) { item(key); string(s); return *this; }
+    JsonWriter& value(const char* key, bool b) { item(key); out << (b ? "true" : "false"); return *this; }
+    JsonWriter& value(const char* key, uint64_t n) { item(key); out << n; return *this; }
+    JsonWriter& value(const char* key, uint32_t n) { item(key); out << n; return *this; }
+    JsonWriter& value(const char* key, int n) { item(key); out << n; return *this; }
+    JsonWriter& value(const char* key, double x) {
+        item(key);
+        if (std::isfinite(x)) {
+            char buf[32];
+            snprintf(buf, sizeof buf, "%.9g", x);
+            out << buf;
+        } else {
+            out << "null";
+        }
+        return *this;
+    }
+    JsonWriter& null(const char* key) { item(key); out << "null"; return *this; }
+
+    // {"count", "mean", "stddev", "min", "max"} of a RunningStats.
+    JsonWriter& stats(const char* key, const RunningStats& s) {
+        beginObject(key);
+        value("count", s.count);
+        value("mean", s.count ? s.mean : NAN);
+        value("stddev", s.stddev());
+        value("min", s.count ? s.min : NAN);
+        value("max", s.count ? s.max : NAN);
+        return endObject();
+    }
+
+    // The identity of the device a report was measured on; Context is a
+    // VulkanContext (kept generic so this header does not need Vulkan).
+    template <typename Context>
+    JsonWriter& device(const char* key, const Context& vulkan) {
+        beginObject(key);
+        value("index", vulkan.deviceIndex);
+        value("name", vulkan.properties.deviceName);
+        value("type", vulkan.deviceType());
+        value("uuid", vulkan.uuid);
+        value("vendor_id", vulkan.properties.vendorID);
+        value("driver_version", vulkan.properties.driverVersion);
+        return endObject();
+    }
+
+    // Ends the document with a newline.
+    void finish() { out << std::endl; }
+
+private:
+    void item(const char* key) {
+        if (!first.empty()) {
+            if (!first.back()) out << ',';
+            first.back() = false;
+            out << '\n' << std::string(2 * first.size(), ' ');
+        }
+        if (key != nullptr) {
+            string(key);
+            out << ": ";
+        }
+    }
+    void open(const char* key, char bracket) {
+        item(key);
+        out << bracket;
+        first.push_back(true);
+    }
+    void close(char bracket) {
+        bool empty = first.back();
+        first.pop_back();
+        if (!empty) out << '\n' << std::string(2 * first.size(), ' ');
+        out << bracket;
+    }
+    void string(const std::string& s) {
+        out << '"';
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if ((unsigned char)c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof buf, "\\u%04x", c);
+                out << buf;
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+    std::ostream& out;
+    std::vector<bool> first; // per open container: nothing written yet
+};
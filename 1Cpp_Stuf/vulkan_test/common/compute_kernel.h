@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <stdexcept>
+#include <vulkan/vulkan.h>
+
+#include "vk_context.h"
+
+/*
+ * One compute pipeline with its own descriptor set, command buffer, fence
+ * and timestamp pair, for the microbenchmarks: bind buffers, run one
+ * dispatch, get its GPU time. Storage buffers sit at bindings 0..n-1,
+ * specialization constants are 32-bit words at constant_id 0..m-1 and
+ * the push constants are one block at offset 0.
+ *
+ * run() waits for the dispatch, so it measures one dispatch in isolation;
+ * the stress loops keep several in flight themselves. submit() and wait()
+ * are its two halves, for overlapping the dispatch with work on another
+ * queue. Without timestamps on the queue, the time is the host's
+ * submit-to-fence time.
+ */
+
+class ComputeKernel {
+public:
+    ComputeKernel(const VulkanContext& vulkan, VkShaderModule module, uint32_t bindingCount, uint32_t pushBytes,
+                  const std::vector<uint32_t>& specConstants = {})
+        : vulkan(vulkan), device(vulkan.device), bindingCount(bindingCount), pushBytes(pushBytes) {
+        std::vector<VkDescriptorSetLayoutBinding> bindings(bindingCount);
+        for (uint32_t b = 0; b < bindingCount; ++b) {
+            bindings[b].binding = b; bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; bindings[b].descriptorCount = 1; bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        VkDescriptorSetLayoutCreateInfo layoutInfo{}; layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO; layoutInfo.bindingCount = bindingCount; layoutInfo.pBindings = bindings.data();
+        vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout);
+
+        VkPushConstantRange pushConstantRange{}; pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT; pushConstantRange.offset = 0; pushConstantRange.size = pushBytes;
+        VkPipelineLayoutCreateInfo plInfo{}; plInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO; plInfo.setLayoutCount = 1; plInfo.pSetLayouts = &descriptorSetLayout; plInfo.pushConstantRangeCount = pushBytes ? 1 : 0; plInfo.pPushConstantRanges = &pushConstantRange;
+        vkCreatePipelineLayout(device, &plInfo, nullptr, &pipelineLayout);
+
+        std::vector<VkSpecializationMapEntry> specEntries(specConstants.size());
+        for (uint32_t c = 0; c < specEntries.size(); ++c) {
+            specEntries[c].constantID = c; specEntries[c].offset = c * sizeof(uint32_t); specEntries[c].size = sizeof(uint32_t);
+        }
+        VkSpecializationInfo specInfo{}; specInfo.mapEntryCount = uint32_t(specEntries.size()); specInfo.pMapEntries = specEntries.data(); specInfo.dataSize = sizeof(uint32_t) * specConstants.size(); specInfo.pData = specConstants.data();
+        VkComputePipelineCreateInfo pInfo{}; pInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO; pInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO; pInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT; pInfo.stage.module = module; pInfo.stage.pName = "main"; pInfo.stage.pSpecializationInfo = &specInfo; pInfo.layout = pipelineLayout;
+        if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pInfo, nullptr, &pipeline) != VK_SUCCESS) throw std::runtime_error("Failed to create compute pipeline");
+
+        VkDescriptorPoolSize poolSize{}; poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; poolSize.descriptorCount = bindingCount;
+        VkDescriptorPoolCreateInfo poolInfo{}; poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO; poolInfo.poolSizeCount = 1; poolInfo.pPoolSizes = &poolSize; poolInfo.maxSets = 1;
+        vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
+        VkDescriptorSetAllocateInfo dsAllocInfo{}; dsAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO; dsAllocInfo.descriptorPool = descriptorPool; dsAllocInfo.descriptorSetCount = 1; dsAllocInfo.pSetLayouts = &descriptorSetLayout;
+        vkAllocateDescriptorSets(device, &dsAllocInfo, &descriptorSet);
+
+        VkCommandPoolCreateInfo cpInfo{}; cpInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO; cpInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; cpInfo.queueFamilyIndex = vulkan.queueFamilyIndex;
+        vkCreateCommandPool(device, &cpInfo, nullptr, &commandPool);
+        VkCommandBufferAllocateInfo cbAllocInfo{}; cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO; cbAllocInfo.commandPool = commandPool; cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbAllocInfo.commandBufferCount = 1;
+        vkAllocateCommandBuffers(device, &cbAllocInfo, &commandBuffer);
+        VkFenceCreateInfo fenceInfo{}; fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        vkCreateFence(device, &fenceInfo, nullptr, &fence);
+        if (vulkan.timestampValidBits != 0) {
+            VkQueryPoolCreateInfo qpInfo{}; qpInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO; qpInfo.queryType = VK_QUERY_TYPE_TIMESTAMP; qpInfo.queryCount = 2;
+            vkCreateQueryPool(device, &qpInfo, nullptr, &queryPool);
+        }
+    }
+
+    ~ComputeKernel() {
+        vkDestroyQueryPool(device, queryPool, nullptr);
+        vkDestroyFence(device, fence, nullptr);
+        vkDestroyCommandPool(device, commandPool, nullptr);
+        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+        vkDestroyPipeline(device, pipeline, nullptr);
+        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    }
+    ComputeKernel(const ComputeKernel&) = delete;
+    ComputeKernel& operator=(const ComputeKernel&) = delete;
+
+    // Points bindings 0..n-1 at the buffers, whole range each.
+    void bind(const std::vector<VkBuffer>& buffers) {
+        if (buffers.size() != bindingCount) throw std::runtime_error("ComputeKernel::bind: wrong number of buffers");
+        std::vector<VkDescriptorBufferInfo> bufferInfos(bindingCount);
+        std::vector<VkWriteDescriptorSet> writes(bindingCount);
+        for (uint32_t b = 0; b < bindingCount; ++b) {
+            bufferInfos[b].buffer = buffers[b]; bufferInfos[b].range = VK_WHOLE_SIZE;
+            writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; writes[b].dstSet = descriptorSet; writes[b].dstBinding = b; writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; writes[b].descriptorCount = 1; writes[b].pBufferInfo = &bufferInfos[b];
+        }
+        vkUpdateDescriptorSets(device, bindingCount, writes.data(), 0, nullptr);
+    }
+
+    // One dispatch of groups workgroups; waits and returns its seconds.
+    double run(uint32_t groups, const void* push = nullptr) {
+        submit(groups, push);
+        return wait();
+    }
+
+    // Starts one dispatch; wait() before the next.
+    void submit(uint32_t groups, const void* push = nullptr) {
+        VkCommandBuffer cb = commandBuffer;
+        vkResetCommandBuffer(cb, 0);
+        VkCommandBufferBeginInfo beginInfo{}; beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO; beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(cb, &beginInfo);
+        if (queryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(cb, queryPool, 0, 2);
+            vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+        }
+        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        if (pushBytes) vkCmdPushConstants(cb, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, pushBytes, push);
+        vkCmdDispatch(cb, groups, 1, 1);
+        if (queryPool != VK_NULL_HANDLE) vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+        // Results the host maps are visible once the fence signals.
+        VkMemoryBarrier hostBarrier{}; hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER; hostBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT; hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+        vkEndCommandBuffer(cb);
+
+        VkSubmitInfo submitInfo{}; submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; submitInfo.commandBufferCount = 1; submitInfo.pCommandBuffers = &cb;
+        submitTime = std::chrono::steady_clock::now();
+        if (vkQueueSubmit(vulkan.computeQueue, 1, &submitInfo, fence) != VK_SUCCESS) throw std::runtime_error("vkQueueSubmit failed (device lost?)");
+    }
+
+    // Waits for the submitted dispatch and returns its seconds.
+    double wait() {
+        vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+        double hostSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - submitTime).count();
+        vkResetFences(device, 1, &fence);
+        if (queryPool == VK_NULL_HANDLE) return hostSeconds;
+
+        uint64_t ticks[2];
+        vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        return double((ticks[1] - ticks[0]) & vulkan.timestampMask()) * vulkan.timestampPeriodNs * 1e-9;
+    }
+
+private:
+    const VulkanContext& vulkan;
+    VkDevice device;
+    uint32_t bindingCount, pushBytes;
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    std::chrono::steady_clock::time_point submitTime;
+};
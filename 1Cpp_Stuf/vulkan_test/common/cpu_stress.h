@@ -0,0 +1,342 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+#include <condition_variable>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include "primality64.h"
+
+/*
+ * The CPU half of a hybrid load: one worker per hardware thread, each
+ * pinned to its own CPU (Linux; --no-pin leaves placement to the
+ * scheduler), running one of three kernels until stopped:
+ *  - fma     twelve independent chains of 8-wide single-precision FMAs,
+ *            AVX2/FMA when the CPU has it, else whatever the compiler
+ *            vectorizes the portable loop to: peak FLOP/s;
+ *  - triad   STREAM's a[i] = b[i] + s * c[i] over per-thread arrays the
+ *            thread touches first (so they sit on its NUMA node), together
+ *            --cpu-mb large: DRAM bandwidth, counted as STREAM does, 24
+ *            bytes per element without the write-allocate;
+ *  - primes  Primality64::isPrime on consecutive odd numbers from
+ *            2^40 + 1, the host twin of stress.comp's loop.
+ * Rates go out once a second and per thread at stop(). The tools start
+ * it next to their GPU loop, or alone with --cpu-only, so the GPU's
+ * numbers can be compared with and without the CPU competing for memory
+ * bandwidth and power.
+ */
+
+struct CpuStressOptions {
+    std::string kernel;      // fma, triad or primes; empty: no CPU load
+    unsigned threads = 0;    // 0: std::thread::hardware_concurrency(); --cpu-threads takes 1 to 4096
+    bool pin = true;
+    uint64_t triadBytes = 1ULL << 30; // all threads' arrays together; --cpu-mb takes up to the installed memory
+    bool alone = false;      // --cpu-only: no GPU work
+};
+
+const char* const CPU_KERNELS = "fma, triad, primes";
+const char* const CPU_USAGE = " [--cpu fma|triad|primes [--cpu-threads <n>] [--cpu-mb <triad MiB>] [--no-pin] [--cpu-only]]";
+
+// Installed memory, the bound for --cpu-mb; 1 TiB where it is not known.
+inline uint64_t physicalMemoryBytes() {
+#ifdef __linux__
+    long pages = sysconf(_SC_PHYS_PAGES), pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && pageSize > 0) return uint64_t(pages) * uint64_t(pageSize);
+#endif
+    return 1ULL << 40;
+}
+
+// The value of a numeric CPU option, in [1, max].
+inline uint64_t cpuOptionValue(const std::string& arg, const std::string& value, uint64_t max) {
+    size_t end = 0;
+    uint64_t n = 0;
+    try {
+        n = std::stoull(value, &end);
+    } catch (const std::logic_error&) {
+        end = 0; // not a number, or past 2^64
+    }
+    if (end == 0 || end != value.size() || value.find('-') != std::string::npos || n == 0 || n > max) {
+        throw std::runtime_error(arg + " " + value + ": must be 1 to " + std::to_string(max));
+    }
+    return n;
+}
+
+// The CPU options every tool takes; true when argv[i] (and its value) was one.
+// Bad values throw here, before the tool sets up the GPU.
+inline bool parseCpuStressOption(int argc, char* argv[], int& i, CpuStressOptions& options) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--cpu" && hasValue) {
+        options.kernel = argv[++i];
+        if (options.kernel != "fma" && options.kernel != "triad" && options.kernel != "primes") {
+            throw std::runtime_error("--cpu " + options.kernel + ": one of " + CPU_KERNELS);
+        }
+    }
+    else if (arg == "--cpu-threads" && hasValue) options.threads = unsigned(cpuOptionValue(arg, argv[++i], 4096));
+    else if (arg == "--cpu-mb" && hasValue) options.triadBytes = cpuOptionValue(arg, argv[++i], physicalMemoryBytes() >> 20) << 20;
+    else if (arg == "--no-pin") options.pin = false;
+    else if (arg == "--cpu-only") options.alone = true;
+    else return false;
+    return true;
+}
+
+class CpuStress {
+public:
+    explicit CpuStress(const CpuStressOptions& options) : options(options) {
+        if (options.kernel == "fma") { kernel = FMA; unitScale = 1e9; unitName = "GFLOP/s"; }
+        else if (options.kernel == "triad") { kernel = TRIAD; unitScale = 1e9; unitName = "GB/s"; }
+        else if (options.kernel == "primes") { kernel = PRIMES; unitScale = 1e6; unitName = "M numbers/s"; }
+        else throw std::runtime_error("--cpu " + options.kernel + ": one of " + CPU_KERNELS);
+
+        unsigned count = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        std::vector<int> cpus = allowedCpus();
+        for (unsigned t = 0; t < count; ++t) workers.emplace_back(new Worker());
+        start = Clock::now();
+        for (unsigned t = 0; t < count; ++t) {
+            Worker& w = *workers[t];
+            w.cpu = (options.pin && !cpus.empty()) ? cpus[t % cpus.size()] : -1;
+            w.thread = std::thread(&CpuStress::work, this, t);
+        }
+        reporter = std::thread(&CpuStress::report, this);
+        std::cout << "CPU " << options.kernel << " on " << count << " thread(s)" << (options.pin && !cpus.empty() ? ", pinned" : "")
+                  << (kernel == FMA ? (hasFma() ? ", AVX2/FMA" : ", portable loop") : "") << std::endl;
+    }
+    ~CpuStress() { stop(); }
+    CpuStress(const CpuStress&) = delete;
+    CpuStress& operator=(const CpuStress&) = delete;
+
+    // Stops the workers and prints total and per-thread rates; once.
+    void stop(std::ostream& out = std::cout) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) return;
+            stopping = true;
+        }
+        wake.notify_all();
+        reporter.join();
+        for (auto& w : workers) w->thread.join();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        double total = 0, lo = 1e300, hi = 0;
+        for (const auto& w : workers) {
+            double rate = w->units.load() / seconds / unitScale;
+            total += rate;
+            lo = std::min(lo, rate);
+            hi = std::max(hi, rate);
+        }
+        out << "--- CPU " << options.kernel << ": " << total << " " << unitName << " over " << seconds << " s on " << workers.size()
+            << " thread(s), per thread " << lo << " - " << hi << " ---" << std::endl;
+        for (size_t t = 0; t < workers.size(); ++t) {
+            out << "    thread " << t;
+            if (workers[t]->cpu >= 0) out << " (cpu " << workers[t]->cpu << ")";
+            out << ": " << workers[t]->units.load() / seconds / unitScale << " " << unitName << (workers[t]->noMemory ? " (no memory for its arrays)" : "") << std::endl;
+        }
+        if (kernel == PRIMES) out << "    " << primesFound.load() << " primes found" << std::endl;
+    }
+
+    // Runs options alone until stop is set, for --cpu-only.
+    static int runAlone(const CpuStressOptions& options, const std::atomic<bool>& stop) {
+        CpuStress cpu(options);
+        while (!stop) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        cpu.stop();
+        return 0;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    enum Kernel { FMA, TRIAD, PRIMES };
+
+    static const uint32_t FMA_CHAINS = 12;             // covers 4-cycle latency on two FMA ports
+    static const uint32_t FMA_STEPS = 1u << 20;        // per counter update
+    static const uint32_t PRIME_CHUNK = 4096;          // odd numbers per counter update
+    static const uint64_t TRIAD_MIN_ELEMENTS = 1u << 19; // 4 MB per array and thread at least
+
+    struct alignas(64) Worker {
+        std::thread thread;
+        int cpu = -1;
+        std::atomic<uint64_t> units{0};
+        bool noMemory = false; // triad: its arrays could not be allocated; read after join
+    };
+
+    static std::vector<int> allowedCpus() {
+        std::vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof set, &set) == 0) {
+            for (int c = 0; c < CPU_SETSIZE; ++c) {
+                if (CPU_ISSET(c, &set)) cpus.push_back(c);
+            }
+        }
+#endif
+        return cpus;
+    }
+
+    static bool hasFma() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+        return false;
+#endif
+    }
+
+    bool running() const { return !stopFlag.load(std::memory_order_relaxed); }
+
+    void work(unsigned t) {
+        Worker& w = *workers[t];
+#ifdef __linux__
+        if (w.cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(w.cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+        }
+#endif
+        if (kernel == FMA) runFma(w);
+        else if (kernel == TRIAD) runTriad(w);
+        else runPrimes(w);
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("avx2,fma"))) static float fmaAvx2() {
+        const __m256 mul = _mm256_set1_ps(0.999999f), add = _mm256_set1_ps(1e-6f);
+        __m256 acc[FMA_CHAINS];
+        for (uint32_t c = 0; c < FMA_CHAINS; ++c) acc[c] = _mm256_set1_ps(float(c));
+        for (uint32_t i = 0; i < FMA_STEPS; ++i) {
+            for (uint32_t c = 0; c < FMA_CHAINS; ++c) acc[c] = _mm256_fmadd_ps(acc[c], mul, add);
+        }
+        float lanes[8], sum = 0;
+        for (uint32_t c = 0; c < FMA_CHAINS; ++c) {
+            _mm256_storeu_ps(lanes, acc[c]);
+            for (float x : lanes) sum += x;
+        }
+        return sum;
+    }
+#endif
+
+    static float fmaPortable() {
+        float acc[FMA_CHAINS][8];
+        for (uint32_t c = 0; c < FMA_CHAINS; ++c) {
+            for (uint32_t l = 0; l < 8; ++l) acc[c][l] = float(c);
+        }
+        for (uint32_t i = 0; i < FMA_STEPS; ++i) {
+            for (uint32_t c = 0; c < FMA_CHAINS; ++c) {
+                for (uint32_t l = 0; l < 8; ++l) acc[c][l] = acc[c][l] * 0.999999f + 1e-6f;
+            }
+        }
+        float sum = 0;
+        for (uint32_t c = 0; c < FMA_CHAINS; ++c) {
+            for (uint32_t l = 0; l < 8; ++l) sum += acc[c][l];
+        }
+        return sum;
+    }
+
+    void runFma(Worker& w) {
+        const bool avx2 = hasFma();
+        const uint64_t flops = uint64_t(FMA_STEPS) * FMA_CHAINS * 8 * 2;
+        float sink = 0;
+        while (running()) {
+#if defined(__x86_64__) || defined(__i386__)
+            sink += avx2 ? fmaAvx2() : fmaPortable();
+#else
+            (void)avx2;
+            sink += fmaPortable();
+#endif
+            w.units.fetch_add(flops, std::memory_order_relaxed);
+        }
+        floatSink.store(sink, std::memory_order_relaxed);
+    }
+
+    void runTriad(Worker& w) {
+        const uint64_t n = std::max<uint64_t>(TRIAD_MIN_ELEMENTS, options.triadBytes / (3 * sizeof(double) * workers.size()));
+        // First touch here, on the thread's own CPU. Out of memory idles the
+        // thread instead of throwing std::bad_alloc out of it.
+        std::unique_ptr<double[]> a(new (std::nothrow) double[n]), b(new (std::nothrow) double[n]), c(new (std::nothrow) double[n]);
+        if (!a || !b || !c) {
+            w.noMemory = true;
+            std::cerr << "CPU triad: cannot allocate " + std::to_string(3 * sizeof(double) * n >> 20) + " MiB for a thread, it stays idle\n";
+            return;
+        }
+        for (uint64_t i = 0; i < n; ++i) { a[i] = 1.0; b[i] = 2.0; c[i] = 0.5; }
+        const double scalar = 3.0;
+        while (running()) {
+            double* __restrict pa = a.get();
+            const double* __restrict pb = b.get();
+            const double* __restrict pc = c.get();
+            for (uint64_t i = 0; i < n; ++i) pa[i] = pb[i] + scalar * pc[i];
+            w.units.fetch_add(3 * sizeof(double) * n, std::memory_order_relaxed);
+        }
+        floatSink.store(float(a[n / 2]), std::memory_order_relaxed);
+    }
+
+    void runPrimes(Worker& w) {
+        uint64_t found = 0;
+        while (running()) {
+            uint64_t first = nextNumber.fetch_add(2 * uint64_t(PRIME_CHUNK), std::memory_order_relaxed);
+            for (uint32_t i = 0; i < PRIME_CHUNK; ++i) found += Primality64::isPrime(first + 2 * uint64_t(i));
+            w.units.fetch_add(PRIME_CHUNK, std::memory_order_relaxed);
+        }
+        primesFound.fetch_add(found);
+    }
+
+    void report() {
+        std::vector<uint64_t> last(workers.size(), 0);
+        Clock::time_point previous = start;
+        for (int tick = 1;; ++tick) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (wake.wait_until(lock, start + std::chrono::seconds(tick), [this] { return stopping; })) break;
+            }
+            Clock::time_point now = Clock::now();
+            double interval = std::chrono::duration<double>(now - previous).count();
+            double total = 0, lo = 1e300, hi = 0;
+            for (size_t t = 0; t < workers.size(); ++t) {
+                uint64_t units = workers[t]->units.load(std::memory_order_relaxed);
+                double rate = (units - last[t]) / interval / unitScale;
+                last[t] = units;
+                total += rate;
+                lo = std::min(lo, rate);
+                hi = std::max(hi, rate);
+            }
+            previous = now;
+            char line[160];
+            std::snprintf(line, sizeof line, "[CPU %d s] %s: %.2f %s (per thread %.2f - %.2f)", tick, options.kernel.c_str(), total, unitName, lo, hi);
+            std::cout << line << std::endl;
+        }
+        stopFlag = true;
+    }
+
+    const CpuStressOptions options;
+    Kernel kernel = FMA;
+    double unitScale = 1;
+    const char* unitName = "";
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::thread reporter;
+    Clock::time_point start;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::atomic<bool> stopFlag{false};
+    std::atomic<uint64_t> nextNumber{(1ULL << 40) + 1};
+    std::atomic<uint64_t> primesFound{0};
+    std::atomic<float> floatSink{0};
+};
@@ -0,0 +1,169 @@
+/*
+ * ===================================================================
+ * 64-bit modular arithmetic shared by the compute kernels.
+ * The including shader must enable GL_ARB_gpu_shader_int64.
+ *
+ * Two implementations live side by side:
+ *  - mul_mod_slow / pow_mod_slow: the original double-and-add loop,
+ *    up to 64 iterations of a 64-bit '%' per multiplication. Kept as a
+ *    deliberately heavy synthetic load for the stress tests. From 2^63
+ *    on a doubling or a sum would overflow 64 bits before the '%', so
+ *    those moduli take a compare-and-subtract step instead.
+ *  - Montgomery: a full 64x64->128 product assembled from umulExtended
+ *    and a single REDC step. Requires an odd modulus.
+ *
+ * A shader that defines COUNT_MULMODS before the include gets every
+ * modular multiplication (mul_mod_slow or mont_mul call) counted in
+ * mulmod_count; the stress benchmark reports mulmods/s from it.
+ * ===================================================================
+ */
+
+#ifdef COUNT_MULMODS
+uint mulmod_count = 0;
+#define COUNT_MULMOD() ++mulmod_count
+#else
+#define COUNT_MULMOD()
+#endif
+
+// --- Double-and-add (slow path) ---
+
+uint64_t mul_mod_slow(uint64_t a, uint64_t b, uint64_t m) {
+    COUNT_MULMOD();
+    uint64_t res = 0;
+    a %= m;
+    if ((m >> 63) == 0) {
+        while (b > 0) {
+            if ((b & 1) > 0) res = (res + a) % m;
+            a = (a * 2) % m;
+            b >>= 1;
+        }
+        return res;
+    }
+    // res, a < m: x + a >= m exactly when x >= m - a.
+    while (b > 0) {
+        if ((b & 1) > 0) res = (res >= m - a) ? res - (m - a) : res + a;
+        a = (a >= m - a) ? a - (m - a) : a + a;
+        b >>= 1;
+    }
+    return res;
+}
+
+uint64_t pow_mod_slow(uint64_t a, uint64_t b, uint64_t m) {
+    uint64_t res = 1;
+    a %= m;
+    while (b > 0) {
+        if ((b & 1) == 1) res = mul_mod_slow(res, a, m);
+        a = mul_mod_slow(a, a, m);
+        b >>= 1;
+    }
+    return res;
+}
+
+// --- 128-bit product ---
+
+// hi:lo = a * b, built from four 32x32->64 partial products.
+void mul64_wide(uint64_t a, uint64_t b, out uint64_t hi, out uint64_t lo) {
+    uvec2 av = unpackUint2x32(a); // .x = low word, .y = high word
+    uvec2 bv = unpackUint2x32(b);
+    uint p0h, p0l, p1h, p1l, p2h, p2l, p3h, p3l;
+    umulExtended(av.x, bv.x, p0h, p0l);
+    umulExtended(av.x, bv.y, p1h, p1l);
+    umulExtended(av.y, bv.x, p2h, p2l);
+    umulExtended(av.y, bv.y, p3h, p3l);
+
+    // Middle column, at most 34 bits wide.
+    uint64_t mid = uint64_t(p0h) + uint64_t(p1l) + uint64_t(p2l);
+    lo = packUint2x32(uvec2(p0l, uint(mid)));
+    hi = packUint2x32(uvec2(p3l, p3h)) + uint64_t(p1h) + uint64_t(p2h) + (mid >> 32);
+}
+
+// (a + b) % n for a, b < n without overflowing 64 bits.
+uint64_t add_mod(uint64_t a, uint64_t b, uint64_t n) {
+    return (a >= n - b) ? a - (n - b) : a + b;
+}
+
+// --- Montgomery arithmetic, R = 2^64 ---
+
+struct Mont64 {
+    uint64_t n;    // odd modulus
+    uint64_t ninv; // -n^-1 mod 2^64
+    uint64_t one;  // R mod n, i.e. 1 in Montgomery form
+    uint64_t r2;   // R^2 mod n, converts into Montgomery form
+};
+
+Mont64 mont_init(uint64_t n) {
+    Mont64 m;
+    m.n = n;
+
+    // Newton iteration: n*n == 1 mod 8 gives 3 correct bits, each step doubles them.
+    uint64_t inv = n;
+    for (int i = 0; i < 5; ++i) inv *= 2UL - n * inv;
+    m.ninv = 0UL - inv;
+
+    m.one = (0UL - n) % n; // 2^64 mod n
+    uint64_t r2 = m.one;
+    for (int i = 0; i < 64; ++i) r2 = add_mod(r2, r2, n);
+    m.r2 = r2;
+    return m;
+}
+
+// hi:lo * R^-1 mod n, valid for hi < n.
+uint64_t mont_redc(Mont64 m, uint64_t hi, uint64_t lo) {
+    uint64_t q = lo * m.ninv;
+    uint64_t qh, ql;
+    mul64_wide(q, m.n, qh, ql);
+    // lo + ql == 0 mod 2^64, so it carries out exactly when lo != 0.
+    uint64_t s = hi + ((lo != 0) ? 1UL : 0UL);
+    uint64_t t = s + qh;
+    if (t < s || t >= m.n) t -= m.n;
+    return t;
+}
+
+uint64_t mont_mul(Mont64 m, uint64_t a, uint64_t b) {
+    COUNT_MULMOD();
+    uint64_t hi, lo;
+    mul64_wide(a, b, hi, lo);
+    return mont_redc(m, hi, lo);
+}
+
+uint64_t mont_to(Mont64 m, uint64_t a) {
+    return mont_mul(m, a % m.n, m.r2);
+}
+
+uint64_t mont_from(Mont64 m, uint64_t a) {
+    return mont_redc(m, 0UL, a);
+}
+
+// a^e with a already in Montgomery form; the result stays in Montgomery form.
+uint64_t mont_pow(Mont64 m, uint64_t a, uint64_t e) {
+    uint64_t res = m.one;
+    while (e > 0) {
+        if ((e & 1) == 1) res = mont_mul(m, res, a);
+        a = mont_mul(m, a, a);
+        e >>= 1;
+    }
+    return res;
+}
+
+// --- Strong probable-prime round, n - 1 = d * 2^s ---
+
+bool sprp_slow(uint64_t n, uint64_t a, uint64_t d, int s) {
+    uint64_t x = pow_mod_slow(a, d, n);
+    if (x == 1 || x == n - 1) return true;
+    for (int r = 1; r < s; ++r) {
+        x = mul_mod_slow(x, x, n);
+        if (x == n - 1) return true;
+    }
+    return false;
+}
+
+bool sprp_mont(Mont64 m, uint64_t a, uint64_t d, int s) {
+    uint64_t minus_one = m.n - m.one; // n - 1 in Montgomery form
+    uint64_t x = mont_pow(m, mont_to(m, a), d);
+    if (x == m.one || x == minus_one) return true;
+    for (int r = 1; r < s; ++r) {
+        x = mont_mul(m, x, x);
+        if (x == minus_one) return true;
+    }
+    return false;
+}
@@ -0,0 +1,168 @@
+/*
+ * ===================================================================
+ * Deterministic 64-bit primality test shared by the compute kernels.
+ * The including shader must enable GL_ARB_gpu_shader_int64 and declare
+ *     layout(constant_id = 0) const bool SLOW_MULMOD
+ * before including this file.
+ *
+ * Montgomery path, cheapest first:
+ *  1. Trial division by the odd primes up to 61, done as three 64-bit
+ *     remainders by prime products and 32-bit remainders from there.
+ *     This settles about 73% of odd inputs before any modexp.
+ *  2. A strong probable-prime round to base 2. Nearly every remaining
+ *     composite fails here.
+ *  3. n < 2^32: rounds to bases 7 and 61; {2, 7, 61} has no strong
+ *     pseudoprime below 4,759,123,141.
+ *     Otherwise: a strong Lucas test with Selfridge's parameters, which
+ *     with step 2 is Baillie-PSW. Checked against Feitsma's list of
+ *     base-2 pseudoprimes, BPSW has no counterexample below 2^64.
+ * A prime costs about four Miller-Rabin rounds instead of twelve.
+ *
+ * SLOW_MULMOD keeps the twelve-base double-and-add test: it is a
+ * deliberately heavy synthetic load, not a fast path, but it gives the
+ * same answers (bases 2..37 are deterministic far beyond 2^64, and
+ * mul_mod_slow does not overflow for moduli from 2^63).
+ *
+ * ../common/primality64.h is the CPU twin of this file, step for step.
+ * ===================================================================
+ */
+
+#include "mulmod64.glsl"
+
+// --- 1. Small primes ---
+
+// Bit p is set for every prime p < 64.
+const uint64_t SMALL_PRIME_MASK = 0x28208a20a08a28acUL;
+
+bool has_small_factor(uint64_t n) {
+    uint r1 = uint(n % 111546435UL); // 3*5*7*11*13*17*19*23
+    uint r2 = uint(n % 58642669UL);  // 29*31*37*41*43
+    uint r3 = uint(n % 8965109UL);   // 47*53*59*61
+    return r1 % 3 == 0 || r1 % 5 == 0 || r1 % 7 == 0 || r1 % 11 == 0 || r1 % 13 == 0 ||
+           r1 % 17 == 0 || r1 % 19 == 0 || r1 % 23 == 0 ||
+           r2 % 29 == 0 || r2 % 31 == 0 || r2 % 37 == 0 || r2 % 41 == 0 || r2 % 43 == 0 ||
+           r3 % 47 == 0 || r3 % 53 == 0 || r3 % 59 == 0 || r3 % 61 == 0;
+}
+
+// --- 2. Strong Lucas test ---
+
+// (a - b) % n for a, b < n.
+uint64_t sub_mod(uint64_t a, uint64_t b, uint64_t n) {
+    return (a >= b) ? a - b : a + (n - b);
+}
+
+// a / 2 mod odd n, for a < n. Linear, so it also works in Montgomery form.
+uint64_t half_mod(uint64_t a, uint64_t n) {
+    return ((a & 1) == 0) ? a >> 1 : (a >> 1) + (n >> 1) + 1;
+}
+
+// Jacobi symbol (a / n) for odd n.
+int jacobi(uint64_t a, uint64_t n) {
+    int t = 1;
+    a %= n;
+    while (a != 0) {
+        while ((a & 1) == 0) {
+            a >>= 1;
+            uint r = uint(n & 7);
+            if (r == 3 || r == 5) t = -t;
+        }
+        uint64_t tmp = a;
+        a = n;
+        n = tmp;
+        if ((a & 3) == 3 && (n & 3) == 3) t = -t;
+        a %= n;
+    }
+    return (n == 1) ? t : 0;
+}
+
+bool is_square(uint64_t n) {
+    uint64_t r = uint64_t(sqrt(float(n)));
+    // float is only good to 24 bits; Newton steps and a final nudge finish the job.
+    r += 1;
+    for (int i = 0; i < 6; ++i) r = (r + n / r) >> 1;
+    r = min(r, 0xffffffffUL);
+    while (r * r > n) --r;
+    while (r < 0xffffffffUL && (r + 1) * (r + 1) <= n) ++r;
+    return r * r == n;
+}
+
+// Strong Lucas probable-prime test for odd n > 61 without small factors.
+// P = 1, Q = (1 - D) / 4, D the first of 5, -7, 9, -11, ... with (D/n) = -1.
+bool strong_lucas(Mont64 m) {
+    uint64_t n = m.n;
+    int D = 5;
+    for (int i = 0;; ++i) {
+        uint64_t dmod = (D > 0) ? uint64_t(D) : n - uint64_t(-D);
+        int j = jacobi(dmod, n);
+        if (j == -1) break;
+        if (j == 0) return false; // |D| < n shares a factor with n
+        // A square never gets (D/n) = -1; look once the search runs long.
+        if (i == 8 && is_square(n)) return false;
+        D = (D > 0) ? -(D + 2) : -D + 2;
+    }
+    int Q = (1 - D) / 4;
+
+    uint64_t md = mont_to(m, (D > 0) ? uint64_t(D) : n - uint64_t(-D));
+    uint64_t mq = mont_to(m, (Q >= 0) ? uint64_t(Q) : n - uint64_t(-Q));
+
+    // n + 1 = d * 2^s. n + 1 cannot overflow: 2^64 - 1 is a multiple of 3.
+    uint64_t d = n + 1;
+    int s = 0;
+    while ((d & 1) == 0) {
+        d >>= 1;
+        ++s;
+    }
+
+    // Left to right over d, starting from U_1 = 1, V_1 = P = 1, Q^1.
+    uint64_t u = m.one, v = m.one, qk = mq;
+    uvec2 dv = unpackUint2x32(d);
+    int top = (dv.y != 0) ? 32 + findMSB(dv.y) : findMSB(dv.x);
+    for (int b = top - 1; b >= 0; --b) {
+        // k -> 2k: U = U V, V = V^2 - 2 Q^k.
+        u = mont_mul(m, u, v);
+        v = sub_mod(mont_mul(m, v, v), add_mod(qk, qk, n), n);
+        qk = mont_mul(m, qk, qk);
+        if (((d >> b) & 1) == 1) {
+            // k -> k + 1: U = (U + V) / 2, V = (D U + V) / 2.
+            uint64_t du = mont_mul(m, md, u);
+            u = half_mod(add_mod(u, v, n), n);
+            v = half_mod(add_mod(du, v, n), n);
+            qk = mont_mul(m, qk, mq);
+        }
+    }
+    if (u == 0 || v == 0) return true;
+    for (int r = 1; r < s; ++r) {
+        v = sub_mod(mont_mul(m, v, v), add_mod(qk, qk, n), n);
+        if (v == 0) return true;
+        qk = mont_mul(m, qk, qk);
+    }
+    return false;
+}
+
+// --- 3. The test ---
+
+bool is_prime(uint64_t n) {
+    if (n < 64) return ((SMALL_PRIME_MASK >> uint(n)) & 1) == 1;
+    if ((n & 1) == 0 || has_small_factor(n)) return false;
+    if (n < 4489) return true; // 67^2
+
+    uint64_t d = n - 1;
+    int s = 0;
+    while ((d & 1) == 0) {
+        d >>= 1;
+        ++s;
+    }
+
+    if (SLOW_MULMOD) {
+        uint64_t bases[12] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+        for (int i = 0; i < 12; ++i) {
+            if (!sprp_slow(n, bases[i], d, s)) return false;
+        }
+        return true;
+    }
+
+    Mont64 m = mont_init(n);
+    if (!sprp_mont(m, 2UL, d, s)) return false;
+    if (n < 0x100000000UL) return sprp_mont(m, 7UL, d, s) && sprp_mont(m, 61UL, d, s);
+    return strong_lucas(m);
+}
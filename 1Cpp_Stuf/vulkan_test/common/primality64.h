@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * CPU twin of primality64.glsl: the same trial division, the same base-2
+ * round, bases {7, 61} below 2^32 and the same strong Lucas test above,
+ * on the same Montgomery arithmetic (R = 2^64). Keep the two in step; the
+ * host uses this one to check what the kernels compute.
+ *
+ * SLOW_MULMOD in the shader runs the twelve-base test (bases 2..37,
+ * deterministic below 3.3e24) on mul_mod_slow; isPrimeSlow() mirrors it,
+ * double-and-add arithmetic included, so the host can check that the
+ * slow path agrees with the fast one, up to 2^64 - 1 where the doubling
+ * needs its overflow-safe form.
+ */
+
+class Primality64 {
+public:
+    static bool isPrime(uint64_t n) {
+        if (n < 64) return (SMALL_PRIME_MASK >> n) & 1;
+        if ((n & 1) == 0 || hasSmallFactor(n)) return false;
+        if (n < 4489) return true; // 67^2
+
+        uint64_t d = n - 1;
+        int s = 0;
+        while ((d & 1) == 0) {
+            d >>= 1;
+            ++s;
+        }
+
+        Mont m(n);
+        if (!sprp(m, 2, d, s)) return false;
+        if (n < 0x100000000ULL) return sprp(m, 7, d, s) && sprp(m, 61, d, s);
+        return strongLucas(m);
+    }
+
+    // SLOW_MULMOD's test, step for step.
+    static bool isPrimeSlow(uint64_t n) {
+        if (n < 64) return (SMALL_PRIME_MASK >> n) & 1;
+        if ((n & 1) == 0 || hasSmallFactor(n)) return false;
+        if (n < 4489) return true;
+
+        uint64_t d = n - 1;
+        int s = 0;
+        while ((d & 1) == 0) {
+            d >>= 1;
+            ++s;
+        }
+        static const uint64_t bases[12] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+        for (uint64_t a : bases) {
+            uint64_t x = powModSlow(a, d, n);
+            if (x == 1 || x == n - 1) continue;
+            bool passes = false;
+            for (int r = 1; r < s && !passes; ++r) {
+                x = mulModSlow(x, x, n);
+                passes = x == n - 1;
+            }
+            if (!passes) return false;
+        }
+        return true;
+    }
+
+    // mul_mod_slow of mulmod64.glsl.
+    static uint64_t mulModSlow(uint64_t a, uint64_t b, uint64_t m) {
+        uint64_t res = 0;
+        a %= m;
+        if ((m >> 63) == 0) {
+            for (; b > 0; b >>= 1) {
+                if (b & 1) res = (res + a) % m;
+                a = (a * 2) % m;
+            }
+            return res;
+        }
+        for (; b > 0; b >>= 1) {
+            if (b & 1) res = (res >= m - a) ? res - (m - a) : res + a;
+            a = (a >= m - a) ? a - (m - a) : a + a;
+        }
+        return res;
+    }
+
+    // Single steps, for validating the pieces on their own.
+    static bool strongProbablePrime(uint64_t n, uint64_t a) {
+        uint64_t d = n - 1;
+        int s = 0;
+        while ((d & 1) == 0) {
+            d >>= 1;
+            ++s;
+        }
+        Mont m(n);
+        return sprp(m, a, d, s);
+    }
+
+    static bool strongLucasProbablePrime(uint64_t n) { return strongLucas(Mont(n)); }
+
+private:
+    static uint64_t powModSlow(uint64_t a, uint64_t e, uint64_t m) {
+        uint64_t res = 1;
+        a %= m;
+        for (; e > 0; e >>= 1) {
+            if (e & 1) res = mulModSlow(res, a, m);
+            a = mulModSlow(a, a, m);
+        }
+        return res;
+    }
+
+    static const uint64_t SMALL_PRIME_MASK = 0x28208a20a08a28acULL; // bit p set for every prime p < 64
+
+    static bool hasSmallFactor(uint64_t n) {
+        uint32_t r1 = uint32_t(n % 111546435); // 3*5*7*11*13*17*19*23
+        uint32_t r2 = uint32_t(n % 58642669);  // 29*31*37*41*43
+        uint32_t r3 = uint32_t(n % 8965109);   // 47*53*59*61
+        return r1 % 3 == 0 || r1 % 5 == 0 || r1 % 7 == 0 || r1 % 11 == 0 || r1 % 13 == 0 ||
+               r1 % 17 == 0 || r1 % 19 == 0 || r1 % 23 == 0 ||
+               r2 % 29 == 0 || r2 % 31 == 0 || r2 % 37 == 0 || r2 % 41 == 0 || r2 % 43 == 0 ||
+               r3 % 47 == 0 || r3 % 53 == 0 || r3 % 59 == 0 || r3 % 61 == 0;
+    }
+
+    // Montgomery arithmetic for an odd modulus, as in mulmod64.glsl.
+    struct Mont {
+        uint64_t n, ninv, one, r2;
+
+        explicit Mont(uint64_t n) : n(n) {
+            uint64_t inv = n;
+            for (int i = 0; i < 5; ++i) inv *= 2 - n * inv;
+            ninv = 0 - inv;
+            one = (0 - n) % n;
+            r2 = uint64_t((unsigned __int128)one * one % n);
+        }
+
+        uint64_t redc(uint64_t hi, uint64_t lo) const {
+            uint64_t q = lo * ninv;
+            uint64_t qh = uint64_t(((unsigned __int128)q * n) >> 64);
+            uint64_t s = hi + (lo != 0 ? 1 : 0);
+            uint64_t t = s + qh;
+            if (t < s || t >= n) t -= n;
+            return t;
+        }
+
+        uint64_t mul(uint64_t a, uint64_t b) const {
+            unsigned __int128 p = (unsigned __int128)a * b;
+            return redc(uint64_t(p >> 64), uint64_t(p));
+        }
+
+        uint64_t to(uint64_t a) const { return mul(a % n, r2); }
+
+        uint64_t pow(uint64_t a, uint64_t e) const {
+            uint64_t res = one;
+            while (e > 0) {
+                if (e & 1) res = mul(res, a);
+                a = mul(a, a);
+                e >>= 1;
+            }
+            return res;
+        }
+
+        uint64_t add(uint64_t a, uint64_t b) const { return (a >= n - b) ? a - (n - b) : a + b; }
+        uint64_t sub(uint64_t a, uint64_t b) const { return (a >= b) ? a - b : a + (n - b); }
+        uint64_t half(uint64_t a) const { return (a & 1) == 0 ? a >> 1 : (a >> 1) + (n >> 1) + 1; }
+    };
+
+    static bool sprp(const Mont& m, uint64_t a, uint64_t d, int s) {
+        uint64_t minusOne = m.n - m.one;
+        uint64_t x = m.pow(m.to(a), d);
+        if (x == m.one || x == minusOne) return true;
+        for (int r = 1; r < s; ++r) {
+            x = m.mul(x, x);
+            if (x == minusOne) return true;
+        }
+        return false;
+    }
+
+    static int jacobi(uint64_t a, uint64_t n) {
+        int t = 1;
+        a %= n;
+        while (a != 0) {
+            while ((a & 1) == 0) {
+                a >>= 1;
+                uint32_t r = uint32_t(n & 7);
+                if (r == 3 || r == 5) t = -t;
+            }
+            uint64_t tmp = a;
+            a = n;
+            n = tmp;
+            if ((a & 3) == 3 && (n & 3) == 3) t = -t;
+            a %= n;
+        }
+        return n == 1 ? t : 0;
+    }
+
+    // Same float estimate and Newton steps as is_square() in the shader.
+    static bool isSquare(uint64_t n) {
+        uint64_t r = uint64_t(__builtin_sqrtf(float(n)));
+        r += 1;
+        for (int i = 0; i < 6; ++i) r = (r + n / r) >> 1;
+        if (r > 0xffffffffULL) r = 0xffffffffULL;
+        while (r * r > n) --r;
+        while (r < 0xffffffffULL && (r + 1) * (r + 1) <= n) ++r;
+        return r * r == n;
+    }
+
+    static bool strongLucas(const Mont& m) {
+        uint64_t n = m.n;
+        int64_t D = 5;
+        for (int i = 0;; ++i) {
+            int j = jacobi(D > 0 ? uint64_t(D) : n - uint64_t(-D), n);
+            if (j == -1) break;
+            if (j == 0) return false;
+            if (i == 8 && isSquare(n)) return false;
+            D = D > 0 ? -(D + 2) : -D + 2;
+        }
+        int64_t Q = (1 - D) / 4;
+
+        uint64_t md = m.to(D > 0 ? uint64_t(D) : n - uint64_t(-D));
+        uint64_t mq = m.to(Q >= 0 ? uint64_t(Q) : n - uint64_t(-Q));
+
+        uint64_t d = n + 1;
+        int s = 0;
+        while ((d & 1) == 0) {
+            d >>= 1;
+            ++s;
+        }
+
+        uint64_t u = m.one, v = m.one, qk = mq;
+        for (int b = 62 - __builtin_clzll(d); b >= 0; --b) {
+            u = m.mul(u, v);
+            v = m.sub(m.mul(v, v), m.add(qk, qk));
+            qk = m.mul(qk, qk);
+            if ((d >> b) & 1) {
+                uint64_t du = m.mul(md, u);
+                u = m.half(m.add(u, v));
+                v = m.half(m.add(du, v));
+                qk = m.mul(qk, mq);
+            }
+        }
+        if (u == 0 || v == 0) return true;
+        for (int r = 1; r < s; ++r) {
+            v = m.sub(m.mul(v, v), m.add(qk, qk));
+            if (v == 0) return true;
+            qk = m.mul(qk, qk);
+        }
+        return false;
+    }
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <condition_variable>
+
+/*
+ * Throughput over a long stress run, sampled once a second on a thread of
+ * its own. The submit loop only calls completed() when a fence signals:
+ * three relaxed atomic adds, no lock, no I/O. The sampler turns the
+ * counters into per-second samples, writes them to CSV when asked and
+ * runs the degradation detector:
+ *
+ *  - the baseline is the mean of the last MonitorOptions::baselineSeconds
+ *    healthy samples, after warmupSeconds of clocks ramping up;
+ *  - a sample is low when it is more than dropFraction below the baseline,
+ *    and sustainSeconds low samples in a row are a drop, reported on
+ *    stderr when it starts and when throughput recovers;
+ *  - low samples never enter the baseline, so a drop does not lower the
+ *    bar it is measured against.
+ *
+ * A slow decline inside the baseline window is not a drop; the summary at
+ * stop() compares the first and the last baseline window for that.
+ *
+ * A sample counts the dispatches that completed in its second, so rates
+ * are only meaningful with several dispatches per second. gpu_busy is the
+ * GPU time of those dispatches per second, summed over the queues that
+ * submit them (so it can pass 1 with several), and empty without
+ * timestamps.
+ */
+
+struct MonitorOptions {
+    std::string csvPath;        // empty: no CSV
+    double dropFraction = 0.10; // below baseline by more than this is low
+    int baselineSeconds = 60;
+    int sustainSeconds = 5;
+    int warmupSeconds = 10;
+};
+
+// The value of --drop, a percentage strictly between 0 and 100, as a fraction.
+// Anything else throws a runtime_error the tools print with their usage.
+inline double parseDropPercent(const std::string& value) {
+    size_t end = 0;
+    double percent = 0.0;
+    try {
+        percent = std::stod(value, &end);
+    } catch (const std::logic_error&) {
+        end = 0; // not a number, or out of range
+    }
+    if (end == 0 || end != value.size() || !(percent > 0.0 && percent < 100.0)) throw std::runtime_error("--drop " + value + ": must be a percentage between 0 and 100");
+    return percent / 100.0;
+}
+
+class ThroughputMonitor {
+public:
+    // unit names what completed() counts ("numbers", "elements").
+    ThroughputMonitor(const std::string& unit, const MonitorOptions& options) : unit(unit), options(options) {
+        if (!options.csvPath.empty()) {
+            csv.open(options.csvPath);
+            if (!csv) throw std::runtime_error("Cannot write " + options.csvPath);
+            csv << "seconds,dispatches," << unit << "," << unit << "_per_second,gpu_busy,baseline,dropping" << std::endl;
+        }
+        start = Clock::now();
+        sampler = std::thread(&ThroughputMonitor::run, this);
+    }
+    ~ThroughputMonitor() { stop(); }
+    ThroughputMonitor(const ThroughputMonitor&) = delete;
+    ThroughputMonitor& operator=(const ThroughputMonitor&) = delete;
+
+    // One dispatch finished, worth units of work and gpuSeconds of GPU time
+    // (0 when the queue has no timestamps). Safe from any thread.
+    void completed(uint64_t units, double gpuSeconds = 0.0) {
+        dispatches.fetch_add(1, std::memory_order_relaxed);
+        workUnits.fetch_add(units, std::memory_order_relaxed);
+        gpuNanos.fetch_add(uint64_t(gpuSeconds * 1e9), std::memory_order_relaxed);
+    }
+
+    // Stops the sampler and prints the summary; once.
+    void stop(std::ostream& out = std::cout) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) return;
+            stopping = true;
+        }
+        wake.notify_all();
+        sampler.join();
+        summary(out);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Drop {
+        double startSeconds, seconds = 0, lowestRate, baseline;
+    };
+
+    void run() {
+        uint64_t lastDispatches = 0, lastUnits = 0, lastGpuNanos = 0;
+        Clock::time_point last = start;
+        for (int tick = 1;; ++tick) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (wake.wait_until(lock, start + std::chrono::seconds(tick), [this] { return stopping; })) return;
+            }
+            Clock::time_point now = Clock::now();
+            uint64_t d = dispatches.load(std::memory_order_relaxed), u = workUnits.load(std::memory_order_relaxed), g = gpuNanos.load(std::memory_order_relaxed);
+            double interval = std::chrono::duration<double>(now - last).count();
+            sample(std::chrono::duration<double>(now - start).count(), d - lastDispatches, u - lastUnits, (g - lastGpuNanos) * 1e-9, interval);
+            lastDispatches = d; lastUnits = u; lastGpuNanos = g; last = now;
+        }
+    }
+
+    void sample(double t, uint64_t newDispatches, uint64_t newUnits, double gpuSeconds, double interval) {
+        const double rate = newUnits / interval;
+        totalDispatches += newDispatches;
+        totalUnits += newUnits;
+        seconds = t;
+        if (t <= options.warmupSeconds) {
+            writeCsv(t, newDispatches, newUnits, rate, gpuSeconds / interval, NAN);
+            return;
+        }
+        if (firstWindow.size() < size_t(options.baselineSeconds)) firstWindow.push_back(rate);
+        lastWindow.push_back(rate);
+        if (lastWindow.size() > size_t(options.baselineSeconds)) lastWindow.pop_front();
+
+        const double baseline = healthy.size() >= size_t(options.sustainSeconds) ? healthySum / healthy.size() : NAN;
+        const bool low = !std::isnan(baseline) && rate < (1.0 - options.dropFraction) * baseline;
+        if (low) {
+            if (++lowRun == options.sustainSeconds) {
+                drops.push_back({t - lowRun + 1, 0, rate, baseline});
+                std::cerr << "[" << t << " s] THROUGHPUT DROP: " << rate / 1e6 << "M " << unit << "/s for " << lowRun << " s, "
+                          << 100.0 * (1.0 - rate / baseline) << "% below the baseline of " << baseline / 1e6 << "M" << std::endl;
+            }
+            if (lowRun >= options.sustainSeconds) {
+                drops.back().seconds = lowRun;
+                drops.back().lowestRate = std::min(drops.back().lowestRate, rate);
+            }
+        } else {
+            if (lowRun >= options.sustainSeconds) {
+                std::cerr << "[" << t << " s] Throughput recovered after " << lowRun << " s: " << rate / 1e6 << "M " << unit << "/s" << std::endl;
+            }
+            lowRun = 0;
+            healthy.push_back(rate);
+            healthySum += rate;
+            if (healthy.size() > size_t(options.baselineSeconds)) {
+                healthySum -= healthy.front();
+                healthy.pop_front();
+            }
+        }
+        writeCsv(t, newDispatches, newUnits, rate, gpuSeconds / interval, baseline);
+    }
+
+    void writeCsv(double t, uint64_t newDispatches, uint64_t newUnits, double rate, double gpuBusy, double baseline) {
+        if (!csv.is_open()) return;
+        char line[256];
+        std::snprintf(line, sizeof line, "%.3f,%llu,%llu,%.6g,", t, (unsigned long long)newDispatches, (unsigned long long)newUnits, rate);
+        csv << line;
+        if (gpuBusy > 0) csv << gpuBusy;
+        csv << ",";
+        if (!std::isnan(baseline)) csv << baseline;
+        csv << "," << (lowRun >= options.sustainSeconds ? 1 : 0) << "\n";
+        csv.flush();
+    }
+
+    static double mean(const std::deque<double>& xs) {
+        double sum = 0;
+        for (double x : xs) sum += x;
+        return xs.empty() ? NAN : sum / xs.size();
+    }
+
+    void summary(std::ostream& out) {
+        out << "--- Throughput: " << totalDispatches << " dispatches, " << double(totalUnits) / 1e9 << "G " << unit << " in " << seconds << " s";
+        if (seconds > 0) out << " (" << totalUnits / seconds / 1e6 << "M " << unit << "/s)";
+        out << std::endl;
+        const double first = mean(firstWindow), lastMean = mean(lastWindow);
+        if (!std::isnan(first) && seconds > options.warmupSeconds + 2.0 * options.baselineSeconds) {
+            out << "    first " << options.baselineSeconds << " s after warm-up: " << first / 1e6 << "M/s, last " << options.baselineSeconds << " s: "
+                << lastMean / 1e6 << "M/s (" << (lastMean >= first ? "+" : "") << 100.0 * (lastMean / first - 1.0) << "%)" << std::endl;
+        }
+        out << "    " << drops.size() << " sustained drop(s) of more than " << 100.0 * options.dropFraction << "% below the rolling baseline" << std::endl;
+        for (const Drop& d : drops) {
+            out << "      at " << d.startSeconds << " s for " << d.seconds << " s, down to " << d.lowestRate / 1e6 << "M/s ("
+                << 100.0 * (1.0 - d.lowestRate / d.baseline) << "% below " << d.baseline / 1e6 << "M/s)" << std::endl;
+        }
+        if (csv.is_open()) out << "    samples written to " << options.csvPath << std::endl;
+    }
+
+    const std::string unit;
+    const MonitorOptions options;
+    std::ofstream csv;
+    Clock::time_point start;
+    std::thread sampler;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    std::atomic<uint64_t> dispatches{0}, workUnits{0}, gpuNanos{0};
+
+    // Sampler thread only (and stop(), after joining it).
+    uint64_t totalDispatches = 0, totalUnits = 0;
+    double seconds = 0;
+    std::deque<double> healthy, firstWindow, lastWindow;
+    double healthySum = 0;
+    int lowRun = 0;
+    std::vector<Drop> drops;
+};
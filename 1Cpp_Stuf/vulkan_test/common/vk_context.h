@@ -0,0 +1,332 @@
+#pragma once
+
+#include <cstdint>
+#include <cctype>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vulkan/vulkan.h>
+
+/*
+ * Vulkan setup shared by the stress and benchmark tools: the instance,
+ * one physical device, a logical device with a compute queue, and the
+ * buffer and shader helpers every tool used to repeat.
+ *
+ * The device comes from a selector string (--device):
+ *  - ""            the first discrete GPU, else integrated, else virtual,
+ *                  and CPU implementations (lavapipe, SwiftShader) last;
+ *  - a number      its index in listDevices();
+ *  - 32 hex digits the device UUID (dashes are ignored);
+ *  - anything else part of the device name, case-insensitive, matching
+ *                  exactly one device.
+ * A CPU implementation is a valid target when selected or when it is the
+ * only device, which makes the tools usable on machines without a GPU.
+ *
+ * shaderInt64, shaderFloat64 and shaderInt16 are enabled when the device
+ * has them (the primality kernels need shaderInt64 and used to run
+ * without asking for it), and on Vulkan 1.2 devices storageBuffer16Bit-
+ * Access, shaderFloat16 and shaderInt8 too, in enabled11 / enabled12.
+ * subgroupOperations lists what subgroups can do in compute shaders.
+ *
+ * By default the device has one queue, computeQueue. With allQueues it
+ * gets every queue of every family instead, listed in queues (with
+ * computeQueue being the first one of its family), for the tools that
+ * measure transfer queues and async compute.
+ */
+
+struct VulkanQueue {
+    VkQueue queue;
+    uint32_t family;
+    uint32_t index;              // within the family
+    VkQueueFlags flags;
+    uint32_t timestampValidBits; // 0: no timestamps on this queue
+};
+
+struct VulkanContext {
+    VkInstance instance = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue computeQueue = VK_NULL_HANDLE;
+    uint32_t queueFamilyIndex = uint32_t(-1);
+    uint32_t deviceIndex = 0;
+    VkPhysicalDeviceProperties properties{};
+    VkPhysicalDeviceFeatures enabledFeatures{};
+    VkPhysicalDeviceVulkan11Features enabled11{}; // all false below Vulkan 1.2
+    VkPhysicalDeviceVulkan12Features enabled12{};
+    std::string uuid; // 32 hex digits
+    uint32_t subgroupSize = 0;
+    VkSubgroupFeatureFlags subgroupOperations = 0; // in compute shaders; 0 when the stage has none
+    double timestampPeriodNs = 0.0;
+    uint32_t timestampValidBits = 0; // 0: the compute queue has no timestamps
+    std::vector<VulkanQueue> queues; // every queue created, computeQueue included
+
+    explicit VulkanContext(const std::string& selector = "", const char* appName = "Vulkan Test", bool allQueues = false) {
+        try {
+            create(selector, appName, allQueues);
+        } catch (...) {
+            destroy();
+            throw;
+        }
+    }
+    ~VulkanContext() { destroy(); }
+    VulkanContext(const VulkanContext&) = delete;
+    VulkanContext& operator=(const VulkanContext&) = delete;
+
+    // Prints every device with the index, type and UUID a selector can use.
+    static void listDevices(std::ostream& out) {
+        VkInstance instance = createInstance("Vulkan Test");
+        std::vector<VkPhysicalDevice> devices = enumerate(instance);
+        for (uint32_t i = 0; i < devices.size(); ++i) {
+            VkPhysicalDeviceProperties props;
+            vkGetPhysicalDeviceProperties(devices[i], &props);
+            out << i << ": " << props.deviceName << " (" << typeName(props.deviceType) << ", uuid " << deviceUuid(devices[i]) << ")" << std::endl;
+        }
+        if (devices.empty()) out << "No devices with Vulkan support found." << std::endl;
+        vkDestroyInstance(instance, nullptr);
+    }
+
+    const char* deviceType() const { return typeName(properties.deviceType); }
+
+    // Ticks of the compute queue's timestamps that are valid.
+    uint64_t timestampMask() const { return timestampMask(timestampValidBits); }
+    static uint64_t timestampMask(uint32_t validBits) {
+        return validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+    }
+
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags memoryProperties) const {
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & memoryProperties) == memoryProperties) {
+                return i;
+            }
+        }
+        throw std::runtime_error("Failed to find suitable memory type!");
+    }
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties, VkBuffer& buffer, VkDeviceMemory& memory) const {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) throw std::runtime_error("Failed to create buffer");
+
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, memoryProperties);
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+            vkDestroyBuffer(device, buffer, nullptr);
+            buffer = VK_NULL_HANDLE;
+            throw std::runtime_error("Failed to allocate " + std::to_string(size) + " bytes of buffer memory");
+        }
+        vkBindBufferMemory(device, buffer, memory, 0);
+    }
+
+    // From SPIR-V in memory (the xxd-generated shader.h headers).
+    VkShaderModule createShaderModule(const void* code, size_t size) const {
+        VkShaderModule module;
+        VkShaderModuleCreateInfo smInfo{}; smInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO; smInfo.codeSize = size; smInfo.pCode = static_cast<const uint32_t*>(code);
+        if (vkCreateShaderModule(device, &smInfo, nullptr, &module) != VK_SUCCESS) throw std::runtime_error("Failed to create shader module");
+        return module;
+    }
+
+    // From a .spv file.
+    VkShaderModule loadShader(const std::string& path) const {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open()) throw std::runtime_error("Failed to open file: " + path);
+        std::vector<uint32_t> code((size_t(file.tellg()) + 3) / 4);
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(code.data()), code.size() * 4);
+        return createShaderModule(code.data(), code.size() * 4);
+    }
+
+    // Records commands with record(commandBuffer), submits them to the
+    // compute queue and waits: uploads, fills and other setup work.
+    template <typename Record>
+    void submitOnce(Record record) const {
+        VkCommandPool pool; VkCommandPoolCreateInfo cpInfo{}; cpInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO; cpInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; cpInfo.queueFamilyIndex = queueFamilyIndex;
+        if (vkCreateCommandPool(device, &cpInfo, nullptr, &pool) != VK_SUCCESS) throw std::runtime_error("Failed to create command pool");
+        VkCommandBuffer cb; VkCommandBufferAllocateInfo cbAllocInfo{}; cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO; cbAllocInfo.commandPool = pool; cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbAllocInfo.commandBufferCount = 1;
+        vkAllocateCommandBuffers(device, &cbAllocInfo, &cb);
+        VkCommandBufferBeginInfo beginInfo{}; beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO; beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(cb, &beginInfo);
+        record(cb);
+        vkEndCommandBuffer(cb);
+        VkSubmitInfo submitInfo{}; submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; submitInfo.commandBufferCount = 1; submitInfo.pCommandBuffers = &cb;
+        VkResult result = vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
+        if (result == VK_SUCCESS) result = vkQueueWaitIdle(computeQueue);
+        vkDestroyCommandPool(device, pool, nullptr);
+        if (result != VK_SUCCESS) throw std::runtime_error("vkQueueSubmit failed (device lost?)");
+    }
+
+private:
+    static VkInstance createInstance(const char* appName) {
+        VkInstance instance;
+        VkApplicationInfo appInfo{}; appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO; appInfo.pApplicationName = appName; appInfo.apiVersion = VK_API_VERSION_1_2;
+        VkInstanceCreateInfo instInfo{}; instInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO; instInfo.pApplicationInfo = &appInfo;
+        if (vkCreateInstance(&instInfo, nullptr, &instance) != VK_SUCCESS) throw std::runtime_error("Failed to create instance");
+        return instance;
+    }
+
+    static std::vector<VkPhysicalDevice> enumerate(VkInstance instance) {
+        uint32_t deviceCount = 0;
+        vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+        std::vector<VkPhysicalDevice> devices(deviceCount);
+        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+        devices.resize(deviceCount);
+        return devices;
+    }
+
+    static const char* typeName(VkPhysicalDeviceType type) {
+        switch (type) {
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+            case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+            default: return "other";
+        }
+    }
+
+    static std::string deviceUuid(VkPhysicalDevice physicalDevice) {
+        static const char hex[] = "0123456789abcdef";
+        VkPhysicalDeviceIDProperties idProperties{}; idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+        VkPhysicalDeviceProperties2 props2{}; props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2; props2.pNext = &idProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &props2);
+        std::string s;
+        for (uint32_t i = 0; i < VK_UUID_SIZE; ++i) {
+            s += hex[idProperties.deviceUUID[i] >> 4];
+            s += hex[idProperties.deviceUUID[i] & 15];
+        }
+        return s;
+    }
+
+    static std::string lower(std::string s) {
+        for (char& c : s) c = char(std::tolower((unsigned char)c));
+        return s;
+    }
+
+    // Index of the device the selector names; see the comment at the top.
+    static uint32_t select(const std::vector<VkPhysicalDevice>& devices, const std::string& selector) {
+        std::vector<VkPhysicalDeviceProperties> props(devices.size());
+        for (size_t i = 0; i < devices.size(); ++i) vkGetPhysicalDeviceProperties(devices[i], &props[i]);
+
+        if (selector.empty()) {
+            const VkPhysicalDeviceType preference[] = {VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU, VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU, VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU};
+            for (VkPhysicalDeviceType type : preference) {
+                for (uint32_t i = 0; i < devices.size(); ++i) {
+                    if (props[i].deviceType == type) return i;
+                }
+            }
+            return 0;
+        }
+        if (selector.find_first_not_of("0123456789") == std::string::npos) {
+            uint32_t index = uint32_t(std::stoul(selector));
+            if (index >= devices.size()) throw std::runtime_error("--device " + selector + ": there are only " + std::to_string(devices.size()) + " devices");
+            return index;
+        }
+        std::string hexDigits;
+        for (char c : selector) {
+            if (c != '-') hexDigits += char(std::tolower((unsigned char)c));
+        }
+        if (hexDigits.size() == 2 * VK_UUID_SIZE && hexDigits.find_first_not_of("0123456789abcdef") == std::string::npos) {
+            for (uint32_t i = 0; i < devices.size(); ++i) {
+                if (deviceUuid(devices[i]) == hexDigits) return i;
+            }
+            throw std::runtime_error("--device " + selector + ": no device has this UUID");
+        }
+        std::vector<uint32_t> matches;
+        for (uint32_t i = 0; i < devices.size(); ++i) {
+            if (lower(props[i].deviceName).find(lower(selector)) != std::string::npos) matches.push_back(i);
+        }
+        if (matches.empty()) throw std::runtime_error("--device " + selector + ": no device name contains it (see --list-devices)");
+        if (matches.size() > 1) throw std::runtime_error("--device " + selector + ": matches " + std::to_string(matches.size()) + " devices, use the index or UUID");
+        return matches[0];
+    }
+
+    void create(const std::string& selector, const char* appName, bool allQueues) {
+        instance = createInstance(appName);
+        std::vector<VkPhysicalDevice> devices = enumerate(instance);
+        if (devices.empty()) throw std::runtime_error("No GPUs with Vulkan support found!");
+        deviceIndex = select(devices, selector);
+        physicalDevice = devices[deviceIndex];
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        uuid = deviceUuid(physicalDevice);
+        VkPhysicalDeviceSubgroupProperties subgroup{}; subgroup.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+        VkPhysicalDeviceProperties2 props2{}; props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2; props2.pNext = &subgroup;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &props2);
+        subgroupSize = subgroup.subgroupSize;
+        if (subgroup.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) subgroupOperations = subgroup.supportedOperations;
+
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+        for (uint32_t i = 0; i < queueFamilyCount; ++i) {
+            if (queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+                queueFamilyIndex = i;
+                break;
+            }
+        }
+        if (queueFamilyIndex == uint32_t(-1)) throw std::runtime_error("Failed to find a compute queue family!");
+
+        VkPhysicalDeviceFeatures supported;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supported);
+        enabledFeatures.shaderInt64 = supported.shaderInt64;
+        enabledFeatures.shaderFloat64 = supported.shaderFloat64;
+        enabledFeatures.shaderInt16 = supported.shaderInt16;
+        enabled11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+        enabled12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        const bool vulkan12 = properties.apiVersion >= VK_API_VERSION_1_2;
+        if (vulkan12) {
+            VkPhysicalDeviceVulkan11Features supported11{}; supported11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+            VkPhysicalDeviceVulkan12Features supported12{}; supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+            VkPhysicalDeviceFeatures2 supported2{}; supported2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2; supported2.pNext = &supported11; supported11.pNext = &supported12;
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &supported2);
+            enabled11.storageBuffer16BitAccess = supported11.storageBuffer16BitAccess;
+            enabled12.shaderFloat16 = supported12.shaderFloat16;
+            enabled12.shaderInt8 = supported12.shaderInt8;
+        }
+
+        // Equal priorities: the multi-queue measurements compare queues, not the scheduler's preferences.
+        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+        uint32_t maxQueues = 1;
+        for (uint32_t i = 0; i < queueFamilyCount; ++i) maxQueues = std::max(maxQueues, queueFamilies[i].queueCount);
+        std::vector<float> queuePriorities(maxQueues, 1.0f);
+        for (uint32_t i = 0; i < queueFamilyCount; ++i) {
+            if (!allQueues && i != queueFamilyIndex) continue;
+            VkDeviceQueueCreateInfo queueCreateInfo{}; queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO; queueCreateInfo.queueFamilyIndex = i; queueCreateInfo.queueCount = allQueues ? queueFamilies[i].queueCount : 1; queueCreateInfo.pQueuePriorities = queuePriorities.data();
+            queueCreateInfos.push_back(queueCreateInfo);
+        }
+        VkPhysicalDeviceFeatures2 features2{}; features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2; features2.features = enabledFeatures;
+        if (vulkan12) { features2.pNext = &enabled11; enabled11.pNext = &enabled12; }
+        VkDeviceCreateInfo devInfo{}; devInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO; devInfo.pNext = &features2; devInfo.queueCreateInfoCount = uint32_t(queueCreateInfos.size()); devInfo.pQueueCreateInfos = queueCreateInfos.data();
+        VkResult created = vkCreateDevice(physicalDevice, &devInfo, nullptr, &device);
+        enabled11.pNext = nullptr;
+        if (created != VK_SUCCESS) throw std::runtime_error("Failed to create logical device");
+        for (const VkDeviceQueueCreateInfo& info : queueCreateInfos) {
+            for (uint32_t q = 0; q < info.queueCount; ++q) {
+                VulkanQueue queue{VK_NULL_HANDLE, info.queueFamilyIndex, q, queueFamilies[info.queueFamilyIndex].queueFlags, queueFamilies[info.queueFamilyIndex].timestampValidBits};
+                vkGetDeviceQueue(device, info.queueFamilyIndex, q, &queue.queue);
+                queues.push_back(queue);
+            }
+        }
+        vkGetDeviceQueue(device, queueFamilyIndex, 0, &computeQueue);
+
+        timestampPeriodNs = properties.limits.timestampPeriod;
+        timestampValidBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+    }
+
+    void destroy() {
+        if (device != VK_NULL_HANDLE) vkDestroyDevice(device, nullptr);
+        if (instance != VK_NULL_HANDLE) vkDestroyInstance(instance, nullptr);
+        device = VK_NULL_HANDLE;
+        instance = VK_NULL_HANDLE;
+    }
+};